@@ -62,9 +62,173 @@ THE SOFTWARE.
 #define HID_REPORTID_NKRO_KEYBOARD 8
 #endif
 
+#ifndef HID_REPORTID_CONSUMERCONTROL_BITMAP
+#define HID_REPORTID_CONSUMERCONTROL_BITMAP 9
+#endif
+
 
 // Nico has submitted these definitions upstream, but they're not merged yet
 // HID Request Type HID1.11 Page 51 7.2.1 Get_Report Request
 #define HID_REPORT_TYPE_INPUT   1
 #define HID_REPORT_TYPE_OUTPUT  2
 #define HID_REPORT_TYPE_FEATURE 3
+
+// Number of keyboard reports that can be waiting for the host to collect them. A single
+// call to `keyboard::Dispatcher::sendReport()` can produce up to three reports, so this
+// must be at least 3.
+#ifndef HID_KEYBOARD_REPORT_QUEUE_LENGTH
+#define HID_KEYBOARD_REPORT_QUEUE_LENGTH 4
+#endif
+
+// The range of plain (non-modifier) keycodes covered by the NKRO keyboard report. Every
+// keycode outside this range is silently ignored, so narrowing it shortens the report.
+#ifndef HID_KEYBOARD_NKRO_FIRST_KEY
+#define HID_KEYBOARD_NKRO_FIRST_KEY HID_KEYBOARD_A_AND_A
+#endif
+
+#ifndef HID_KEYBOARD_NKRO_LAST_KEY
+#define HID_KEYBOARD_NKRO_LAST_KEY HID_LAST_KEY
+#endif
+
+// Give each device its own HID interface and interrupt IN endpoint, instead of sharing the
+// multi-report `HID()` interface. The host can then collect reports from several devices
+// in the same frame, and the reports don't need a report ID. Each device can be set
+// individually; `HID_DEDICATED_ENDPOINTS` sets the default for all of them. Note that the
+// ATmega32u4 only has six endpoints besides the control endpoint, three of which are used
+// by the CDC serial port. The keyboard always has its own interface for boot protocol
+// reports (a dedicated endpoint moves its NKRO reports there too), and the absolute
+// mouse always has its own interface.
+#ifndef HID_DEDICATED_ENDPOINTS
+#define HID_DEDICATED_ENDPOINTS 0
+#endif
+
+#ifndef HID_KEYBOARD_DEDICATED_ENDPOINT
+#define HID_KEYBOARD_DEDICATED_ENDPOINT HID_DEDICATED_ENDPOINTS
+#endif
+
+#ifndef HID_MOUSE_DEDICATED_ENDPOINT
+#define HID_MOUSE_DEDICATED_ENDPOINT HID_DEDICATED_ENDPOINTS
+#endif
+
+#ifndef HID_CONSUMERCONTROL_DEDICATED_ENDPOINT
+#define HID_CONSUMERCONTROL_DEDICATED_ENDPOINT HID_DEDICATED_ENDPOINTS
+#endif
+
+#ifndef HID_SYSTEMCONTROL_DEDICATED_ENDPOINT
+#define HID_SYSTEMCONTROL_DEDICATED_ENDPOINT HID_DEDICATED_ENDPOINTS
+#endif
+
+#ifndef HID_GAMEPAD_DEDICATED_ENDPOINT
+#define HID_GAMEPAD_DEDICATED_ENDPOINT HID_DEDICATED_ENDPOINTS
+#endif
+
+// Polling intervals (the endpoint descriptors' `bInterval`), in milliseconds, for each
+// device that has its own interface. Valid values are 1-255. The shared `HID()` interface
+// always uses 1 ms, so these only apply to dedicated endpoints (and the keyboard's boot
+// protocol interface). Low-priority devices can be slowed down to leave more of the bus
+// to the keyboard.
+#ifndef HID_KEYBOARD_POLL_INTERVAL
+#define HID_KEYBOARD_POLL_INTERVAL 1
+#endif
+
+#ifndef HID_MOUSE_POLL_INTERVAL
+#define HID_MOUSE_POLL_INTERVAL 1
+#endif
+
+#ifndef HID_ABSOLUTEMOUSE_POLL_INTERVAL
+#define HID_ABSOLUTEMOUSE_POLL_INTERVAL 1
+#endif
+
+#ifndef HID_CONSUMERCONTROL_POLL_INTERVAL
+#define HID_CONSUMERCONTROL_POLL_INTERVAL 1
+#endif
+
+#ifndef HID_SYSTEMCONTROL_POLL_INTERVAL
+#define HID_SYSTEMCONTROL_POLL_INTERVAL 1
+#endif
+
+#ifndef HID_GAMEPAD_POLL_INTERVAL
+#define HID_GAMEPAD_POLL_INTERVAL 1
+#endif
+
+// Collect counters and a send latency histogram in the keyboard, consumer control,
+// system control and mouse dispatchers, readable by the host as one vendor-defined
+// feature report on the keyboard's interface (see
+// `kaleidoglyph/hid/stats.h`). The first latency bucket holds reports that were sent in
+// less than `HID_STATS_LATENCY_BASE_US` microseconds; each following bucket is twice as
+// wide.
+#ifndef HID_STATS
+#define HID_STATS 0
+#endif
+
+#ifndef HID_STATS_LATENCY_BASE_US
+#define HID_STATS_LATENCY_BASE_US 125
+#endif
+
+// How the keyboard dispatcher orders the reports for an update that changes modifiers:
+//   0: strict: plain key releases, then modifier changes, then presses (up to three
+//      reports, one per polling interval)
+//   1: two-phase: releases and modifier changes together, then presses (up to two)
+//   2: unordered: everything in a single report, for hosts that tolerate it
+// The policy can also be changed at runtime with
+// `keyboard::Dispatcher::setModifierOrdering()`.
+#ifndef HID_KEYBOARD_MODIFIER_ORDERING
+#define HID_KEYBOARD_MODIFIER_ORDERING 0
+#endif
+
+// Add a second consumer control report, with one bit for each of the most commonly used
+// Consumer page usages (see `consumer::BitmapUsages`), alongside the four-slot array
+// report. Keys in the bitmap can all be held at once, and are added and released in
+// constant time; any other usage still has to go in the array report.
+#ifndef HID_CONSUMERCONTROL_BITMAP
+#define HID_CONSUMERCONTROL_BITMAP 0
+#endif
+
+// Send system control keys as a bitmap with one bit for each usage from
+// `HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE` to `HID_SYSTEMCONTROL_BITMAP_LAST_USAGE`
+// (inclusive), so that more than one can be held at once, instead of as a single usage.
+// Usages outside the range are ignored in bitmap mode. The default range is Power Down
+// (0x81) to Warm Restart (0x8F).
+#ifndef HID_SYSTEMCONTROL_BITMAP
+#define HID_SYSTEMCONTROL_BITMAP 0
+#endif
+
+#ifndef HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE
+#define HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE 0x81
+#endif
+
+#ifndef HID_SYSTEMCONTROL_BITMAP_LAST_USAGE
+#define HID_SYSTEMCONTROL_BITMAP_LAST_USAGE 0x8F
+#endif
+
+// The number of fractional bits in the movement given to the mouse dispatcher's motion
+// accumulator (`mouse::Dispatcher::accumulate()`). With the default of 4, a value of 16
+// moves the pointer one unit; anything less is carried over to later reports.
+#ifndef HID_MOUSE_SUBPIXEL_BITS
+#define HID_MOUSE_SUBPIXEL_BITS 4
+#endif
+
+// Send the relative mouse's X and Y movement as 16-bit values instead of 8-bit ones, so
+// that a fast movement fits in one report. The wheels stay 8-bit.
+#ifndef HID_MOUSE_16BIT_AXES
+#define HID_MOUSE_16BIT_AXES 0
+#endif
+
+// The wheel resolution multiplier offered to the host by the relative mouse's Resolution
+// Multiplier feature. A host that enables it expects this many wheel units per detent,
+// which lets the motion accumulator scroll smoothly. It's only available with a dedicated
+// mouse endpoint, because the shared `HID()` interface doesn't pass feature reports on;
+// set it to 1 to leave the feature out.
+#ifndef HID_MOUSE_WHEEL_MULTIPLIER
+#define HID_MOUSE_WHEEL_MULTIPLIER 8
+#endif
+
+// The screen resolution used to map pixel coordinates to the absolute mouse's logical
+// range (see `mouse::absolute::Report::moveCursorToPixel()`).
+#ifndef HID_ABSOLUTEMOUSE_SCREEN_WIDTH
+#define HID_ABSOLUTEMOUSE_SCREEN_WIDTH 1920
+#endif
+
+#ifndef HID_ABSOLUTEMOUSE_SCREEN_HEIGHT
+#define HID_ABSOLUTEMOUSE_SCREEN_HEIGHT 1080
+#endif
@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/acceleration.h"
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace hid {
+namespace mouse {
+
+void Accelerator::setDirection(int8_t x, int8_t y) {
+  x_direction_ = x;
+  y_direction_ = y;
+  if (x == 0 && y == 0)
+    held_ticks_ = 0;
+}
+
+void Accelerator::tick(int16_t& x, int16_t& y) {
+  x = 0;
+  y = 0;
+  // An empty curve has no speed to look up.
+  if (curve_length_ == 0 || (x_direction_ == 0 && y_direction_ == 0))
+    return;
+
+  byte i = (held_ticks_ < curve_length_) ? held_ticks_ : (curve_length_ - 1);
+  uint16_t speed = pgm_read_word(&curve_[i]);
+  if (held_ticks_ < curve_length_)
+    ++held_ticks_;
+
+  // 181/256 is close enough to 1/sqrt(2).
+  if (x_direction_ != 0 && y_direction_ != 0)
+    speed = (uint32_t(speed) * 181) >> 8;
+
+  if (x_direction_ != 0)
+    x = (x_direction_ > 0) ? int16_t(speed) : -int16_t(speed);
+  if (y_direction_ != 0)
+    y = (y_direction_ > 0) ? int16_t(speed) : -int16_t(speed);
+}
+
+} // namespace mouse {
+} // namespace hid {
+} // namespace kaleidoglyph {
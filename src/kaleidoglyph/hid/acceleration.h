@@ -0,0 +1,126 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "kaleidoglyph/hid/descriptor.h"
+#include "kaleidoglyph/hid/mouse.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace mouse {
+
+// Fixed-point acceleration for mouse keys. A curve gives the speed, in the accumulator's
+// subpixel units (see `HID_MOUSE_SUBPIXEL_BITS`) per tick, for each tick that a movement
+// key has been held, and is stored in PROGMEM; after the last entry, the speed stays the
+// same. A curve is described by a struct with a `length` and a constexpr `speed(i)`, like
+// `QuadraticCurve`, and `CurveTable<MyCurve>` turns it into a table. An `Accelerator`
+// then just has to look up one table entry per tick, with no floating point at all.
+
+// A curve that starts at `_initial_speed`, and eases in to `_max_speed` over
+// `_ramp_ticks` ticks, with the speed increasing with the square of the time held.
+template <uint16_t _initial_speed, uint16_t _max_speed, byte _ramp_ticks>
+struct QuadraticCurve {
+  static_assert(_initial_speed <= _max_speed,
+                "A mouse key acceleration curve mustn't slow down");
+  static_assert(_max_speed <= INT16_MAX,
+                "Mouse key speeds must fit in an int16_t");
+  static_assert(_ramp_ticks > 0 && _ramp_ticks < 0xFF,
+                "Mouse key acceleration curves must have 2 to 255 entries");
+
+  static constexpr byte length = _ramp_ticks + 1;
+  static constexpr uint16_t speed(byte i) {
+    return _initial_speed +
+      (uint32_t(_max_speed - _initial_speed) * i * i) / (uint32_t(_ramp_ticks) * _ramp_ticks);
+  }
+};
+
+template <typename _Curve,
+          typename _Indices = typename descriptor::MakeIndices<_Curve::length>::type>
+struct CurveTable;
+
+template <typename _Curve, byte... _i>
+struct CurveTable<_Curve, descriptor::Indices<_i...>> {
+  static_assert(sizeof...(_i) > 0, "A mouse key acceleration curve can't be empty");
+
+  static constexpr byte length = sizeof...(_i);
+  static const uint16_t data[sizeof...(_i)] PROGMEM;
+};
+
+template <typename _Curve, byte... _i>
+const uint16_t CurveTable<_Curve, descriptor::Indices<_i...>>::data[sizeof...(_i)] PROGMEM = {
+  _Curve::speed(_i)...
+};
+
+// Turns the directions of the held mouse keys into movement. Call `setDirection()` when
+// the keys change, and `moveCursor()` (or `scroll()`) once per tick while any are held.
+// For example:
+//
+//   typedef CurveTable<QuadraticCurve<8, 160, 40>> CursorCurve;
+//   Accelerator cursor(CursorCurve::data, CursorCurve::length);
+//
+// The table can be any PROGMEM array of speeds no greater than `INT16_MAX`. With an
+// empty table (`curve_length` 0), there's no movement at all.
+class Accelerator {
+
+ public:
+  Accelerator(const uint16_t* curve, byte curve_length)
+      : curve_(curve), curve_length_(curve_length) {}
+
+  // Each direction is -1, 0 or 1. When nothing is held, the acceleration starts over.
+  void setDirection(int8_t x, int8_t y);
+
+  // The movement for the next tick, in subpixel units. Diagonal movement is scaled by
+  // 1/sqrt(2), so it isn't any faster than straight movement.
+  void tick(int16_t& x, int16_t& y);
+
+  // Add the next tick's movement to the dispatcher's motion accumulator.
+  void moveCursor(Dispatcher& dispatcher) {
+    int16_t x, y;
+    tick(x, y);
+    dispatcher.accumulate(x, y);
+  }
+  // Likewise, but for the wheels: `y` is the vertical wheel and `x` the horizontal one.
+  void scroll(Dispatcher& dispatcher) {
+    int16_t x, y;
+    tick(x, y);
+    dispatcher.accumulate(0, 0, y, x);
+  }
+
+ private:
+  const uint16_t* curve_;
+  byte curve_length_;
+  byte held_ticks_{0};
+  int8_t x_direction_{0};
+  int8_t y_direction_{0};
+
+};
+
+} // namespace mouse {
+} // namespace hid {
+} // namespace kaleidoglyph {
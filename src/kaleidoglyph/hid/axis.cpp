@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/axis.h"
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace hid {
+namespace gamepad {
+
+namespace {
+
+constexpr int16_t max_value = 32767;
+
+// The factor (16.16 fixed point) that scales `range` to `max_value`.
+uint32_t scaleFor(uint16_t range) {
+  return (uint32_t(max_value) << 16) / range;
+}
+
+} // namespace {
+
+void Axis::calibrate(int16_t min, int16_t center, int16_t max) {
+  center_ = center;
+  int32_t negative_range = int32_t(center) - min - deadzone_;
+  int32_t positive_range = int32_t(max) - center - deadzone_;
+  negative_range_ = (negative_range > 0) ? negative_range : 1;
+  positive_range_ = (positive_range > 0) ? positive_range : 1;
+  // The only divisions are here, not in `update()`.
+  negative_scale_ = scaleFor(negative_range_);
+  positive_scale_ = scaleFor(positive_range_);
+}
+
+bool Axis::update(int16_t raw) {
+  // The average has 8 fractional bits, so that small weights don't round away.
+  int32_t reading = int32_t(raw) * 256;
+  if (!has_average_) {
+    average_ = reading;
+    has_average_ = true;
+  } else {
+    // Rounded, so that the average can actually reach the reading.
+    int32_t half = (int32_t(1) << smoothing_shift_) >> 1;
+    average_ += (reading - average_ + half) >> smoothing_shift_;
+  }
+
+  // The average can stop just short of the reading, so it's rounded to the nearest raw
+  // unit, rather than truncated.
+  int16_t value = scale_((average_ + 128) >> 8);
+  int32_t change = int32_t(value) - value_;
+  if (change < 0)
+    change = -change;
+  bool at_rest_or_end = (value == 0 || value == max_value || value == -max_value);
+  if (value == value_ || (change < threshold_ && !at_rest_or_end))
+    return false;
+  value_ = value;
+  return true;
+}
+
+int16_t Axis::scale_(int16_t reading) const {
+  int32_t offset = int32_t(reading) - center_;
+  if (offset > deadzone_) {
+    uint32_t distance = offset - deadzone_;
+    if (distance >= positive_range_)
+      return max_value;
+    return (distance * positive_scale_) >> 16;
+  }
+  if (offset < -int32_t(deadzone_)) {
+    uint32_t distance = -offset - deadzone_;
+    if (distance >= negative_range_)
+      return -max_value;
+    return -int16_t((distance * negative_scale_) >> 16);
+  }
+  return 0;
+}
+
+} // namespace gamepad {
+} // namespace hid {
+} // namespace kaleidoglyph {
@@ -0,0 +1,101 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace hid {
+namespace gamepad {
+
+// Conditions the raw readings from one analog axis (e.g. an ADC channel) for the gamepad
+// report, all in integer arithmetic:
+//
+//  1. smoothing: an exponential moving average, with a weight of 1/2^`smoothing_shift`
+//     for each new reading (0 turns it off), kept with 8 fractional bits;
+//  2. calibration: the reading is centred on the calibrated rest position, and each
+//     side is scaled (by a 16.16 fixed-point factor worked out in `calibrate()`) so that
+//     the calibrated minimum and maximum map to -32767 and 32767;
+//  3. deadzone: readings within `deadzone` raw units of the centre are 0, and the scale
+//     starts from the edge of the deadzone, so there's no jump when leaving it;
+//  4. change threshold: the output only changes when it moves by at least `threshold`
+//     (or reaches the centre or either end), so that noise doesn't change the report,
+//     and the gamepad dispatcher can suppress it as a duplicate.
+//
+// For example, for a 10-bit ADC:
+//
+//   gamepad::Axis x_axis(8, 2, 64);  // deadzone, smoothing shift, threshold
+//   x_axis.calibrate(0, 512, 1023);
+//   ...
+//   if (x_axis.update(analogRead(A0)))
+//     report.setXAxis(x_axis.value());
+class Axis {
+
+ public:
+  Axis(uint16_t deadzone, byte smoothing_shift, uint16_t threshold)
+      : deadzone_(deadzone), smoothing_shift_(smoothing_shift), threshold_(threshold) {}
+
+  // Set the raw readings at either end of the axis, and at rest.
+  void calibrate(int16_t min, int16_t center, int16_t max);
+
+  // Add a raw reading. Returns `true` if the output value has changed.
+  bool update(int16_t raw);
+
+  // The output, from -32767 to 32767 (for the 16-bit axes).
+  int16_t value() const {
+    return value_;
+  }
+  // The output, scaled to -127 to 127 (for the 8-bit axes). It's rounded towards zero,
+  // so both sides of the axis are the same.
+  int8_t value8() const {
+    return (value_ + ((value_ < 0) ? 0xFF : 0)) >> 8;
+  }
+
+ private:
+  uint16_t deadzone_;
+  byte smoothing_shift_;
+  uint16_t threshold_;
+
+  int16_t center_{0};
+  // The distance from the edge of the deadzone to each end, in raw units, and the factor
+  // that scales it to 32767.
+  uint16_t negative_range_{1};
+  uint16_t positive_range_{1};
+  uint32_t negative_scale_{0};
+  uint32_t positive_scale_{0};
+
+  int32_t average_{0};
+  bool has_average_{false};
+  int16_t value_{0};
+
+  int16_t scale_(int16_t reading) const;
+
+};
+
+} // namespace gamepad {
+} // namespace hid {
+} // namespace kaleidoglyph {
@@ -0,0 +1,132 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace hid {
+namespace bitmap {
+
+// These kernels operate on report bitmaps one machine word at a time, with no
+// data-dependent branches inside the loops; each one folds its result into an
+// accumulator and tests it once at the end. The AVR is an 8-bit machine, so there the
+// word is a single byte (wider types would only add register pressure). Elsewhere,
+// words are loaded and stored with `memcpy()`, which compiles to plain (unaligned-safe)
+// loads and stores. The `size` argument is always a compile-time constant, so the
+// compiler can fully unroll the tail loops. Defining `HID_BITMAP_BYTE_WORDS` gives the
+// AVR's byte-sized words on other targets, too, so that its kernels can be benchmarked on
+// a host.
+
+#if defined(__AVR__) || defined(HID_BITMAP_BYTE_WORDS)
+typedef uint8_t word_t;
+#else
+typedef uint32_t word_t;
+#endif
+
+inline word_t load(const byte* p) {
+  word_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+inline void store(byte* p, word_t w) {
+  memcpy(p, &w, sizeof(w));
+}
+
+// Return `true` if the two bitmaps are identical.
+inline bool equal(const byte* a, const byte* b, byte size) {
+  word_t diff{0};
+  byte i{0};
+  for (; i + sizeof(word_t) <= size; i += sizeof(word_t))
+    diff |= load(a + i) ^ load(b + i);
+  byte tail{0};
+  for (; i < size; ++i)
+    tail |= a[i] ^ b[i];
+  return (diff | tail) == 0;
+}
+
+// A copy has no result to accumulate, and the compiler already expands a fixed-size
+// `memcpy()` inline, which beats a word loop (see `keyboard_trace_copy_*` in
+// `test/bench.cpp`).
+inline void copy(byte* dst, const byte* src, byte size) {
+  memcpy(dst, src, size);
+}
+
+// Return `true` if any bit set in `a` is not set in `b`.
+inline bool hasBitsNotIn(const byte* a, const byte* b, byte size) {
+  word_t extra{0};
+  byte i{0};
+  for (; i + sizeof(word_t) <= size; i += sizeof(word_t))
+    extra |= load(a + i) & ~load(b + i);
+  byte tail{0};
+  for (; i < size; ++i)
+    tail |= a[i] & ~b[i];
+  return (extra | tail) != 0;
+}
+
+// Clear any bits in `dst` that are not set in `mask`. Return `true` if any were cleared.
+inline bool intersect(byte* dst, const byte* mask, byte size) {
+  word_t cleared{0};
+  byte i{0};
+  for (; i + sizeof(word_t) <= size; i += sizeof(word_t)) {
+    word_t w = load(dst + i);
+    word_t m = load(mask + i);
+    cleared |= w & ~m;
+    store(dst + i, w & m);
+  }
+  byte tail{0};
+  for (; i < size; ++i) {
+    tail |= dst[i] & ~mask[i];
+    dst[i] &= mask[i];
+  }
+  return (cleared | tail) != 0;
+}
+
+// Clear the bits in `releases`, then set the bits in `presses`. Return `true` if `dst`
+// changed.
+inline bool apply(byte* dst, const byte* presses, const byte* releases, byte size) {
+  word_t changed{0};
+  byte i{0};
+  for (; i + sizeof(word_t) <= size; i += sizeof(word_t)) {
+    word_t w = load(dst + i);
+    word_t updated = (w & ~load(releases + i)) | load(presses + i);
+    changed |= w ^ updated;
+    store(dst + i, updated);
+  }
+  byte tail{0};
+  for (; i < size; ++i) {
+    byte updated = (dst[i] & ~releases[i]) | presses[i];
+    tail |= dst[i] ^ updated;
+    dst[i] = updated;
+  }
+  return (changed | tail) != 0;
+}
+
+} // namespace bitmap {
+} // namespace hid {
+} // namespace kaleidoglyph {
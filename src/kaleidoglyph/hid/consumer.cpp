@@ -28,27 +28,56 @@ THE SOFTWARE.
 
 #include <kaleidoglyph/utils.h>
 #include "DescriptorPrimitives.h"
+#include "kaleidoglyph/hid/descriptor.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace consumer {
 
-static const PROGMEM byte consumer_control_descriptor[] = {
+using namespace descriptor;
+
+typedef Descriptor<
   // Consumer Control (Sound/Media keys)
-  D_USAGE_PAGE, 0x0C,                          // usage page (consumer device) 
-  D_USAGE, 0x01,                               // usage -- consumer control 
-  D_COLLECTION, D_APPLICATION,                 // collection (application) 
-  D_REPORT_ID, HID_REPORTID_CONSUMERCONTROL,   // report id 
-  // 4 Media Keys 
-  D_LOGICAL_MINIMUM, 0x00,                     // logical minimum 
-  D_MULTIBYTE(D_LOGICAL_MAXIMUM), 0xFF, 0x03,  // logical maximum (3ff) 
-  D_USAGE_MINIMUM, 0x00,                       // usage minimum (0) 
-  D_MULTIBYTE(D_USAGE_MAXIMUM), 0xFF, 0x03,    // usage maximum (3ff) 
-  D_REPORT_COUNT, 0x04,                        // report count (4) 
-  D_REPORT_SIZE, 0x10,                         // report size (16) 
-  D_INPUT, 0x00,                               // input 
-  D_END_COLLECTION                             // end collection 
-};
+  UsagePage<D_PAGE_CONSUMER>,                  // usage page (consumer device)
+  Usage<0x01>,                                 // usage -- consumer control
+  Collection<D_APPLICATION>,                   // collection (application)
+  ReportId<report_id>,                         // report id
+  // 4 Media Keys
+  LogicalMinimum<0>,                           // logical minimum
+  LogicalMaximum<0x3ff>,                       // logical maximum (3ff)
+  UsageMinimum<0>,                             // usage minimum (0)
+  UsageMaximum<0x3ff>,                         // usage maximum (3ff)
+  ReportCount<4>,                              // report count (4)
+  ReportSize<16>,                              // report size (16)
+  Input<0x00>,                                 // input
+  EndCollection                                // end collection
+> ConsumerControlDescriptor;
+
+static_assert(ConsumerControlDescriptor::input_bytes == sizeof(Report),
+              "Consumer control descriptor doesn't match the report size");
+
+typedef Descriptor<
+  // Consumer Control (one bit per usage)
+  UsagePage<D_PAGE_CONSUMER>,                  // usage page (consumer device)
+  Usage<0x01>,                                 // usage -- consumer control
+  Collection<D_APPLICATION>,                   // collection (application)
+  ReportId<bitmap_report_id>,                  // report id
+  LogicalMinimum<0>,                           // logical minimum (0)
+  LogicalMaximum<1>,                           // logical maximum (1)
+  ReportSize<1>,                               // report size (1)
+  ReportCount<BitmapUsages::count>,            // report count
+  BitmapUsages::usages,                        // usages, in bit order
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,         // input (data, variable, absolute)
+  InputPadding<(BitmapReport::size * 8) - BitmapUsages::count>,
+  EndCollection                                // end collection
+> BitmapDescriptor;
+
+static_assert(BitmapDescriptor::input_bytes == sizeof(BitmapReport),
+              "Consumer control bitmap descriptor doesn't match the report size");
+
+typedef Select<HID_CONSUMERCONTROL_BITMAP,
+               Descriptor<ConsumerControlDescriptor, BitmapDescriptor>,
+               ConsumerControlDescriptor>::type InterfaceDescriptor;
 
 void Report::clear() {
   memset(keycodes_, 0, sizeof(keycodes_));
@@ -79,33 +108,149 @@ void Report::updateFrom(const Report& new_report) {
   memcpy(keycodes_, new_report.keycodes_, sizeof(keycodes_));
 }
 
-Dispatcher::Dispatcher() {
-  static HIDSubDescriptor node(consumer_control_descriptor,
-                               sizeof(consumer_control_descriptor));
-  HID().AppendDescriptor(&node);
+bool BitmapReport::addUsage(uint16_t usage) {
+  byte i = BitmapUsages::index(usage);
+  if (i == 0xFF)
+    return false;
+  bits_[i / 8] |= (1 << (i % 8));
+  return true;
+}
+
+bool BitmapReport::releaseUsage(uint16_t usage) {
+  byte i = BitmapUsages::index(usage);
+  if (i == 0xFF)
+    return false;
+  bits_[i / 8] &= ~(1 << (i % 8));
+  return true;
 }
 
+Dispatcher::Dispatcher()
+    : Interface<HID_CONSUMERCONTROL_DEDICATED_ENDPOINT>(
+        InterfaceDescriptor::data(), InterfaceDescriptor::length,
+        poll_interval) {}
+
 void Dispatcher::init() {
+  plug();
+  stats_.publish(stats::Source::consumer);
   last_report_.clear();
   sendReport(last_report_);
+#if HID_CONSUMERCONTROL_BITMAP
+  last_bitmap_report_.clear();
+  sendReportUnchecked_(last_bitmap_report_);
+#endif
 }
 
-void Dispatcher::sendReportUnchecked_(const Report& report) {
-  HID().SendReport(HID_REPORTID_CONSUMERCONTROL,
-                   report.keycodes_, sizeof(report.keycodes_));
+// The report the host already has isn't sent again (and replaces any waiting report of
+// the same kind).
+void Dispatcher::suppressDuplicate_() {
+  stats_.duplicateSuppressed();
+  if (!hasPendingReports())
+    stats_.clearQueue();
 }
 
-void Dispatcher::sendReport(const Report& report) {
+SendStatus Dispatcher::sendReportUnchecked_(const Report& report) {
+  stats_.reportQueued();
+  int result = sendReport_(report_id, report.keycodes_, sizeof(report.keycodes_));
+  stats_.reportSent(result);
+  SendStatus status = sendStatus(result);
+  has_pending_report_ = (status == SendStatus::host_busy);
+  if (has_pending_report_) {
+    pending_report_.updateFrom(report);
+    return SendStatus::queued;
+  }
+  if (status == SendStatus::sent) {
+    last_report_.updateFrom(report);
+  } else if (!hasPendingReports()) {
+    stats_.clearQueue();
+  }
+  return status;
+}
+
+SendStatus Dispatcher::sendReport(const Report& report) {
   // If the last report is different than the current report, then we need to send a
   // report. We guard sendReport like this so that calling code doesn't end up spamming
   // the host with empty reports if sendReport is called in a tight loop.
 
   // if the previous report is the same, return early without a new report.
-  if (report == last_report_)
-    return;
+  if (report == last_report_) {
+    has_pending_report_ = false;
+    suppressDuplicate_();
+    return SendStatus::sent;
+  }
+
+  return sendReportUnchecked_(report);
+}
 
+SendStatus Dispatcher::trySendReport(const Report& report) {
+  if (report == last_report_) {
+    has_pending_report_ = false;
+    suppressDuplicate_();
+    return SendStatus::sent;
+  }
+  pending_report_.updateFrom(report);
+  has_pending_report_ = true;
+  stats_.reportQueued();
+  return SendStatus::queued;
+}
+
+#if HID_CONSUMERCONTROL_BITMAP
+SendStatus Dispatcher::sendReportUnchecked_(const BitmapReport& report) {
+  stats_.reportQueued();
+  int result = sendReport_(bitmap_report_id, report.bits_, sizeof(report.bits_));
+  stats_.reportSent(result);
+  SendStatus status = sendStatus(result);
+  has_pending_bitmap_report_ = (status == SendStatus::host_busy);
+  if (has_pending_bitmap_report_) {
+    pending_bitmap_report_.updateFrom(report);
+    return SendStatus::queued;
+  }
+  if (status == SendStatus::sent) {
+    last_bitmap_report_.updateFrom(report);
+  } else if (!hasPendingReports()) {
+    stats_.clearQueue();
+  }
+  return status;
+}
+
+SendStatus Dispatcher::sendReport(const BitmapReport& report) {
+  if (report == last_bitmap_report_) {
+    has_pending_bitmap_report_ = false;
+    suppressDuplicate_();
+    return SendStatus::sent;
+  }
+  return sendReportUnchecked_(report);
+}
+
+SendStatus Dispatcher::trySendReport(const BitmapReport& report) {
+  if (report == last_bitmap_report_) {
+    has_pending_bitmap_report_ = false;
+    suppressDuplicate_();
+    return SendStatus::sent;
+  }
+  pending_bitmap_report_.updateFrom(report);
+  has_pending_bitmap_report_ = true;
+  stats_.reportQueued();
+  return SendStatus::queued;
+}
+#endif
+
+bool Dispatcher::poll() {
+  if (!hasPendingReports())
+    return false;
+  if (byte(UDFNUML - last_send_frame_) < poll_interval)
+    return false;
+  last_send_frame_ = UDFNUML;
+  // Only one report per call; if both are waiting, the bitmap report goes next time.
+  if (has_pending_report_) {
+    Report report = pending_report_;
+    sendReportUnchecked_(report);
+    return true;
+  }
+#if HID_CONSUMERCONTROL_BITMAP
+  BitmapReport report = pending_bitmap_report_;
   sendReportUnchecked_(report);
-  last_report_.updateFrom(report);
+#endif
+  return true;
 }
 
 } //
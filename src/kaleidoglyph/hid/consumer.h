@@ -35,11 +35,20 @@ THE SOFTWARE.
 
 #include <kaleidoglyph/Key.h>
 #include <kaleidoglyph/utils.h>
+#include "kaleidoglyph/hid/interface.h"
+#include "kaleidoglyph/hid/stats.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace consumer {
 
+// The array report only needs a report ID if it's sharing an interface, either the
+// shared `HID()` interface or its own with the bitmap report.
+constexpr byte report_id =
+  reportId(HID_CONSUMERCONTROL_DEDICATED_ENDPOINT && !HID_CONSUMERCONTROL_BITMAP,
+           HID_REPORTID_CONSUMERCONTROL);
+constexpr byte bitmap_report_id = HID_REPORTID_CONSUMERCONTROL_BITMAP;
+
 class Report {
 
   friend class Dispatcher;
@@ -56,16 +65,255 @@ class Report {
 
 };
 
-class Dispatcher {
+// ----------------------------------------------------------------------------
+// Bitmap report
+
+namespace usage_map {
+
+// Constant expression helpers for `UsageMap`, which can only be written as single
+// recursive return statements in C++11.
+
+constexpr uint16_t last(uint16_t usage) {
+  return usage;
+}
+template <typename... _Usages>
+constexpr uint16_t last(uint16_t, _Usages... usages) {
+  return last(usages...);
+}
+
+constexpr bool ascending(uint16_t) {
+  return true;
+}
+template <typename... _Usages>
+constexpr bool ascending(uint16_t a, uint16_t b, _Usages... usages) {
+  return (a < b) && ascending(b, usages...);
+}
+
+// The position of `usage` in the list, or `0xFF` if it's not there.
+constexpr byte find(uint16_t, byte) {
+  return 0xFF;
+}
+template <typename... _Usages>
+constexpr byte find(uint16_t usage, byte i, uint16_t first, _Usages... usages) {
+  return (usage == first) ? i : find(usage, i + 1, usages...);
+}
+
+// `true` if any usage in the list is in block `b` (i.e. `usage >> 4 == b`).
+constexpr bool inBlock(byte) {
+  return false;
+}
+template <typename... _Usages>
+constexpr bool inBlock(byte b, uint16_t first, _Usages... usages) {
+  return ((first >> 4) == b) || inBlock(b, usages...);
+}
+
+// The number of blocks below `b` that contain any usages.
+template <typename... _Usages>
+constexpr byte usedBlocksBelow(byte b, _Usages... usages) {
+  return (b == 0) ? 0 : (usedBlocksBelow(b - 1, usages...) + inBlock(b - 1, usages...));
+}
+
+// The block number of the `slot`th used block, searching from block `b`.
+template <typename... _Usages>
+constexpr byte blockOfSlot(byte slot, byte b, _Usages... usages) {
+  return inBlock(b, usages...)
+    ? ((slot == 0) ? b : blockOfSlot(slot - 1, b + 1, usages...))
+    : blockOfSlot(slot, b + 1, usages...);
+}
+
+} // namespace usage_map {
+
+// A compact mapping from a sparse list of Consumer page usages (in ascending order) to
+// bit indexes 0 to N-1. The usage space is split into blocks of sixteen, and two PROGMEM
+// tables are used for the lookup: one with an entry for each block up to the highest
+// usage, giving the slot of that block in the second table (or `0xFF` if it's empty),
+// and one with sixteen bit indexes for each block that contains any usages. That's two
+// table reads per lookup, regardless of the length of the list.
+template <uint16_t... _usages>
+struct UsageMap {
+  static_assert(usage_map::ascending(_usages...),
+                "Bitmap usages must be listed in ascending order");
+
+  static constexpr byte count = sizeof...(_usages);
+  static constexpr byte block_count = (usage_map::last(_usages...) >> 4) + 1;
+  static constexpr byte used_block_count =
+    usage_map::usedBlocksBelow(block_count, _usages...);
+
+  static_assert(count < 0xFF, "Too many bitmap usages");
+  static_assert(used_block_count * 16 < 0xFF, "Bitmap usages are too widely spread");
+
+  static constexpr byte blockSlot(byte b) {
+    return usage_map::inBlock(b, _usages...)
+      ? usage_map::usedBlocksBelow(b, _usages...)
+      : 0xFF;
+  }
+  static constexpr byte slotIndex(byte i) {
+    return usage_map::find(
+      (usage_map::blockOfSlot(i / 16, 0, _usages...) * 16) + (i % 16), 0, _usages...);
+  }
+
+  // The bit index of `usage`, or `0xFF` if it's not in the map.
+  static byte index(uint16_t usage);
+
+  // A `Usage` item for each usage in the map, in bit order.
+  typedef descriptor::Descriptor<descriptor::Usage<_usages>...> usages;
+};
+
+namespace usage_map {
+
+template <typename _Map, typename _Indices>
+struct BlockSlots;
+
+template <typename _Map, byte... _i>
+struct BlockSlots<_Map, descriptor::Indices<_i...>> {
+  static const byte data[] PROGMEM;
+};
+
+template <typename _Map, byte... _i>
+const byte BlockSlots<_Map, descriptor::Indices<_i...>>::data[] PROGMEM = {
+  _Map::blockSlot(_i)...
+};
+
+template <typename _Map, typename _Indices>
+struct SlotIndices;
+
+template <typename _Map, byte... _i>
+struct SlotIndices<_Map, descriptor::Indices<_i...>> {
+  static const byte data[] PROGMEM;
+};
+
+template <typename _Map, byte... _i>
+const byte SlotIndices<_Map, descriptor::Indices<_i...>>::data[] PROGMEM = {
+  _Map::slotIndex(_i)...
+};
+
+} // namespace usage_map {
+
+template <uint16_t... _usages>
+byte UsageMap<_usages...>::index(uint16_t usage) {
+  typedef usage_map::BlockSlots<
+    UsageMap, typename descriptor::MakeIndices<block_count>::type> BlockSlots;
+  typedef usage_map::SlotIndices<
+    UsageMap, typename descriptor::MakeIndices<used_block_count * 16>::type> SlotIndices;
+
+  if (usage >= block_count * 16)
+    return 0xFF;
+  byte slot = pgm_read_byte(&BlockSlots::data[usage / 16]);
+  if (slot == 0xFF)
+    return 0xFF;
+  return pgm_read_byte(&SlotIndices::data[(slot * 16) + (usage % 16)]);
+}
+
+// The usages that get a bit in the bitmap report: the ones that keyboards with media keys
+// actually use.
+typedef UsageMap<
+  0x006F,  // Display Brightness Increment
+  0x0070,  // Display Brightness Decrement
+  0x00B0,  // Play
+  0x00B1,  // Pause
+  0x00B2,  // Record
+  0x00B3,  // Fast Forward
+  0x00B4,  // Rewind
+  0x00B5,  // Scan Next Track
+  0x00B6,  // Scan Previous Track
+  0x00B7,  // Stop
+  0x00B8,  // Eject
+  0x00CD,  // Play/Pause
+  0x00E2,  // Mute
+  0x00E9,  // Volume Increment
+  0x00EA,  // Volume Decrement
+  0x0183,  // AL Consumer Control Configuration (media player)
+  0x018A,  // AL Email Reader
+  0x0192,  // AL Calculator
+  0x0194,  // AL Local Machine Browser
+  0x0221,  // AC Search
+  0x0223,  // AC Home
+  0x0224,  // AC Back
+  0x0225,  // AC Forward
+  0x0226,  // AC Stop
+  0x0227,  // AC Refresh
+  0x022A   // AC Bookmarks
+> BitmapUsages;
+
+class BitmapReport {
+
+  friend class Dispatcher;
 
  public:
+  static constexpr byte size = (BitmapUsages::count + 7) / 8;
+
+  void clear() {
+    memset(bits_, 0, sizeof(bits_));
+  }
+  // These return `false` if `usage` doesn't have a bit in the report, in which case it
+  // needs to go in the array report instead.
+  bool addUsage(uint16_t usage);
+  bool releaseUsage(uint16_t usage);
+  bool operator==(const BitmapReport& other) const {
+    return (memcmp(bits_, other.bits_, sizeof(bits_)) == 0);
+  }
+  void updateFrom(const BitmapReport& new_report) {
+    memcpy(bits_, new_report.bits_, sizeof(bits_));
+  }
+
+ private:
+  byte bits_[size] = {};
+
+};
+
+static_assert(BitmapReport::size < USB_EP_SIZE,
+              "The consumer control bitmap report doesn't fit in a single packet");
+
+class Dispatcher : Interface<HID_CONSUMERCONTROL_DEDICATED_ENDPOINT> {
+
+ public:
+  static constexpr byte poll_interval = HID_CONSUMERCONTROL_POLL_INTERVAL;
+  static_assert(isValidPollInterval(HID_CONSUMERCONTROL_POLL_INTERVAL),
+                "Invalid consumer control polling interval");
+
   Dispatcher();
   void init();
-  void sendReportUnchecked_(const Report& report);
-  void sendReport(const Report& report);
+  // A report the host didn't accept is sent again by `poll()`, unless a newer one
+  // replaces it first. `last_report_` is only updated once the host accepts a report.
+  // `trySendReport()` just replaces the waiting report.
+  SendStatus sendReportUnchecked_(const Report& report);
+  SendStatus sendReport(const Report& report);
+  SendStatus trySendReport(const Report& report);
+#if HID_CONSUMERCONTROL_BITMAP
+  // The bitmap report is tracked separately from the array report, and either can be
+  // waiting to be sent by `poll()`.
+  SendStatus sendReportUnchecked_(const BitmapReport& report);
+  SendStatus sendReport(const BitmapReport& report);
+  SendStatus trySendReport(const BitmapReport& report);
+#endif
+  bool poll();
+  bool hasPendingReports() const {
+#if HID_CONSUMERCONTROL_BITMAP
+    return has_pending_report_ || has_pending_bitmap_report_;
+#else
+    return has_pending_report_;
+#endif
+  }
+
+  // Counters and latency histogram (only collected if `HID_STATS` is enabled). With the
+  // bitmap report, the two reports share them.
+  stats::Stats<1>& stats() {
+    return stats_;
+  }
 
  private:
   Report last_report_;
+  Report pending_report_;
+  bool has_pending_report_{false};
+  byte last_send_frame_{0};
+  stats::Stats<1> stats_;
+
+  void suppressDuplicate_();
+#if HID_CONSUMERCONTROL_BITMAP
+  BitmapReport last_bitmap_report_;
+  BitmapReport pending_bitmap_report_;
+  bool has_pending_bitmap_report_{false};
+#endif
 
 };
 
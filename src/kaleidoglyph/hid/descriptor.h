@@ -0,0 +1,320 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "DescriptorPrimitives.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace descriptor {
+
+// A compile-time HID report descriptor builder. Each item is a type; a `Descriptor` is a
+// list of items (or other descriptors, which lets fragments be shared). From that list
+// we get both the bytes of the descriptor, stored once in PROGMEM, and the lengths of
+// the input, output and feature reports it describes, which can be checked against the
+// report classes with `static_assert`. For example:
+//
+//   typedef Descriptor<
+//     UsagePage<D_PAGE_BUTTON>,
+//     UsageMinimum<1>, UsageMaximum<8>,
+//     LogicalMinimum<0>, LogicalMaximum<1>,
+//     ReportSize<1>, ReportCount<8>,
+//     Input<D_DATA|D_VARIABLE|D_ABSOLUTE>
+//   > Buttons;
+//
+//   static_assert(Buttons::input_bytes == 1, "");
+//
+// Item data is encoded in the smallest size that holds the value, so the numbers never
+// need to be split into bytes by hand.
+
+// `std::conditional`, which isn't available on AVR.
+template <bool _condition, typename _True, typename _False>
+struct Select {
+  typedef _True type;
+};
+
+template <typename _True, typename _False>
+struct Select<false, _True, _False> {
+  typedef _False type;
+};
+
+// `std::make_integer_sequence`, which isn't available either, for building PROGMEM
+// tables with one entry per index.
+template <byte... _i>
+struct Indices {};
+
+template <byte _n, byte... _i>
+struct MakeIndices : MakeIndices<_n - 1, _n - 1, _i...> {};
+
+template <byte... _i>
+struct MakeIndices<0, _i...> {
+  typedef Indices<_i...> type;
+};
+
+// ----------------------------------------------------------------------------
+// Byte sequences
+
+template <byte... _bytes>
+struct Bytes {
+  static constexpr uint16_t length = sizeof...(_bytes);
+  static const byte data[] PROGMEM;
+};
+
+template <byte... _bytes>
+const byte Bytes<_bytes...>::data[] PROGMEM = {_bytes...};
+
+template <typename... _Sequences>
+struct Concat;
+
+template <>
+struct Concat<> {
+  typedef Bytes<> type;
+};
+
+template <byte... _bytes>
+struct Concat<Bytes<_bytes...>> {
+  typedef Bytes<_bytes...> type;
+};
+
+template <byte... _a, byte... _b, typename... _Rest>
+struct Concat<Bytes<_a...>, Bytes<_b...>, _Rest...> {
+  typedef typename Concat<Bytes<_a..., _b...>, _Rest...>::type type;
+};
+
+// ----------------------------------------------------------------------------
+// Parser state
+
+// The global items that determine the size of main items, and the running totals of
+// report bits. Report IDs aren't tracked; each descriptor in this library describes at
+// most one report of each type.
+template <byte _report_size = 0, byte _report_count = 0,
+          uint16_t _input_bits = 0, uint16_t _output_bits = 0,
+          uint16_t _feature_bits = 0>
+struct State {
+  static constexpr byte report_size = _report_size;
+  static constexpr byte report_count = _report_count;
+  static constexpr uint16_t input_bits = _input_bits;
+  static constexpr uint16_t output_bits = _output_bits;
+  static constexpr uint16_t feature_bits = _feature_bits;
+};
+
+template <typename _State, typename... _Items>
+struct Fold;
+
+template <typename _State>
+struct Fold<_State> {
+  typedef _State type;
+};
+
+template <typename _State, typename _Item, typename... _Rest>
+struct Fold<_State, _Item, _Rest...> {
+  typedef typename Fold<typename _Item::template Apply<_State>::type, _Rest...>::type type;
+};
+
+// ----------------------------------------------------------------------------
+// Short items (HID 1.11 section 6.2.2.2)
+
+constexpr byte unsignedDataSize(uint32_t value) {
+  return (value <= 0xFF) ? 1 : (value <= 0xFFFF) ? 2 : 4;
+}
+
+constexpr byte signedDataSize(int32_t value) {
+  return ((value >= -128) && (value <= 127)) ? 1 :
+         ((value >= -32768) && (value <= 32767)) ? 2 : 4;
+}
+
+// The `D_*` item macros all include a data size of one byte; these are the bare tags.
+constexpr byte tag(byte item) {
+  return item & ~0x03;
+}
+
+template <byte _tag, uint32_t _value, byte _size>
+struct ShortItemBytes;
+
+template <byte _tag, uint32_t _value>
+struct ShortItemBytes<_tag, _value, 0> {
+  typedef Bytes<_tag> type;
+};
+
+template <byte _tag, uint32_t _value>
+struct ShortItemBytes<_tag, _value, 1> {
+  typedef Bytes<_tag | 1, byte(_value)> type;
+};
+
+template <byte _tag, uint32_t _value>
+struct ShortItemBytes<_tag, _value, 2> {
+  typedef Bytes<_tag | 2, byte(_value), byte(_value >> 8)> type;
+};
+
+template <byte _tag, uint32_t _value>
+struct ShortItemBytes<_tag, _value, 4> {
+  typedef Bytes<_tag | 3, byte(_value), byte(_value >> 8),
+                byte(_value >> 16), byte(_value >> 24)> type;
+};
+
+// An item that doesn't affect the report lengths.
+template <byte _item, uint32_t _value, byte _size>
+struct ShortItem {
+  typedef typename ShortItemBytes<tag(_item), _value, _size>::type bytes;
+  template <typename _State>
+  struct Apply {
+    typedef _State type;
+  };
+};
+
+template <byte _item, uint32_t _value>
+using UnsignedItem = ShortItem<_item, _value, unsignedDataSize(_value)>;
+
+template <byte _item, int32_t _value>
+using SignedItem = ShortItem<_item, uint32_t(_value), signedDataSize(_value)>;
+
+// Local and global items
+template <uint16_t _page>
+using UsagePage = UnsignedItem<D_USAGE_PAGE, _page>;
+template <uint16_t _usage>
+using Usage = UnsignedItem<D_USAGE, _usage>;
+template <uint16_t _usage>
+using UsageMinimum = UnsignedItem<D_USAGE_MINIMUM, _usage>;
+template <uint16_t _usage>
+using UsageMaximum = UnsignedItem<D_USAGE_MAXIMUM, _usage>;
+template <int32_t _value>
+using LogicalMinimum = SignedItem<D_LOGICAL_MINIMUM, _value>;
+template <int32_t _value>
+using LogicalMaximum = SignedItem<D_LOGICAL_MAXIMUM, _value>;
+template <int32_t _value>
+using PhysicalMinimum = SignedItem<D_PHYSICAL_MINIMUM, _value>;
+template <int32_t _value>
+using PhysicalMaximum = SignedItem<D_PHYSICAL_MAXIMUM, _value>;
+
+// Report ID zero means "no report ID", and emits nothing, so the same descriptor can be
+// used on a shared or a dedicated interface.
+template <byte _id>
+struct ReportId {
+  typedef typename Select<_id == 0, Bytes<>, Bytes<D_REPORT_ID, _id>>::type bytes;
+  template <typename _State>
+  struct Apply {
+    typedef _State type;
+  };
+};
+
+template <byte _bits>
+struct ReportSize {
+  typedef Bytes<D_REPORT_SIZE, _bits> bytes;
+  template <typename _State>
+  struct Apply {
+    typedef State<_bits, _State::report_count, _State::input_bits,
+                  _State::output_bits, _State::feature_bits> type;
+  };
+};
+
+template <byte _count>
+struct ReportCount {
+  typedef Bytes<D_REPORT_COUNT, _count> bytes;
+  template <typename _State>
+  struct Apply {
+    typedef State<_State::report_size, _count, _State::input_bits,
+                  _State::output_bits, _State::feature_bits> type;
+  };
+};
+
+// Main items
+template <byte _type>
+using Collection = ShortItem<D_COLLECTION, _type, 1>;
+typedef ShortItem<D_END_COLLECTION, 0, 0> EndCollection;
+
+template <byte _flags>
+struct Input {
+  typedef Bytes<D_INPUT, _flags> bytes;
+  template <typename _State>
+  struct Apply {
+    typedef State<_State::report_size, _State::report_count,
+                  _State::input_bits + (_State::report_size * _State::report_count),
+                  _State::output_bits, _State::feature_bits> type;
+  };
+};
+
+template <byte _flags>
+struct Output {
+  typedef Bytes<D_OUTPUT, _flags> bytes;
+  template <typename _State>
+  struct Apply {
+    typedef State<_State::report_size, _State::report_count, _State::input_bits,
+                  _State::output_bits + (_State::report_size * _State::report_count),
+                  _State::feature_bits> type;
+  };
+};
+
+template <byte _flags>
+struct Feature {
+  typedef Bytes<D_FEATURE, _flags> bytes;
+  template <typename _State>
+  struct Apply {
+    typedef State<_State::report_size, _State::report_count, _State::input_bits,
+                  _State::output_bits,
+                  _State::feature_bits + (_State::report_size * _State::report_count)> type;
+  };
+};
+
+// ----------------------------------------------------------------------------
+// Descriptors
+
+template <typename... _Items>
+struct Descriptor {
+  typedef typename Concat<typename _Items::bytes...>::type bytes;
+
+  // A descriptor is also an item, so fragments can be nested in other descriptors.
+  template <typename _State>
+  struct Apply {
+    typedef typename Fold<_State, _Items...>::type type;
+  };
+
+  typedef typename Apply<State<>>::type state;
+
+  static constexpr uint16_t length = bytes::length;
+  static constexpr uint16_t input_bytes = (state::input_bits + 7) / 8;
+  static constexpr uint16_t output_bytes = (state::output_bits + 7) / 8;
+  static constexpr uint16_t feature_bytes = (state::feature_bits + 7) / 8;
+
+  static const byte* data() {
+    return bytes::data;
+  }
+};
+
+// A constant input item for `_bits` bits of padding, or nothing at all if there aren't
+// any padding bits to add.
+template <byte _bits>
+struct InputPadding : Select<_bits == 0,
+                              Descriptor<>,
+                              Descriptor<ReportSize<_bits>,
+                                         ReportCount<1>,
+                                         Input<D_CONSTANT>>>::type {};
+
+} // namespace descriptor {
+} // namespace hid {
+} // namespace kaleidoglyph {
@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/gamepad.h"
+
+#include <kaleidoglyph/utils.h>
+#include "DescriptorPrimitives.h"
+#include "kaleidoglyph/hid/descriptor.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace gamepad {
+
+using namespace descriptor;
+
+typedef Descriptor<
+  /* Gamepad with 32 buttons and 6 axes */
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              // USAGE_PAGE (Generic Desktop)
+  Usage<D_USAGE_JOYSTICK>,                        // USAGE (Joystick)
+  Collection<D_APPLICATION>,                      // COLLECTION (Application)
+  ReportId<report_id>,                            //   REPORT_ID
+
+  /* 32 Buttons */
+  UsagePage<D_PAGE_BUTTON>,                       //   USAGE_PAGE (Button)
+  UsageMinimum<0x01>,                             //   USAGE_MINIMUM (Button 1)
+  UsageMaximum<0x20>,                             //   USAGE_MAXIMUM (Button 32)
+  LogicalMinimum<0>,                              //   LOGICAL_MINIMUM (0)
+  LogicalMaximum<1>,                              //   LOGICAL_MAXIMUM (1)
+  ReportSize<1>,                                  //   REPORT_SIZE (1)
+  ReportCount<32>,                                //   REPORT_COUNT (32)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,            //   INPUT (Data,Var,Abs)
+
+  /* 4 16bit Axes */
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              //   USAGE_PAGE (Generic Desktop)
+  Collection<D_PHYSICAL>,                         //   COLLECTION (Physical)
+  Usage<0x30>,                                    //     USAGE (X)
+  Usage<0x31>,                                    //     USAGE (Y)
+  Usage<0x33>,                                    //     USAGE (Rx)
+  Usage<0x34>,                                    //     USAGE (Ry)
+  LogicalMinimum<-32768>,                         //     LOGICAL_MINIMUM (-32768)
+  LogicalMaximum<32767>,                          //     LOGICAL_MAXIMUM (32767)
+  ReportSize<16>,                                 //     REPORT_SIZE (16)
+  ReportCount<4>,                                 //     REPORT_COUNT (4)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,            //     INPUT (Data,Var,Abs)
+
+  /* 2 8bit Axes */
+  Usage<0x32>,                                    //     USAGE (Z)
+  Usage<0x35>,                                    //     USAGE (Rz)
+  LogicalMinimum<-128>,                           //     LOGICAL_MINIMUM (-128)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  ReportCount<2>,                                 //     REPORT_COUNT (2)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,            //     INPUT (Data,Var,Abs)
+  EndCollection,                                  //   END_COLLECTION
+
+  /* 2 Hat Switches */
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              //   USAGE_PAGE (Generic Desktop)
+  Usage<0x39>,                                    //   USAGE (Hat switch)
+  Usage<0x39>,                                    //   USAGE (Hat switch)
+  LogicalMinimum<1>,                              //   LOGICAL_MINIMUM (1)
+  LogicalMaximum<8>,                              //   LOGICAL_MAXIMUM (8)
+  ReportCount<2>,                                 //   REPORT_COUNT (2)
+  ReportSize<4>,                                  //   REPORT_SIZE (4)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,            //   INPUT (Data,Var,Abs)
+  EndCollection                                   // END_COLLECTION
+> GamepadDescriptor;
+
+static_assert(GamepadDescriptor::input_bytes == sizeof(Report),
+              "Gamepad descriptor doesn't match the report size");
+
+void Report::pressButton(byte button) {
+  byte i = button - 1;
+  if (i < 32)
+    buttons_[i / 8] |= (1 << (i % 8));
+}
+
+void Report::releaseButton(byte button) {
+  byte i = button - 1;
+  if (i < 32)
+    buttons_[i / 8] &= ~(1 << (i % 8));
+}
+
+void Report::setButtons(uint32_t buttons) {
+  for (byte i{0}; i < arraySize(buttons_); ++i) {
+    buttons_[i] = byte(buttons);
+    buttons >>= 8;
+  }
+}
+
+void Report::setDPad1(DPad direction) {
+  dpads_ = (dpads_ & 0xF0) | byte(direction);
+}
+
+void Report::setDPad2(DPad direction) {
+  dpads_ = (dpads_ & 0x0F) | (byte(direction) << 4);
+}
+
+Dispatcher::Dispatcher()
+    : Interface<HID_GAMEPAD_DEDICATED_ENDPOINT>(
+        GamepadDescriptor::data(), GamepadDescriptor::length,
+        poll_interval) {}
+
+void Dispatcher::init() {
+  plug();
+  last_report_.clear();
+  sendReportUnchecked_(last_report_);
+}
+
+SendStatus Dispatcher::sendReportUnchecked_(const Report& report) {
+  SendStatus status = sendStatus(sendReport_(report_id, &report, sizeof(report)));
+  has_pending_report_ = (status == SendStatus::host_busy);
+  if (has_pending_report_) {
+    pending_report_.updateFrom(report);
+    return SendStatus::queued;
+  }
+  if (status == SendStatus::sent)
+    last_report_.updateFrom(report);
+  return status;
+}
+
+SendStatus Dispatcher::sendReport(const Report& report) {
+  if (report == last_report_) {
+    has_pending_report_ = false;
+    return SendStatus::sent;
+  }
+  return sendReportUnchecked_(report);
+}
+
+SendStatus Dispatcher::trySendReport(const Report& report) {
+  if (report == last_report_) {
+    has_pending_report_ = false;
+    return SendStatus::sent;
+  }
+  pending_report_.updateFrom(report);
+  has_pending_report_ = true;
+  return SendStatus::queued;
+}
+
+bool Dispatcher::poll() {
+  if (!has_pending_report_)
+    return false;
+  if (byte(UDFNUML - last_send_frame_) < poll_interval)
+    return false;
+  Report report = pending_report_;
+  last_send_frame_ = UDFNUML;
+  sendReportUnchecked_(report);
+  return true;
+}
+
+} // namespace gamepad {
+} // namespace hid {
+} // namespace kaleidoglyph {
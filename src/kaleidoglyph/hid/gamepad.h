@@ -0,0 +1,133 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <PluggableUSB.h>
+#include <HID.h>
+#include "HID-Settings.h"
+
+#include <kaleidoglyph/utils.h>
+#include "kaleidoglyph/hid/interface.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace gamepad {
+
+// Directions for the two hat switches (d-pads).
+enum class DPad : byte {
+  centered,
+  up,
+  up_right,
+  right,
+  down_right,
+  down,
+  down_left,
+  left,
+  up_left,
+};
+
+constexpr byte report_id = reportId(HID_GAMEPAD_DEDICATED_ENDPOINT, HID_REPORTID_GAMEPAD);
+
+// A gamepad with 32 buttons, four 16-bit axes (X, Y, Rx, Ry), two 8-bit axes (Z, Rz) and
+// two hat switches. The report is laid out byte by byte, without bitfields, so that it
+// matches the descriptor regardless of how the compiler would arrange them.
+class Report {
+
+  friend class Dispatcher;
+
+ public:
+  void clear() {
+    memset(this, 0, sizeof(*this));
+  }
+
+  // Buttons are numbered from 1 to 32, as in the descriptor.
+  void pressButton(byte button);
+  void releaseButton(byte button);
+  void setButtons(uint32_t buttons);
+
+  void setXAxis(int16_t value) { x_ = value; }
+  void setYAxis(int16_t value) { y_ = value; }
+  void setRxAxis(int16_t value) { rx_ = value; }
+  void setRyAxis(int16_t value) { ry_ = value; }
+  void setZAxis(int8_t value) { z_ = value; }
+  void setRzAxis(int8_t value) { rz_ = value; }
+  void setDPad1(DPad direction);
+  void setDPad2(DPad direction);
+
+  bool operator==(const Report& other) const {
+    return (memcmp(this, &other, sizeof(*this)) == 0);
+  }
+  void updateFrom(const Report& new_report) {
+    memcpy(this, &new_report, sizeof(*this));
+  }
+
+ private:
+  byte buttons_[4] = {};
+  int16_t x_{0};
+  int16_t y_{0};
+  int16_t rx_{0};
+  int16_t ry_{0};
+  int8_t z_{0};
+  int8_t rz_{0};
+  // D-pad 1 in the low nibble, d-pad 2 in the high nibble.
+  byte dpads_{0};
+} __attribute__((packed));
+
+class Dispatcher : Interface<HID_GAMEPAD_DEDICATED_ENDPOINT> {
+
+ public:
+  static constexpr byte poll_interval = HID_GAMEPAD_POLL_INTERVAL;
+  static_assert(isValidPollInterval(HID_GAMEPAD_POLL_INTERVAL),
+                "Invalid gamepad polling interval");
+
+  Dispatcher();
+  void init();
+  // A report that's the same as the last one the host accepted isn't sent again, so
+  // this can be called every scan cycle. A report the host didn't accept is sent again
+  // by `poll()`, unless a newer one replaces it first. `trySendReport()` just replaces
+  // the waiting report, so only the latest state is sent in each polling interval.
+  SendStatus sendReport(const Report& report);
+  SendStatus trySendReport(const Report& report);
+  bool poll();
+  bool hasPendingReports() const {
+    return has_pending_report_;
+  }
+
+ private:
+  Report last_report_;
+  Report pending_report_;
+  bool has_pending_report_{false};
+  byte last_send_frame_{0};
+
+  SendStatus sendReportUnchecked_(const Report& report);
+
+};
+
+} // namespace gamepad {
+} // namespace hid {
+} // namespace kaleidoglyph {
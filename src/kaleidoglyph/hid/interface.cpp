@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2014-2015 NicoHood
+Copyright (c) 2015-2018 Keyboard.io, Inc
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/interface.h"
+
+#include "DescriptorPrimitives.h"
+
+namespace kaleidoglyph {
+namespace hid {
+
+DedicatedInterface::DedicatedInterface(const byte* descriptor, uint16_t descriptor_length,
+                                       byte poll_interval, byte subclass, byte protocol)
+    : PluggableUSBModule(1, 1, epType),
+      descriptor_(descriptor), descriptor_length_(descriptor_length),
+      poll_interval_(poll_interval), subclass_(subclass), device_protocol_(protocol) {}
+
+// PluggableUSBModule method
+int DedicatedInterface::getInterface(byte* interface_count) {
+  *interface_count += 1; // uses 1
+  HIDDescriptor hid_interface = {
+    D_INTERFACE(pluggedInterface, 1,
+                USB_DEVICE_CLASS_HUMAN_INTERFACE,
+                subclass_,
+                device_protocol_),
+    D_HIDREPORT(descriptor_length_),
+    D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint),
+               USB_ENDPOINT_TYPE_INTERRUPT, USB_EP_SIZE, poll_interval_)
+  };
+  return USB_SendControl(0, &hid_interface, sizeof(hid_interface));
+}
+
+bool DedicatedInterface::isReportDescriptorRequest_(const USBSetup& setup) const {
+  // Check if this is a HID Class Descriptor request
+  if (setup.bmRequestType != REQUEST_DEVICETOHOST_STANDARD_INTERFACE) {
+    return false;
+  }
+  if (setup.wValueH != HID_REPORT_DESCRIPTOR_TYPE) {
+    return false;
+  }
+
+  // In a HID Class Descriptor wIndex cointains the interface number
+  return (setup.wIndex == pluggedInterface);
+}
+
+// PluggableUSBModule method
+int DedicatedInterface::getDescriptor(USBSetup& setup) {
+  if (!isReportDescriptorRequest_(setup)) {
+    return 0;
+  }
+
+  // Reset the protocol on reenumeration. Normally the host should not assume the state of
+  // the protocol due to the USB specs, but Windows and Linux just assumes its in report
+  // mode.
+  protocol_ = HID_REPORT_PROTOCOL;
+
+  return USB_SendControl(TRANSFER_PGM, descriptor_, descriptor_length_);
+}
+
+// PluggableUSBModule method
+bool DedicatedInterface::setup(USBSetup& setup) {
+  if (pluggedInterface != setup.wIndex) {
+    return false;
+  }
+
+  byte request = setup.bRequest;
+  byte request_type = setup.bmRequestType;
+
+  if (request_type == REQUEST_DEVICETOHOST_CLASS_INTERFACE) {
+    if (request == HID_GET_REPORT) {
+      // TODO: HID_GetReport();
+      return true;
+    }
+    if (request == HID_GET_PROTOCOL) {
+      // TODO improve
+      UEDATX = protocol_;
+      return true;
+    }
+    if (request == HID_GET_IDLE) {
+      // TODO improve
+      UEDATX = idle_;
+      return true;
+    }
+  }
+
+  if (request_type == REQUEST_HOSTTODEVICE_CLASS_INTERFACE) {
+    if (request == HID_SET_PROTOCOL) {
+      protocol_ = setup.wValueL;
+      return true;
+    }
+    if (request == HID_SET_IDLE) {
+      // We currently ignore SET_IDLE, because we don't really do anything with it, and implementing
+      // it causes issues on OSX, such as key chatter. Other operating systems do not suffer if we
+      // force this to zero, either.
+#if 0
+      idle_ = setup.wValueL;
+#else
+      idle_ = 0;
+#endif
+      return true;
+    }
+  }
+
+  return false;
+}
+
+} // namespace hid {
+} // namespace kaleidoglyph {
@@ -0,0 +1,155 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2014-2015 NicoHood
+Copyright (c) 2015-2018 Keyboard.io, Inc
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <PluggableUSB.h>
+#include <HID.h>
+
+#include "HID-Settings.h"
+#include "kaleidoglyph/hid/descriptor.h"
+
+namespace kaleidoglyph {
+namespace hid {
+
+// Each dispatcher sends its reports either through the shared multi-report HID
+// interface (`HID()`), or through a HID interface of its own, with its own interrupt IN
+// endpoint. A dedicated endpoint lets the host collect reports from different devices in
+// the same frame, and its reports don't need a report ID byte. The choice is made at
+// compile time (see `HID-Settings.h`); both classes present the same interface to the
+// dispatchers, which select one with the `Interface` template alias below.
+
+// A report ID is only needed on the shared interface.
+constexpr byte reportId(bool dedicated, byte id) {
+  return dedicated ? HID_REPORTID_NONE : id;
+}
+
+// Full-speed interrupt endpoints can be polled every 1-255 ms (USB 2.0 section 9.6.6).
+constexpr bool isValidPollInterval(int interval) {
+  return (interval >= 1) && (interval <= 255);
+}
+
+// The result of a dispatcher's `sendReport()`:
+//
+// - `sent`: the host has accepted the report (or already had the same one).
+// - `queued`: the report will be sent in the background by the dispatcher's `poll()`.
+// - `host_busy`: the dispatcher couldn't take the report now; nothing was changed, and
+//   the caller should try again later.
+// - `host_absent`: the device isn't configured by a host, so the report was dropped.
+//
+// A dispatcher's record of what the host has seen only changes once the host accepts a
+// report.
+enum class SendStatus : byte {
+  sent,
+  queued,
+  host_busy,
+  host_absent,
+};
+
+// Translate the return value of `USB_Send()` or `HID().SendReport()`.
+inline SendStatus sendStatus(int result) {
+  if (result >= 0)
+    return SendStatus::sent;
+  return USBDevice.configured() ? SendStatus::host_busy : SendStatus::host_absent;
+}
+
+class SharedInterface {
+
+ public:
+  SharedInterface(const byte* descriptor, uint16_t descriptor_length,
+                  byte /*poll_interval*/,
+                  byte /*subclass*/ = HID_SUBCLASS_NONE,
+                  byte /*protocol*/ = HID_PROTOCOL_NONE)
+      : node_(descriptor, descriptor_length) {
+    HID().AppendDescriptor(&node_);
+  }
+
+  void plug() {}
+
+ protected:
+  int sendReport_(byte report_id, const void* data, int length) {
+    return HID().SendReport(report_id, data, length);
+  }
+
+ private:
+  HIDSubDescriptor node_;
+
+};
+
+class DedicatedInterface : public PluggableUSBModule {
+
+ public:
+  DedicatedInterface(const byte* descriptor, uint16_t descriptor_length,
+                     byte poll_interval,
+                     byte subclass = HID_SUBCLASS_NONE, byte protocol = HID_PROTOCOL_NONE);
+
+  void plug() {
+    PluggableUSB().plug(this);
+  }
+
+  byte getProtocol() const {
+    return protocol_;
+  }
+
+ protected:
+  // Like `HID().SendReport()`, the report ID (if any) is sent first.
+  int sendReport_(byte report_id, const void* data, int length) {
+    if (report_id != HID_REPORTID_NONE) {
+      int result = USB_Send(pluggedEndpoint, &report_id, 1);
+      if (result < 0)
+        return result;
+    }
+    return USB_Send(pluggedEndpoint | TRANSFER_RELEASE, data, length);
+  }
+
+  // PluggableUSBModule
+  int getInterface(byte* interface_count) override;
+  int getDescriptor(USBSetup& setup) override;
+  bool setup(USBSetup& setup) override;
+
+  bool isReportDescriptorRequest_(const USBSetup& setup) const;
+
+  const byte* descriptor_;
+  uint16_t descriptor_length_;
+  byte poll_interval_;
+  byte subclass_;
+  byte device_protocol_;
+
+  byte epType[1] = {EP_TYPE_INTERRUPT_IN};
+  byte protocol_{HID_REPORT_PROTOCOL};
+  byte idle_{0};
+
+};
+
+template <bool _dedicated>
+using Interface =
+  typename descriptor::Select<_dedicated, DedicatedInterface, SharedInterface>::type;
+
+} // namespace hid {
+} // namespace kaleidoglyph {
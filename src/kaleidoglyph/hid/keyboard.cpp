@@ -32,259 +32,389 @@ THE SOFTWARE.
 
 #include "DescriptorPrimitives.h"
 #include "HID-Settings.h"
+#include "kaleidoglyph/hid/descriptor.h"
 #include "kaleidoglyph/cKey.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace keyboard {
 
-void Report::clear() {
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::clear() {
   memset(&data_, 0, sizeof(data_));
+  memset(boot_keys_, 0, sizeof(boot_keys_));
+  boot_overflow_ = 0;
 }
 
 // This method is of dubious value
-bool Report::readKeycode(byte keycode) const {
-  byte n = keycode / 8;
+template <byte _first_key, byte _last_key>
+bool BasicReport<_first_key, _last_key>::readKeycode(byte keycode) const {
+  byte n = byteIndex_(keycode);
   byte i = keycode % 8;
   if (keycode < HID_KEYBOARD_FIRST_MODIFIER) {
-    return bitRead(data_[1 + n], i);
+    return isInRange_(keycode) && bitRead(data_[n], i);
   } else if (keycode <= HID_KEYBOARD_LAST_MODIFIER) {
     return bitRead(data_[0], i);
   }
   return false;
 }
 
-void Report::addKeycode(byte keycode) {
-  byte n = keycode / 8;
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::addKeycode(byte keycode) {
+  byte n = byteIndex_(keycode);
   byte i = keycode % 8;
   if (keycode < HID_KEYBOARD_FIRST_MODIFIER) {
-    bitSet(data_[1 + n], i);
+    if (!isInRange_(keycode) || bitRead(data_[n], i))
+      return;
+    bitSet(data_[n], i);
+    addBootKey_(keycode);
   } else if (keycode <= HID_KEYBOARD_LAST_MODIFIER) {
     bitSet(data_[0], i);
   }
 }
 
-void Report::removeKeycode(byte keycode) {
-  byte n = keycode / 8;
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::removeKeycode(byte keycode) {
+  byte n = byteIndex_(keycode);
   byte i = keycode % 8;
   if (keycode < HID_KEYBOARD_FIRST_MODIFIER) {
-    bitClear(data_[1 + n], i);
+    if (!isInRange_(keycode) || !bitRead(data_[n], i))
+      return;
+    bitClear(data_[n], i);
+    removeBootKey_(keycode);
   } else if (keycode <= HID_KEYBOARD_LAST_MODIFIER) {
     bitClear(data_[0], i);
   }
 }
 
+// Return `true` if any plain (non-modifier) keycodes in this report don't appear in
+// `new_report`.
+template <byte _first_key, byte _last_key>
+bool BasicReport<_first_key, _last_key>::hasPlainReleases_(const BasicReport &new_report) const {
+  return bitmap::hasBitsNotIn(&data_[1], &new_report.data_[1], keycode_bytes);
+}
+
 // Update the report to remove any keycodes that don't appear in `new_report`. If any such
 // keycodes are found, return `true`, otherwise return `false`. This efficiently deals
 // with the problem of a plain keycode release in the same update as a new modifier
 // press. We don't want to risk the modifier applying to the plain keycode before that
 // keycode is released.
-bool Report::updatePlainReleases_(const Report &new_report) {
-  bool result{false};
-  for (byte i{1}; i < arraySize(data_); ++i) {
-    byte released_keycodes = data_[i] & ~(new_report.data_[i]);
-    if (released_keycodes != 0) {
-      data_[i] &= ~released_keycodes;
-      result = true;
-    }
+template <byte _first_key, byte _last_key>
+bool BasicReport<_first_key, _last_key>::updatePlainReleases_(const BasicReport &new_report) {
+  if (!bitmap::intersect(&data_[1], &new_report.data_[1], keycode_bytes))
+    return false;
+  rebuildBootKeys_();
+  return true;
+}
+
+// The padding bits around the key range aren't keys in this report (by default, the
+// leading ones are NO_EVENT and the three error codes), so any that are set in `presses`
+// are left out; otherwise they'd be sent, and end up in the boot slots. That takes a
+// masked copy, which is only made if there are any.
+template <byte _first_key, byte _last_key>
+bool BasicReport<_first_key, _last_key>::applyDiff(const Bitmap& presses, const Bitmap& releases) {
+  constexpr byte first_byte_mask = byte(0xFF << leading_padding_bits);
+  constexpr byte last_byte_mask = byte(0xFF >> trailing_padding_bits);
+  const byte* keys = presses;
+  Bitmap masked_presses;
+  if ((presses[1] & ~first_byte_mask) | (presses[size - 1] & ~last_byte_mask)) {
+    bitmap::copy(masked_presses, presses, size);
+    masked_presses[1] &= first_byte_mask;
+    masked_presses[size - 1] &= last_byte_mask;
+    keys = masked_presses;
   }
-  return result;
+  if (!bitmap::apply(data_, keys, releases, size))
+    return false;
+  rebuildBootKeys_();
+  return true;
 }
 
+// Put a newly-pressed keycode in the first empty boot slot, if there is one.
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::addBootKey_(byte keycode) {
+  if (keycode == HID_KEYBOARD_NO_EVENT)
+    return;
+  for (byte i{0}; i < boot_key_slots; ++i) {
+    if (boot_keys_[i] == 0) {
+      boot_keys_[i] = keycode;
+      return;
+    }
+  }
+  ++boot_overflow_;
+}
 
+// Remove a released keycode from the boot slots, shifting any later ones down to keep
+// them in press order, and fill the last slot with an overflow keycode, if any.
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::removeBootKey_(byte keycode) {
+  if (keycode == HID_KEYBOARD_NO_EVENT)
+    return;
+  for (byte i{0}; i < boot_key_slots; ++i) {
+    if (boot_keys_[i] == keycode) {
+      for (; i < boot_key_slots - 1; ++i)
+        boot_keys_[i] = boot_keys_[i + 1];
+      boot_keys_[boot_key_slots - 1] = 0;
+      if (boot_overflow_ != 0) {
+        --boot_overflow_;
+        boot_keys_[boot_key_slots - 1] = findUnslottedKeycode_();
+      }
+      return;
+    }
+  }
+  // The keycode wasn't in a slot, so it must have been one of the overflow keys.
+  --boot_overflow_;
+}
 
+// Bring the boot slots back in sync with the bitmap after a bulk update. Keys that are
+// still held keep their slots (and order); new keys are added in keycode order. This is
+// only needed on the less common paths that change many keys at once.
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::rebuildBootKeys_() {
+  byte n{0};
+  for (byte i{0}; i < boot_key_slots; ++i) {
+    byte keycode = boot_keys_[i];
+    if (keycode != 0 && readKeycode(keycode))
+      boot_keys_[n++] = keycode;
+  }
+  while (n < boot_key_slots)
+    boot_keys_[n++] = 0;
+
+  boot_overflow_ = 0;
+  for (byte i{0}; i < keycode_bytes; ++i) {
+    if (data_[1 + i] == 0) continue;
+    for (byte b{0}; b < 8; ++b) {
+      if (!bitRead(data_[1 + i], b)) continue;
+      byte keycode = keycodeAt_(i, b);
+      if (keycode == HID_KEYBOARD_NO_EVENT) continue;
+      if (memchr(boot_keys_, keycode, sizeof(boot_keys_)) != nullptr) continue;
+      addBootKey_(keycode);
+    }
+  }
+}
 
+// Find a plain keycode that's held in the report, but isn't in any of the boot slots.
+template <byte _first_key, byte _last_key>
+byte BasicReport<_first_key, _last_key>::findUnslottedKeycode_() const {
+  for (byte i{0}; i < keycode_bytes; ++i) {
+    if (data_[1 + i] == 0) continue;
+    for (byte b{0}; b < 8; ++b) {
+      if (!bitRead(data_[1 + i], b)) continue;
+      byte keycode = keycodeAt_(i, b);
+      if (keycode == HID_KEYBOARD_NO_EVENT) continue;
+      if (memchr(boot_keys_, keycode, sizeof(boot_keys_)) == nullptr)
+        return keycode;
+    }
+  }
+  return 0;
+}
 
-static constexpr PROGMEM byte nkro_descriptor[] = {
+using namespace descriptor;
+
+// Key modifier byte. This fragment is identical in the NKRO and boot protocol
+// descriptors, so it's only stored once, as part of the NKRO descriptor; the boot
+// descriptor is sent in pieces.
+typedef Descriptor<
+  UsagePage<D_PAGE_KEYBOARD>,
+  UsageMinimum<HID_KEYBOARD_FIRST_MODIFIER>,
+  UsageMaximum<HID_KEYBOARD_LAST_MODIFIER>,
+  LogicalMinimum<0>,
+  LogicalMaximum<1>,
+  ReportSize<1>,
+  ReportCount<8>,
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>
+> ModifiersDescriptor;
+
+typedef Descriptor<
   //  NKRO Keyboard
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,
-  D_USAGE, D_USAGE_KEYBOARD,
-  D_COLLECTION, D_APPLICATION,
-  D_REPORT_ID, HID_REPORTID_NKRO_KEYBOARD,
-  D_USAGE_PAGE, D_PAGE_KEYBOARD,
-
-
-  /* Key modifier byte */
-  D_USAGE_MINIMUM, HID_KEYBOARD_FIRST_MODIFIER,
-  D_USAGE_MAXIMUM, HID_KEYBOARD_LAST_MODIFIER,
-  D_LOGICAL_MINIMUM, 0x00,
-  D_LOGICAL_MAXIMUM, 0x01,
-  D_REPORT_SIZE, 0x01,
-  D_REPORT_COUNT, 0x08,
-  D_INPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),
-
-
-	/* 5 LEDs for num lock etc, 3 left for advanced, custom usage */
-  D_USAGE_PAGE, D_PAGE_LEDS,
-  D_USAGE_MINIMUM, 0x01,
-  D_USAGE_MAXIMUM, 0x08,
-  D_REPORT_COUNT, 0x08,
-  D_REPORT_SIZE, 0x01,
-  D_OUTPUT, (D_DATA | D_VARIABLE | D_ABSOLUTE),
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,
+  Usage<D_USAGE_KEYBOARD>,
+  Collection<D_APPLICATION>,
+  ReportId<reportId(HID_KEYBOARD_DEDICATED_ENDPOINT, HID_REPORTID_NKRO_KEYBOARD)>
+> NkroHeaderDescriptor;
+
+typedef Descriptor<
+  NkroHeaderDescriptor,
+  ModifiersDescriptor,
+
+  /* 5 LEDs for num lock etc, 3 left for advanced, custom usage */
+  UsagePage<D_PAGE_LEDS>,
+  UsageMinimum<0x01>,
+  UsageMaximum<0x08>,
+  ReportCount<8>,
+  ReportSize<1>,
+  Output<D_DATA|D_VARIABLE|D_ABSOLUTE>,
 
   /* NKRO Keyboard */
-  D_USAGE_PAGE, D_PAGE_KEYBOARD,
+  UsagePage<D_PAGE_KEYBOARD>,
 
-  // Padding 4 bits, to skip NO_EVENT & 3 error states.
-  D_REPORT_SIZE, 0x04,
-  D_REPORT_COUNT, 0x01,
-  D_INPUT, (D_CONSTANT),
+  // Padding from the byte boundary up to the first keycode in the report (by default, to
+  // skip NO_EVENT & 3 error states).
+  InputPadding<Report::leading_padding_bits>,
 
-  D_USAGE_MINIMUM, HID_KEYBOARD_A_AND_A,
-  D_USAGE_MAXIMUM, HID_LAST_KEY,
-  D_LOGICAL_MINIMUM, 0x00,
-  D_LOGICAL_MAXIMUM, 0x01,
-  D_REPORT_SIZE, 0x01,
-  D_REPORT_COUNT, (HID_LAST_KEY - HID_KEYBOARD_A_AND_A),
-  D_INPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),
+  UsageMinimum<Report::first_key>,
+  UsageMaximum<Report::last_key>,
+  LogicalMinimum<0>,
+  LogicalMaximum<1>,
+  ReportSize<1>,
+  ReportCount<Report::key_count>,
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,
 
-  // Padding (3 bits) to round up the report to byte boundary.
-  D_REPORT_SIZE, 0x03,
-  D_REPORT_COUNT, 0x01,
-  D_INPUT, (D_CONSTANT),
+  // Padding to round up the report to byte boundary.
+  InputPadding<Report::trailing_padding_bits>,
 
-  D_END_COLLECTION,
+  EndCollection
+> NkroDescriptor;
 
-};
+static_assert(NkroDescriptor::input_bytes == Report::size,
+              "NKRO descriptor doesn't match the keyboard report size");
 
 // See Appendix B of USB HID spec
-static constexpr PROGMEM byte boot_descriptor[] = {
+typedef Descriptor<
   //  Keyboard
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,
-  D_USAGE, D_USAGE_KEYBOARD,
-
-  D_COLLECTION, D_APPLICATION,
-  // Modifiers
-  D_USAGE_PAGE, D_PAGE_KEYBOARD,
-  D_USAGE_MINIMUM, 0xe0,
-  D_USAGE_MAXIMUM, 0xe7,
-  D_LOGICAL_MINIMUM, 0x0,
-  D_LOGICAL_MAXIMUM, 0x1,
-  D_REPORT_SIZE, 0x1,
-  D_REPORT_COUNT, 0x8,
-  D_INPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,
+  Usage<D_USAGE_KEYBOARD>,
+  Collection<D_APPLICATION>
+> BootHeaderDescriptor;
 
+// Everything in the boot descriptor after the modifiers
+typedef Descriptor<
   // Reserved byte
-  D_REPORT_COUNT, 0x1,
-  D_REPORT_SIZE, 0x8,
-  D_INPUT, (D_CONSTANT),
+  ReportCount<1>,
+  ReportSize<8>,
+  Input<D_CONSTANT>,
 
   // LEDs
-  D_REPORT_COUNT, 0x5,
-  D_REPORT_SIZE, 0x1,
-  D_USAGE_PAGE, D_PAGE_LEDS,
-  D_USAGE_MINIMUM, 0x1,
-  D_USAGE_MAXIMUM, 0x5,
-  D_OUTPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),
+  ReportCount<5>,
+  ReportSize<1>,
+  UsagePage<D_PAGE_LEDS>,
+  UsageMinimum<1>,
+  UsageMaximum<5>,
+  Output<D_DATA|D_VARIABLE|D_ABSOLUTE>,
   // Pad LEDs up to a byte
-  D_REPORT_COUNT, 0x1,
-  D_REPORT_SIZE, 0x3,
-  D_OUTPUT, (D_CONSTANT),
+  ReportCount<1>,
+  ReportSize<3>,
+  Output<D_CONSTANT>,
 
   // Non-modifiers
-  D_REPORT_COUNT, 0x6,
-  D_REPORT_SIZE, 0x8,
-  D_LOGICAL_MINIMUM, 0x0,
-  D_LOGICAL_MAXIMUM, 0xff,
-  D_USAGE_PAGE, D_PAGE_KEYBOARD,
-  D_USAGE_MINIMUM, 0x0,
-  D_USAGE_MAXIMUM, 0xff,
-  D_INPUT, (D_DATA|D_ARRAY|D_ABSOLUTE),
-  D_END_COLLECTION
-};
-
-Dispatcher::Dispatcher() : PluggableUSBModule(1, 1, epType) {
-  static HIDSubDescriptor node(nkro_descriptor, sizeof(nkro_descriptor));
-  HID().AppendDescriptor(&node);
+  ReportCount<6>,
+  ReportSize<8>,
+  LogicalMinimum<0>,
+  LogicalMaximum<0xff>,
+  UsagePage<D_PAGE_KEYBOARD>,
+  UsageMinimum<0>,
+  UsageMaximum<0xff>,
+  Input<D_DATA|D_ARRAY|D_ABSOLUTE>,
+  EndCollection
+> BootBodyDescriptor;
+
+typedef Descriptor<
+  BootHeaderDescriptor,
+  ModifiersDescriptor,
+  BootBodyDescriptor
+> BootDescriptor;
+
+static_assert(BootDescriptor::input_bytes == 8,
+              "Boot descriptor doesn't match the boot report size");
+
+// If stats are enabled, their feature report is added to the keyboard interface's
+// descriptor.
+constexpr uint16_t stats_descriptor_length = HID_STATS ? stats::StatsDescriptor::length : 0;
+
+#if HID_KEYBOARD_DEDICATED_ENDPOINT
+
+typedef Select<HID_STATS,
+               Descriptor<NkroDescriptor, stats::StatsDescriptor>,
+               NkroDescriptor>::type InterfaceDescriptor;
+
+// The NKRO descriptor is the interface's report descriptor; hosts that switch to boot
+// protocol ignore it, and expect the fixed boot report format.
+Dispatcher::Dispatcher()
+    : DedicatedInterface(InterfaceDescriptor::data(), InterfaceDescriptor::length,
+                         poll_interval,
+                         HID_SUBCLASS_BOOT_INTERFACE, HID_PROTOCOL_KEYBOARD) {}
+
+#else
+
+// Send the boot descriptor to the host, using the copy of the modifiers fragment that's
+// in the NKRO descriptor.
+static int sendBootDescriptor() {
+  int total{0};
+  int result = USB_SendControl(TRANSFER_PGM, BootHeaderDescriptor::data(),
+                               BootHeaderDescriptor::length);
+  if (result < 0)
+    return result;
+  total += result;
+  result = USB_SendControl(TRANSFER_PGM,
+                           NkroDescriptor::data() + NkroHeaderDescriptor::length,
+                           ModifiersDescriptor::length);
+  if (result < 0)
+    return result;
+  total += result;
+  result = USB_SendControl(TRANSFER_PGM, BootBodyDescriptor::data(),
+                           BootBodyDescriptor::length);
+  if (result < 0)
+    return result;
+  total += result;
+  if (stats_descriptor_length != 0) {
+    result = USB_SendControl(TRANSFER_PGM, stats::StatsDescriptor::data(),
+                             stats_descriptor_length);
+    if (result < 0)
+      return result;
+  }
+  return total + result;
 }
 
-// PluggableUSBModule method
-int Dispatcher::getInterface(byte* interface_count) {
-  *interface_count += 1; // uses 1
-  HIDDescriptor hid_interface = {
-    D_INTERFACE(pluggedInterface, 1,
-                USB_DEVICE_CLASS_HUMAN_INTERFACE,
-                HID_SUBCLASS_BOOT_INTERFACE,
-                HID_PROTOCOL_KEYBOARD),
-    D_HIDREPORT(sizeof(boot_descriptor)),
-    D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint),
-               USB_ENDPOINT_TYPE_INTERRUPT, USB_EP_SIZE, 0x01)
-  };
-  return USB_SendControl(0, &hid_interface, sizeof(hid_interface));
+// The NKRO report goes through the shared HID interface, so this interface just serves
+// the boot protocol descriptor.
+Dispatcher::Dispatcher()
+    : DedicatedInterface(nullptr, BootDescriptor::length + stats_descriptor_length,
+                         poll_interval,
+                         HID_SUBCLASS_BOOT_INTERFACE, HID_PROTOCOL_KEYBOARD) {
+  static HIDSubDescriptor node(NkroDescriptor::data(), NkroDescriptor::length);
+  HID().AppendDescriptor(&node);
 }
 
 // PluggableUSBModule method
 int Dispatcher::getDescriptor(USBSetup& setup) {
-  // Check if this is a HID Class Descriptor request
-  if (setup.bmRequestType != REQUEST_DEVICETOHOST_STANDARD_INTERFACE) {
-    return 0;
-  }
-  if (setup.wValueH != HID_REPORT_DESCRIPTOR_TYPE) {
-    return 0;
-  }
-
-  // In a HID Class Descriptor wIndex cointains the interface number
-  if (setup.wIndex != pluggedInterface) {
+  if (!isReportDescriptorRequest_(setup)) {
     return 0;
   }
 
   // Reset the protocol on reenumeration. Normally the host should not assume the state of
   // the protocol due to the USB specs, but Windows and Linux just assumes its in report
   // mode.
-  hid_protocol_ = nkro_mode;
+  protocol_ = nkro_mode;
 
-  return USB_SendControl(TRANSFER_PGM, boot_descriptor, sizeof(boot_descriptor));
+  return sendBootDescriptor();
 }
 
+#endif
+
 // PluggableUSBModule method
 bool Dispatcher::setup(USBSetup& setup) {
   if (pluggedInterface != setup.wIndex) {
     return false;
   }
 
-  byte request = setup.bRequest;
-  byte request_type = setup.bmRequestType;
-
-  if (request_type == REQUEST_DEVICETOHOST_CLASS_INTERFACE) {
-    if (request == HID_GET_REPORT) {
-      // TODO: HID_GetReport();
-      return true;
-    }
-    if (request == HID_GET_PROTOCOL) {
-      // TODO improve
-      UEDATX = hid_protocol_;
-      return true;
-    }
-    if (request == HID_GET_IDLE) {
-      // TODO improve
-      UEDATX = idle;
-      return true;
-    }
+#if HID_STATS
+  if (setup.bmRequestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE &&
+      setup.bRequest == HID_GET_REPORT &&
+      setup.wValueH == HID_REPORT_TYPE_FEATURE) {
+    stats::sendFeatureReport();
+    return true;
   }
-
-  if (request_type == REQUEST_HOSTTODEVICE_CLASS_INTERFACE) {
-    if (request == HID_SET_PROTOCOL) {
-      hid_protocol_ = setup.wValueL;
-      return true;
-    }
-    if (request == HID_SET_IDLE) {
-      // We currently ignore SET_IDLE, because we don't really do anything with it, and implementing
-      // it causes issues on OSX, such as key chatter. Other operating systems do not suffer if we
-      // force this to zero, either.
-#if 0
-      idle = setup.wValueL;
-#else
-      idle = 0;
 #endif
-      return true;
-    }
-    if (request == HID_SET_REPORT) {
+
+  if (setup.bmRequestType == REQUEST_HOSTTODEVICE_CLASS_INTERFACE) {
+    if (setup.bRequest == HID_SET_REPORT) {
       // Check if data has the correct length afterwards
       int length = setup.wLength;
 
       if (setup.wValueH == HID_REPORT_TYPE_OUTPUT) {
+        byte leds;
         if (length == sizeof(leds)) {
           USB_RecvControl(&leds, length);
+          setLedState_(leds);
           return true;
         }
       }
@@ -302,18 +432,38 @@ bool Dispatcher::setup(USBSetup& setup) {
     }
   }
 
-  return false;
+  return DedicatedInterface::setup(setup);
 }
 
 void Dispatcher::init() {
-  PluggableUSB().plug(this);
+  plug();
   last_report_.clear();
+  queue_.clear();
+  stats_.clearQueue();
+  stats_.publish(stats::Source::keyboard);
   sendReportUnchecked_(last_report_);
 }
 
-// This is the primary function of the Dispatcher: to send new HID reports such that they
-// won't cause unintended output on the host.
-void Dispatcher::sendReport(const Report &new_report) {
+// This is the primary function of the Dispatcher: to queue new HID reports such that they
+// won't cause unintended output on the host. If there isn't enough room in the queue for
+// all of the reports needed to make the transition from the previous report, nothing is
+// changed and this returns `host_busy`; the caller should try again after calling
+// `poll()`.
+SendStatus Dispatcher::trySendReport(const Report &new_report) {
+
+  if (!USBDevice.configured()) {
+    dropQueuedReports_();
+    return SendStatus::host_absent;
+  }
+
+  // If the host wouldn't see any difference, there's nothing to send. In boot protocol
+  // mode, that includes changes that only affect keys beyond the sixth.
+  if (boot_protocol_ ? new_report.bootViewEquals_(last_report_)
+                     : new_report == last_report_) {
+    last_report_.updateFrom_(new_report);
+    stats_.duplicateSuppressed();
+    return queue_.isEmpty() ? SendStatus::sent : SendStatus::queued;
+  }
 
   // First, we determine if any modifiers have changed state
   const byte new_modifiers = new_report.getModifiers();
@@ -323,11 +473,13 @@ void Dispatcher::sendReport(const Report &new_report) {
   // keycodes removed to prevent getting any unintended output when keys are held long
   // enough to repeat. For example, if we have a `shift` + `C` key, holding it might
   // sometimes produce: `CCCCCc`.
+  // In two-phase mode, these releases go in the same report as the modifier changes,
+  // which has the same effect, as long as the host processes a report's releases
+  // first. In unordered mode, everything goes in a single report.
   const byte released_modifiers = old_modifiers & ~new_modifiers;
-  if ((released_modifiers != 0) &&
-      last_report_.updatePlainReleases_(new_report)) {
-    sendReportUnchecked_(last_report_);
-  }
+  const bool split_releases = ((modifier_ordering_ == ModifierOrdering::strict) &&
+                               (released_modifiers != 0) &&
+                               last_report_.hasPlainReleases_(new_report));
 
   // Next, if any modifiers were added since the previous report, we need to send those
   // first to ensure that the modifiers will be applied before any keycodes that were
@@ -335,57 +487,170 @@ void Dispatcher::sendReport(const Report &new_report) {
   // keycode press (Unshifter does this), we likewise need to send the modifier changes in
   // a separate report first. In short, modifier changes must come after key _releases_,
   // but before key _presses_.
-  const byte changed_modifiers  = old_modifiers ^ new_modifiers;
-  if (changed_modifiers != 0) {
+  const bool split_modifiers = ((modifier_ordering_ != ModifierOrdering::unordered) &&
+                                (old_modifiers != new_modifiers));
+
+  // Make sure there's room for every report we might need before changing anything, so
+  // a caller that gets `host_busy` can simply try again with the same report.
+  const byte reports_needed = 1 + split_releases + split_modifiers;
+  if (queue_.available() < reports_needed)
+    return SendStatus::host_busy;
+
+  const byte queue_length = queue_.length();
+
+  if (split_releases) {
+    last_report_.updatePlainReleases_(new_report);
+    pushReport_(last_report_);
+  }
+
+  if (split_modifiers) {
+    if (modifier_ordering_ == ModifierOrdering::two_phase &&
+        last_report_.hasPlainReleases_(new_report))
+      last_report_.updatePlainReleases_(new_report);
     last_report_.setModifiers(new_modifiers);
-    sendReportUnchecked_(last_report_);
+    pushReport_(last_report_);
   }
 
   // Last, we send a report with any keycodes that were added in the new report, if
   // any. We also update the stored previous report, if necessary.
   if (new_report != last_report_) {
     last_report_.updateFrom_(new_report);
-    sendReportUnchecked_(last_report_);
+    pushReport_(last_report_);
   }
+
+  if (queue_.length() - queue_length > 1)
+    stats_.updateSplit();
+
+  return SendStatus::queued;
 }
 
-void Dispatcher::sendBreakReport(byte keycode) {
-  last_report_.removeKeycode(keycode);
-  sendReportUnchecked_(last_report_);
+// Blocking version of `trySendReport()`. It doesn't return until the host has accepted
+// every queued report, including the new one(s). If a send fails, it stops there, and
+// leaves the rest of the queue for `poll()`, rather than waiting indefinitely for a host
+// that might be asleep.
+SendStatus Dispatcher::sendReport(const Report &new_report) {
+  SendStatus status;
+  while ((status = trySendReport(new_report)) == SendStatus::host_busy) {
+    status = sendQueuedReport_();
+    if (status != SendStatus::sent)
+      return status;
+  }
+  if (status != SendStatus::queued)
+    return status;
+  while (!queue_.isEmpty()) {
+    status = sendQueuedReport_();
+    if (status != SendStatus::sent)
+      return (status == SendStatus::host_busy) ? SendStatus::queued : status;
+  }
+  return SendStatus::sent;
+}
+
+SendStatus Dispatcher::sendBreakReport(byte keycode) {
+  Report report = last_report_;
+  report.removeKeycode(keycode);
+  return trySendReport(report);
+}
+
+bool Dispatcher::poll() {
+  updateLedState_();
+  if (queue_.isEmpty())
+    return false;
+  // The host collects at most one report per polling interval from the endpoint, so
+  // there's no point trying to send another until that many frames have passed; doing so
+  // would just block until the endpoint is free again. Only the low byte of the frame
+  // number is used, which is enough for any valid interval.
+  if (byte(UDFNUML - last_send_frame_) < poll_interval)
+    return false;
+  sendQueuedReport_();
+  return true;
+}
+
+void Dispatcher::pushReport_(const Report &report) {
+  queue_.push(report);
+  stats_.reportQueued();
+}
+
+void Dispatcher::refreshSharedLedState_() const {
+#if !HID_KEYBOARD_DEDICATED_ENDPOINT
+  // The shared interface receives the NKRO keyboard's LED reports, and keeps them to
+  // itself, so we check it for changes. Whichever interface changed last wins.
+  byte shared_leds = HID().getLEDs();
+  if (shared_leds != shared_leds_) {
+    shared_leds_ = shared_leds;
+    // `setLedState_()` is also called from the USB interrupt.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      setLedState_(shared_leds);
+    }
+  }
+#endif
+}
+
+void Dispatcher::updateLedState_() {
+  refreshSharedLedState_();
+  if (led_state_callback_ != nullptr && ledStateChanged())
+    (*led_state_callback_)(leds_);
+}
+
+SendStatus Dispatcher::sendQueuedReport_() {
+  if (queue_.isEmpty())
+    return SendStatus::sent;
+  const Report &report = queue_.front();
+  last_send_frame_ = UDFNUML;
+  // Intermediate reports can be indistinguishable from the previous one in boot
+  // protocol mode (e.g. releasing a seventh key), so don't bother sending them.
+  if (boot_protocol_ && report.matchesBootReport_(boot_report_)) {
+    stats_.reportDropped();
+    queue_.pop();
+    return SendStatus::sent;
+  }
+  int result = sendReportUnchecked_(report);
+  stats_.reportSent(result);
+  SendStatus status = sendStatus(result);
+  if (status == SendStatus::sent)
+    queue_.pop();
+  else if (status == SendStatus::host_absent)
+    dropQueuedReports_();
+  return status;
+}
+
+// Without a host, there's nobody to send the queued reports to, so they're dropped (as
+// the other dispatchers drop their pending reports).
+void Dispatcher::dropQueuedReports_() {
+  queue_.clear();
+  stats_.clearQueue();
 }
 
-// I'm not at all convinced that it's worthwhile to check the return value, and
-// the report-sending functions become more efficient if we just return void
-// instead, but for the moment, pass it through.
+// Returns the result of the USB send. `boot_report_` is only updated if the host accepts
+// the new boot report.
 int Dispatcher::sendReportUnchecked_(const Report &report) {
   if (boot_protocol_) {
-    report.translateToBootProtocol_(boot_report_);
-    return USB_Send(pluggedEndpoint | TRANSFER_RELEASE,
-                    &boot_report_, sizeof(boot_report_));
+    byte boot_report[sizeof(boot_report_)];
+    report.translateToBootProtocol_(boot_report);
+    int result = USB_Send(pluggedEndpoint | TRANSFER_RELEASE,
+                          &boot_report, sizeof(boot_report));
+    if (result >= 0)
+      memcpy(boot_report_, boot_report, sizeof(boot_report_));
+    return result;
   }
+#if HID_KEYBOARD_DEDICATED_ENDPOINT
+  return sendReport_(HID_REPORTID_NONE, report.data_, sizeof(report.data_));
+#else
   return HID().SendReport(HID_REPORTID_NKRO_KEYBOARD,
-                          &report, sizeof(report));
+                          report.data_, sizeof(report.data_));
+#endif
 }
 
-void Report::translateToBootProtocol_(byte (&boot_report)[8]) const {
-  // modifiers
-  memset(boot_report, 0, sizeof(boot_report));
-  byte boot_report_index{2};
-
+template <byte _first_key, byte _last_key>
+void BasicReport<_first_key, _last_key>::translateToBootProtocol_(byte (&boot_report)[8]) const {
+  static_assert(sizeof(boot_keys_) + 2 == sizeof(boot_report),
+                "Boot protocol slots don't match the boot report size");
   boot_report[0] = getModifiers();
-  for (byte i{1}; i < arraySize(data_); ++i) {
-    if (data_[i] == 0) continue;
-    for (byte n{0}; n < 8; ++n) {
-      if (bitRead(data_[i], n)) {
-        byte keycode = ((i - 1) * 8) + n;
-        boot_report[boot_report_index++] = keycode;
-        if (boot_report_index == sizeof(boot_report))
-          return;
-      }
-    }
-  }
+  boot_report[1] = 0;
+  memcpy(&boot_report[2], boot_keys_, sizeof(boot_keys_));
 }
 
+template class BasicReport<HID_KEYBOARD_NKRO_FIRST_KEY, HID_KEYBOARD_NKRO_LAST_KEY>;
+
 } // namespace keyboard {
 } // namespace hid {
 } // namespace kaleidoscope {
@@ -31,21 +31,39 @@ THE SOFTWARE.
 #include <Arduino.h>
 #include <PluggableUSB.h>
 #include <HID.h>
+#include <util/atomic.h>
 
 #include "kaleidoglyph/Key.h"
 #include "kaleidoglyph/utils.h"
+#include "kaleidoglyph/hid/bitmap.h"
+#include "kaleidoglyph/hid/interface.h"
+#include "kaleidoglyph/hid/report_queue.h"
+#include "kaleidoglyph/hid/stats.h"
 #include "HIDAliases.h"
+#include "HID-Settings.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace keyboard {
 
-class Report {
+class Dispatcher;
+
+// A keyboard report covering the plain keycodes from `_first_key` to `_last_key`
+// (inclusive), plus the modifiers. The size of the bitmap and its padding are derived
+// from the key range, so a build that never uses (for example) the keypad hexadecimal
+// keys can send shorter reports, and use less RAM for queued reports, by narrowing it.
+template <byte _first_key, byte _last_key>
+class BasicReport {
+
+  static_assert(_first_key <= _last_key,
+                "The NKRO key range must not be empty");
+  static_assert(_last_key < HID_KEYBOARD_FIRST_MODIFIER,
+                "The NKRO key range must not include the modifiers");
 
   friend class Dispatcher;
 
  public:
-  Report() {}
+  BasicReport() {}
 
   void clear();
 
@@ -58,77 +76,243 @@ class Report {
   void addModifiers(byte modifiers) { data_[0] |= modifiers; }
   void removeModifiers(byte modifiers) { data_[0] &= ~modifiers; }
 
-  bool operator==(const Report& other) const {
-    return (memcmp(data_, other.data_, sizeof(data_)) == 0);
+  static constexpr byte first_key = _first_key;
+  static constexpr byte last_key = _last_key;
+  static constexpr byte key_count = _last_key - _first_key + 1;
+
+ private:
+  // The bitmap starts on the byte boundary at or below the first keycode.
+  static constexpr byte first_byte = _first_key / 8;
+  static constexpr byte keycode_bytes = (_last_key / 8) - first_byte + 1;
+
+ public:
+  static constexpr byte leading_padding_bits = _first_key % 8;
+  static constexpr byte trailing_padding_bits =
+    (keycode_bytes * 8) - leading_padding_bits - key_count;
+
+  // A bitmap with the same layout as the report: modifiers in the first byte, followed
+  // by one bit per keycode.
+  static constexpr byte size = 1 + keycode_bytes;
+  typedef byte Bitmap[size];
+
+  // Apply a whole scan's worth of changes in one pass: first clear every key in
+  // `releases`, then set every key in `presses`. Returns `true` if the report changed.
+  // Padding bits outside the key range are ignored.
+  bool applyDiff(const Bitmap& presses, const Bitmap& releases);
+
+  bool operator==(const BasicReport& other) const {
+    return bitmap::equal(data_, other.data_, size);
   }
-  bool operator!=(const Report& other) const {
+  bool operator!=(const BasicReport& other) const {
     return !(*this == other);
   }
 
  private:
-  static constexpr byte keycode_bytes = bitfieldSize(HID_KEYBOARD_FIRST_MODIFIER);
-
   // It's important to make this a single array, rather than a struct with a separate
   // modifiers byte and keycodes array, because we're going to send this report data
   // directly to the HID().sendReport() function, and this is the only way to guarantee
   // that there won't be any padding bytes between the two members.
-  byte data_[1 + keycode_bytes] = {};
+  Bitmap data_ = {};
+
+  // The six-key boot protocol view of the report, kept up to date as keycodes are added
+  // and removed so that it never needs to be rebuilt from the bitmap when sending. Slots
+  // are filled in the order the keys were pressed, and empty slots are zero. Any plain
+  // keycodes that didn't fit are counted in `boot_overflow_`; when a slotted key is
+  // released, one of them takes its place.
+  static constexpr byte boot_key_slots = 6;
+  byte boot_keys_[boot_key_slots] = {};
+  byte boot_overflow_{0};
+
+  static bool isInRange_(byte keycode) {
+    return (keycode >= _first_key) && (keycode <= _last_key);
+  }
+  static byte byteIndex_(byte keycode) {
+    return 1 + (keycode / 8) - first_byte;
+  }
+  static byte keycodeAt_(byte i, byte bit) {
+    return ((first_byte + i) * 8) + bit;
+  }
+
+  bool hasPlainReleases_(const BasicReport& new_report) const;
+  bool updatePlainReleases_(const BasicReport& new_report);
+
+  void updateFrom_(const BasicReport& other) {
+    bitmap::copy(data_, other.data_, size);
+    memcpy(boot_keys_, other.boot_keys_, sizeof(boot_keys_));
+    boot_overflow_ = other.boot_overflow_;
+  }
 
-  bool updatePlainReleases_(const Report& new_report);
+  void addBootKey_(byte keycode);
+  void removeBootKey_(byte keycode);
+  void rebuildBootKeys_();
+  byte findUnslottedKeycode_() const;
 
-  void updateFrom_(const Report& other) {
-    memcpy(data_, other.data_, sizeof(data_));
+  bool bootViewEquals_(const BasicReport& other) const {
+    return ((getModifiers() == other.getModifiers()) &&
+            (memcmp(boot_keys_, other.boot_keys_, sizeof(boot_keys_)) == 0));
+  }
+  bool matchesBootReport_(const byte (&boot_report)[8]) const {
+    return ((getModifiers() == boot_report[0]) &&
+            (memcmp(boot_keys_, &boot_report[2], sizeof(boot_keys_)) == 0));
   }
   void translateToBootProtocol_(byte (&boot_report)[8]) const;
 
 };
 
-class Dispatcher : PluggableUSBModule {
+typedef BasicReport<HID_KEYBOARD_NKRO_FIRST_KEY, HID_KEYBOARD_NKRO_LAST_KEY> Report;
+
+static_assert(Report::size < USB_EP_SIZE,
+              "The NKRO keyboard report doesn't fit in a single packet");
+
+// One update can take three reports (plain key releases, modifier changes, then
+// presses), and `trySendReport()` only queues an update if it has room for all of them.
+static_assert(HID_KEYBOARD_REPORT_QUEUE_LENGTH >= 3,
+              "The keyboard report queue must hold at least three reports");
+
+// The order in which the parts of an update that changes modifiers are sent (see
+// `HID_KEYBOARD_MODIFIER_ORDERING`).
+enum class ModifierOrdering : byte {
+  strict,
+  two_phase,
+  unordered,
+};
+
+static_assert(HID_KEYBOARD_MODIFIER_ORDERING >= 0 && HID_KEYBOARD_MODIFIER_ORDERING <= 2,
+              "Invalid keyboard modifier ordering");
+
+class Dispatcher : DedicatedInterface {
 
  public:
+  static constexpr byte poll_interval = HID_KEYBOARD_POLL_INTERVAL;
+  static_assert(isValidPollInterval(HID_KEYBOARD_POLL_INTERVAL),
+                "Invalid keyboard polling interval");
+
   Dispatcher();
   void init();
+  // The lock LED state, as last set by the host. It's written when the host sends an
+  // LED report (on the keyboard's interface, or, with the shared `HID()` interface, as
+  // noticed by `poll()` or by this function). A change is reported once, either to the
+  // callback, which is called from `poll()` (never from the USB interrupt), or by
+  // `ledStateChanged()`.
   byte getLedState() const {
-    return HID().getLEDs();
+    refreshSharedLedState_();
+    return leds_;
+  }
+  typedef void (*LedStateCallback)(byte leds);
+  void setLedStateCallback(LedStateCallback callback) {
+    led_state_callback_ = callback;
+  }
+  // Returns `true` (once) if the LED state has changed since the last call.
+  bool ledStateChanged() {
+    bool changed;
+    // The USB interrupt can set the flag between reading and clearing it.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      changed = leds_changed_;
+      leds_changed_ = false;
+    }
+    return changed;
   }
   byte lastModifierState() const {
     return last_report_.getModifiers();
   }
-  void sendReport(const Report &report);
-  void sendBreakReport(byte keycode);
+  // `trySendReport()` only queues reports. It returns:
+  //
+  // - `sent`: the report doesn't change anything, and the queue is empty.
+  // - `queued`: the report (or its predecessors) will be sent by `poll()`.
+  // - `host_busy`: the queue is too full; nothing was queued.
+  // - `host_absent`: the device isn't configured; every queued report was dropped.
+  //
+  // `sendReport()` blocks until the host has collected every report, and returns `sent`,
+  // `queued` (if the host stopped accepting them part way), `host_busy` (if the queue
+  // was full and the host wasn't collecting reports, so nothing was queued), or
+  // `host_absent` (as above).
+  SendStatus sendReport(const Report &report);
+  SendStatus trySendReport(const Report &report);
+  SendStatus sendBreakReport(byte keycode);
+
+  // Send the next queued report, if the host has had a chance to collect the previous
+  // one (i.e. `poll_interval` frames have passed). A report the host doesn't accept
+  // stays at the head of the queue, and is sent again on a later call. This should be
+  // called once per scan cycle (or by the `Scheduler`). Returns `true` if it tried to
+  // send a report.
+  bool poll();
+  // `true` if the next report goes through the shared `HID()` interface.
+  bool usesSharedEndpoint() const {
+    return !HID_KEYBOARD_DEDICATED_ENDPOINT && !boot_protocol_;
+  }
+  bool hasPendingReports() const {
+    return !queue_.isEmpty();
+  }
+
+  // Counters and latency histogram (only collected if `HID_STATS` is enabled).
+  stats::Stats<HID_KEYBOARD_REPORT_QUEUE_LENGTH>& stats() {
+    return stats_;
+  }
 
   // should be enum class
   static constexpr byte boot_mode = HID_BOOT_PROTOCOL;
   static constexpr byte nkro_mode = HID_REPORT_PROTOCOL;
 
   bool getProtocol() const {
-    return hid_protocol_;
+    return protocol_;
   }
   void setProtocol(byte mode) {
-    hid_protocol_ = mode;
+    protocol_ = mode;
   }
   void toggleProtocol() {
     boot_protocol_ = !boot_protocol_;
   }
 
+  ModifierOrdering modifierOrdering() const {
+    return modifier_ordering_;
+  }
+  void setModifierOrdering(ModifierOrdering ordering) {
+    modifier_ordering_ = ordering;
+  }
+
  private:
+  // `last_report_` is the most recent report added to the queue, not necessarily the
+  // last one the host has received. Reports are only removed from the queue once the
+  // host has accepted them.
   Report last_report_;
+  ReportQueue<Report, HID_KEYBOARD_REPORT_QUEUE_LENGTH> queue_;
+  byte last_send_frame_{0};
+  stats::Stats<HID_KEYBOARD_REPORT_QUEUE_LENGTH> stats_;
 
   bool boot_protocol_{false};
-  byte hid_protocol_{nkro_mode};
-  byte boot_report_[8];
+  ModifierOrdering modifier_ordering_{ModifierOrdering(HID_KEYBOARD_MODIFIER_ORDERING)};
+  byte boot_report_[8] = {};
 
   int sendReportUnchecked_(const Report &report);
+  void pushReport_(const Report &report);
+  SendStatus sendQueuedReport_();
+  void dropQueuedReports_();
 
  protected:
   // PluggableUSBModule
-  int getInterface(byte* interface_count);
-  int getDescriptor(USBSetup& setup);
-  bool setup(USBSetup& setup);
-
-  byte epType[1] = {EP_TYPE_INTERRUPT_IN};
-  byte idle{1};
-  byte leds{0};
+#if !HID_KEYBOARD_DEDICATED_ENDPOINT
+  int getDescriptor(USBSetup& setup) override;
+#endif
+  bool setup(USBSetup& setup) override;
+
+  // Written from the USB control request handler. They're mutable because reading the
+  // state with `getLedState()` also picks up a change from the shared interface.
+  mutable volatile byte leds_{0};
+  mutable volatile bool leds_changed_{false};
+  LedStateCallback led_state_callback_{nullptr};
+#if !HID_KEYBOARD_DEDICATED_ENDPOINT
+  // The last LED state seen from the shared interface.
+  mutable byte shared_leds_{0};
+#endif
+
+  void setLedState_(byte leds) const {
+    if (leds != leds_) {
+      leds_ = leds;
+      leds_changed_ = true;
+    }
+  }
+  void refreshSharedLedState_() const;
+  void updateLedState_();
 
 };
 
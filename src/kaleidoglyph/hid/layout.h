@@ -0,0 +1,135 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "HIDTables.h"
+#include "HIDAliases.h"
+#include "kaleidoglyph/hid/descriptor.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace layout {
+
+// Character-to-keystroke lookup tables for typing text, built at compile time and
+// stored in PROGMEM. A layout is described by the characters that each key produces,
+// starting from `A` (keycode 0x04), unshifted and shifted (and optionally with AltGr);
+// `Table` turns that into an array indexed by character, so a lookup is a single
+// `pgm_read_word()`. To add a layout, define a struct like `UsQwerty`, and use
+// `Table<MyLayout>::lookup()`. Only 7-bit characters are mapped; anything else (e.g. the
+// bytes of a multi-byte UTF-8 sequence) looks up as `{0, 0}`.
+
+struct Keystroke {
+  byte keycode;
+  byte modifiers;
+};
+
+struct UsQwerty {
+  static constexpr byte key_count =
+    HID_KEYBOARD_SLASH_AND_QUESTION_MARK - HID_KEYBOARD_A_AND_A + 1;
+  // `\0` marks keys that don't type a character (the literals are split to keep the
+  // escapes from running together).
+  static constexpr char plain(byte i) {
+    return ("abcdefghijklmnopqrstuvwxyz1234567890"
+            "\n" "\0" "\b\t -=[]\\" "\0" ";'`,./")[i];
+  }
+  static constexpr char shifted(byte i) {
+    return ("ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()"
+            "\0\0\0\0" "\0_+{}|" "\0" ":\"~<>?")[i];
+  }
+  static constexpr char altgr(byte /*i*/) {
+    return '\0';
+  }
+};
+
+// The modifier bits used in a `Keystroke`.
+constexpr byte shift_modifier = 1 << (HID_KEYBOARD_LEFT_SHIFT - HID_KEYBOARD_FIRST_MODIFIER);
+constexpr byte altgr_modifier = 1 << (HID_KEYBOARD_RIGHT_ALT - HID_KEYBOARD_FIRST_MODIFIER);
+
+// Table entries have the keycode in the low byte and the modifiers in the high byte.
+// Characters that appear without modifiers are preferred.
+template <typename _Layout>
+constexpr uint16_t findKey(char c, byte i = 0) {
+  return (c == '\0' || i == _Layout::key_count) ? 0 :
+         (_Layout::plain(i) == c) ? (HID_KEYBOARD_A_AND_A + i) :
+         findKey<_Layout>(c, i + 1);
+}
+
+template <typename _Layout>
+constexpr uint16_t findShiftedKey(char c, byte i = 0) {
+  return (c == '\0' || i == _Layout::key_count) ? 0 :
+         (_Layout::shifted(i) == c) ? ((shift_modifier << 8) | (HID_KEYBOARD_A_AND_A + i)) :
+         findShiftedKey<_Layout>(c, i + 1);
+}
+
+template <typename _Layout>
+constexpr uint16_t findAltGrKey(char c, byte i = 0) {
+  return (c == '\0' || i == _Layout::key_count) ? 0 :
+         (_Layout::altgr(i) == c) ? ((altgr_modifier << 8) | (HID_KEYBOARD_A_AND_A + i)) :
+         findAltGrKey<_Layout>(c, i + 1);
+}
+
+template <typename _Layout>
+constexpr uint16_t tableEntry(char c) {
+  return findKey<_Layout>(c) ? findKey<_Layout>(c) :
+         findShiftedKey<_Layout>(c) ? findShiftedKey<_Layout>(c) :
+         findAltGrKey<_Layout>(c);
+}
+
+// The table covers backspace (0x08) through `~` (0x7E).
+constexpr byte first_char = '\b';
+constexpr byte last_char = '~';
+
+using descriptor::Indices;
+using descriptor::MakeIndices;
+
+template <typename _Layout,
+          typename _Indices = typename MakeIndices<last_char - first_char + 1>::type>
+struct Table;
+
+template <typename _Layout, byte... _i>
+struct Table<_Layout, Indices<_i...>> {
+  static const uint16_t data[sizeof...(_i)] PROGMEM;
+
+  static Keystroke lookup(char c) {
+    byte i = byte(c) - first_char;
+    if (i >= sizeof...(_i))
+      return {0, 0};
+    uint16_t entry = pgm_read_word(&data[i]);
+    return {byte(entry), byte(entry >> 8)};
+  }
+};
+
+template <typename _Layout, byte... _i>
+const uint16_t Table<_Layout, Indices<_i...>>::data[sizeof...(_i)] PROGMEM = {
+  tableEntry<_Layout>(char(first_char + _i))...
+};
+
+} // namespace layout {
+} // namespace hid {
+} // namespace kaleidoglyph {
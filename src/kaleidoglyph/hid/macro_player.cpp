@@ -0,0 +1,163 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/macro_player.h"
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace hid {
+namespace keyboard {
+
+// The abandoned macro's keys are released first; otherwise any key it pressed (or a tap
+// still in progress) would stay down in every report the new one sends. A macro that
+// ended with a key still pressed is holding it too.
+void MacroPlayer::play(const byte* macro) {
+  if (isPlaying() || held_ != Report())
+    stop();
+  next_ = macro;
+  wait_frames_ = 0;
+  wait_started_ = false;
+}
+
+void MacroPlayer::stop() {
+  next_ = nullptr;
+  wait_frames_ = 0;
+  wait_started_ = false;
+  tapped_keycode_ = 0;
+  held_.clear();
+  dispatcher_.sendReport(held_);
+}
+
+void MacroPlayer::poll() {
+  while (isPlaying() && step_())
+    continue;
+}
+
+// Queue the report for the next event in the macro. Returns `false` if there's nothing
+// more to do until a later call, because the dispatcher's queue is full, or the macro
+// is waiting.
+bool MacroPlayer::step_() {
+  if (wait_frames_ != 0) {
+    // The wait starts once the reports before it have left the dispatcher's queue, so
+    // the host sees the whole pause, however long the queue was.
+    if (!wait_started_) {
+      if (dispatcher_.hasPendingReports())
+        return false;
+      wait_start_frame_ = UDFNUML;
+      wait_started_ = true;
+    }
+    if (byte(UDFNUML - wait_start_frame_) < wait_frames_)
+      return false;
+    wait_frames_ = 0;
+  }
+
+  if (next_ == nullptr)
+    return releaseTappedKey_();
+
+  byte command = pgm_read_byte(next_);
+
+  if (command == macro::end) {
+    if (!releaseTappedKey_())
+      return false;
+    next_ = nullptr;
+    return true;
+  }
+
+  if (command < macro::press || command == macro::tap_with) {
+    byte modifiers{0};
+    byte keycode = command;
+    byte length{1};
+    if (command == macro::tap_with) {
+      modifiers = pgm_read_byte(next_ + 1);
+      keycode = pgm_read_byte(next_ + 2);
+      length = 3;
+    }
+    // The host can't see a key being pressed again until it has seen it released.
+    if (keycode == tapped_keycode_)
+      return releaseTappedKey_();
+    Report report = held_;
+    report.addKeycode(keycode);
+    report.addModifiers(modifiers);
+    if (!send_(report))
+      return false;
+    tapped_keycode_ = keycode;
+    next_ += length;
+    return true;
+  }
+
+  // Every other command releases the tapped key first.
+  if (!releaseTappedKey_())
+    return false;
+
+  byte argument = pgm_read_byte(next_ + 1);
+  if (command == macro::wait) {
+    wait_started_ = false;
+    wait_frames_ = argument;
+    next_ += 2;
+    return true;
+  }
+
+  Report report = held_;
+  if (command == macro::press) {
+    report.addKeycode(argument);
+  } else if (command == macro::release) {
+    report.removeKeycode(argument);
+  }
+  if (!send_(report))
+    return false;
+  held_ = report;
+  next_ += 2;
+  return true;
+}
+
+bool MacroPlayer::releaseTappedKey_() {
+  if (tapped_keycode_ == 0)
+    return true;
+  if (!send_(held_))
+    return false;
+  tapped_keycode_ = 0;
+  return true;
+}
+
+bool MacroPlayer::send_(const Report& report) {
+  switch (dispatcher_.trySendReport(report)) {
+    case SendStatus::host_busy:
+      return false;
+    case SendStatus::host_absent:
+      // There's nobody to type to.
+      next_ = nullptr;
+      tapped_keycode_ = 0;
+      wait_frames_ = 0;
+      wait_started_ = false;
+      held_.clear();
+      return false;
+    default:
+      return true;
+  }
+}
+
+} // namespace keyboard {
+} // namespace hid {
+} // namespace kaleidoglyph {
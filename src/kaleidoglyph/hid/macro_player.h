@@ -0,0 +1,103 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "kaleidoglyph/hid/keyboard.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace keyboard {
+
+// Macros are byte streams stored in PROGMEM. Most bytes are keycodes, each of which
+// taps that key; the rest are these commands:
+namespace macro {
+constexpr byte end       = 0x00;  // end of the macro
+constexpr byte press     = 0xF0;  // press <keycode>, and hold it until released
+constexpr byte release   = 0xF1;  // release <keycode>
+constexpr byte tap_with  = 0xF2;  // tap <keycode> with <modifiers> (a bitfield) held
+constexpr byte wait      = 0xF3;  // wait <count> frames, once the host has the reports so far
+} // namespace macro {
+
+// For example, "Hi!" followed by Enter:
+//
+//   const byte hi[] PROGMEM = {
+//     macro::tap_with, 0x02, HID_KEYBOARD_H_AND_H,
+//     HID_KEYBOARD_I_AND_I,
+//     macro::tap_with, 0x02, HID_KEYBOARD_1_AND_EXCLAMATION_POINT,
+//     HID_KEYBOARD_ENTER,
+//     macro::end,
+//   };
+
+// The MacroPlayer feeds a macro to the keyboard dispatcher as fast as the host will
+// take it, by keeping the dispatcher's queue full; the dispatcher then sends one report
+// per polling interval. A tapped key isn't released on its own: the report that presses
+// the next key releases it at the same time, which the host sees as ordinary rollover.
+// The only extra release reports are for a key tapped twice in a row, and at the end of
+// the macro. The dispatcher takes care of the order of any modifier changes.
+//
+// The player assumes it has the keyboard to itself while it's playing; keys the user
+// holds aren't included in its reports.
+class MacroPlayer {
+
+ public:
+  explicit MacroPlayer(Dispatcher& dispatcher) : dispatcher_(dispatcher) {}
+
+  // Start playing `macro` (in PROGMEM), abandoning any macro that's already playing, and
+  // releasing any keys it's holding.
+  void play(const byte* macro);
+  // Stop playing, and release any keys the macro is holding.
+  void stop();
+  bool isPlaying() const {
+    return next_ != nullptr || tapped_keycode_ != 0;
+  }
+
+  // Queue as many reports as the dispatcher will take. Call this once per scan cycle,
+  // before the dispatcher's (or the scheduler's) `poll()`.
+  void poll();
+
+ private:
+  Dispatcher& dispatcher_;
+  const byte* next_{nullptr};
+  // The keys the macro is holding down.
+  Report held_;
+  // The last key tapped, which the host still sees as pressed.
+  byte tapped_keycode_{0};
+  byte wait_start_frame_{0};
+  byte wait_frames_{0};
+  bool wait_started_{false};
+
+  bool step_();
+  bool releaseTappedKey_();
+  bool send_(const Report& report);
+
+};
+
+} // namespace keyboard {
+} // namespace hid {
+} // namespace kaleidoglyph {
@@ -28,58 +28,148 @@ THE SOFTWARE.
 
 #include <kaleidoglyph/utils.h>
 #include "DescriptorPrimitives.h"
+#include "HIDTables.h"
+#include "kaleidoglyph/hid/descriptor.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace mouse {
 
-static byte const mouse_descriptor[] PROGMEM = {
-  /*  Mouse relative */
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,           // USAGE_PAGE (Generic Desktop)
-  D_USAGE, D_USAGE_MOUSE,                         //  USAGE (Mouse)
-  D_COLLECTION, D_APPLICATION,                    //   COLLECTION (Application)
-  D_REPORT_ID, HID_REPORTID_MOUSE,                //    REPORT_ID (Mouse)
-
-  /* 8 Buttons */
-  D_USAGE_PAGE, D_PAGE_BUTTON,                    //    USAGE_PAGE (Button)
-  D_USAGE_MINIMUM, 0x01,                          //     USAGE_MINIMUM (Button 1)
-  D_USAGE_MAXIMUM, 0x08,                          //     USAGE_MAXIMUM (Button 8)
-  D_LOGICAL_MINIMUM, 0x00,                        //     LOGICAL_MINIMUM (0)
-  D_LOGICAL_MAXIMUM, 0x01,                        //     LOGICAL_MAXIMUM (1)
-  D_REPORT_COUNT, 0x08,                           //     REPORT_COUNT (8)
-  D_REPORT_SIZE, 0x01,                            //     REPORT_SIZE (1)
-  D_INPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),        //     INPUT (Data,Var,Abs)
+using namespace descriptor;
 
+// With 8-bit X and Y, the vertical wheel shares their input item, which keeps the
+// descriptor short.
+typedef Descriptor<
   /* X, Y, Wheel */
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,           //    USAGE_PAGE (Generic Desktop)
-  D_USAGE, 0x30,                                  //     USAGE (X)
-  D_USAGE, 0x31,                                  //     USAGE (Y)
-  D_USAGE, 0x38,                                  //     USAGE (Wheel)
-  D_LOGICAL_MINIMUM, 0x81,                        //     LOGICAL_MINIMUM (-127)
-  D_LOGICAL_MAXIMUM, 0x7f,                        //     LOGICAL_MAXIMUM (127)
-  D_REPORT_SIZE, 0x08,                            //     REPORT_SIZE (8)
-  D_REPORT_COUNT, 0x03,                           //     REPORT_COUNT (3)
-  D_INPUT, (D_DATA|D_VARIABLE|D_RELATIVE),        //     INPUT (Data,Var,Rel)
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              //    USAGE_PAGE (Generic Desktop)
+  Usage<0x30>,                                    //     USAGE (X)
+  Usage<0x31>,                                    //     USAGE (Y)
+  Usage<0x38>,                                    //     USAGE (Wheel)
+  LogicalMinimum<-127>,                           //     LOGICAL_MINIMUM (-127)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  ReportCount<3>,                                 //     REPORT_COUNT (3)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>             //     INPUT (Data,Var,Rel)
+> CursorAndWheelDescriptor;
+
+typedef Descriptor<
+  /* X, Y */
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              //    USAGE_PAGE (Generic Desktop)
+  Usage<0x30>,                                    //     USAGE (X)
+  Usage<0x31>,                                    //     USAGE (Y)
+  LogicalMinimum<-Report::max_cursor_delta>,      //     LOGICAL_MINIMUM
+  LogicalMaximum<Report::max_cursor_delta>,       //     LOGICAL_MAXIMUM
+  ReportSize<8 * sizeof(Report::CursorDelta)>,    //     REPORT_SIZE (8 or 16)
+  ReportCount<2>,                                 //     REPORT_COUNT (2)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>             //     INPUT (Data,Var,Rel)
+> CursorDescriptor;
+
+typedef Descriptor<
+  /* Wheel */
+  Usage<0x38>,                                    //     USAGE (Wheel)
+  LogicalMinimum<-127>,                           //     LOGICAL_MINIMUM (-127)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  ReportCount<1>,                                 //     REPORT_COUNT (1)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>             //     INPUT (Data,Var,Rel)
+> WheelDescriptor;
+
+typedef Descriptor<
+  /* Horizontal wheel */
+  UsagePage<D_PAGE_CONSUMER>,                     //    USAGE_PAGE (Consumer)
+  Usage<HID_CONSUMER_AC_PAN>,                     //     USAGE (AC Pan)
+  LogicalMinimum<-127>,                           //     LOGICAL_MINIMUM (-127)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  ReportCount<1>,                                 //     REPORT_COUNT (1)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>             //     INPUT (Data,Var,Rel)
+> PanDescriptor;
+
+// The same wheels, each in a logical collection with a Resolution Multiplier. When the
+// host sets a multiplier to 1, it expects `HID_MOUSE_WHEEL_MULTIPLIER` units per detent
+// on that wheel. The two multipliers make up a one-byte feature report.
+typedef Descriptor<
+  /* Wheel */
+  Collection<D_LOGICAL>,                          //    COLLECTION (Logical)
+  Usage<0x48>,                                    //     USAGE (Resolution Multiplier)
+  LogicalMinimum<0>,                              //     LOGICAL_MINIMUM (0)
+  LogicalMaximum<1>,                              //     LOGICAL_MAXIMUM (1)
+  PhysicalMinimum<1>,                             //     PHYSICAL_MINIMUM (1)
+  PhysicalMaximum<HID_MOUSE_WHEEL_MULTIPLIER>,    //     PHYSICAL_MAXIMUM (multiplier)
+  ReportSize<2>,                                  //     REPORT_SIZE (2)
+  ReportCount<1>,                                 //     REPORT_COUNT (1)
+  Feature<D_DATA|D_VARIABLE|D_ABSOLUTE>,          //     FEATURE (Data,Var,Abs)
+  Usage<0x38>,                                    //     USAGE (Wheel)
+  LogicalMinimum<-127>,                           //     LOGICAL_MINIMUM (-127)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  PhysicalMinimum<0>,                             //     PHYSICAL_MINIMUM (0)
+  PhysicalMaximum<0>,                             //     PHYSICAL_MAXIMUM (0)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>,            //     INPUT (Data,Var,Rel)
+  EndCollection,                                  //    END_COLLECTION
 
   /* Horizontal wheel */
-  D_USAGE_PAGE, D_PAGE_CONSUMER,                  //    USAGE_PAGE (Consumer)
-  D_PAGE_ORDINAL, 0x38, 0x02,                     //     PAGE (AC Pan)
-  D_LOGICAL_MINIMUM, 0x81,                        //     LOGICAL_MINIMUM (-127)
-  D_LOGICAL_MAXIMUM, 0x7f,                        //     LOGICAL_MAXIMUM (127)
-  D_REPORT_SIZE, 0x08,                            //     REPORT_SIZE (8)
-  D_REPORT_COUNT, 0x01,                           //     REPORT_COUNT (1)
-  D_INPUT, (D_DATA|D_VARIABLE|D_RELATIVE),        //     INPUT (Data,Var,Rel)
+  Collection<D_LOGICAL>,                          //    COLLECTION (Logical)
+  Usage<0x48>,                                    //     USAGE (Resolution Multiplier)
+  LogicalMinimum<0>,                              //     LOGICAL_MINIMUM (0)
+  LogicalMaximum<1>,                              //     LOGICAL_MAXIMUM (1)
+  PhysicalMinimum<1>,                             //     PHYSICAL_MINIMUM (1)
+  PhysicalMaximum<HID_MOUSE_WHEEL_MULTIPLIER>,    //     PHYSICAL_MAXIMUM (multiplier)
+  ReportSize<2>,                                  //     REPORT_SIZE (2)
+  Feature<D_DATA|D_VARIABLE|D_ABSOLUTE>,          //     FEATURE (Data,Var,Abs)
+  ReportSize<4>,                                  //     REPORT_SIZE (4)
+  Feature<D_CONSTANT>,                            //     FEATURE (Cnst) -- padding
+  PhysicalMinimum<0>,                             //     PHYSICAL_MINIMUM (0)
+  PhysicalMaximum<0>,                             //     PHYSICAL_MAXIMUM (0)
+  UsagePage<D_PAGE_CONSUMER>,                     //     USAGE_PAGE (Consumer)
+  Usage<HID_CONSUMER_AC_PAN>,                     //     USAGE (AC Pan)
+  LogicalMinimum<-127>,                           //     LOGICAL_MINIMUM (-127)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>,            //     INPUT (Data,Var,Rel)
+  EndCollection                                   //    END_COLLECTION
+> HighResolutionWheelDescriptor;
+
+static_assert(HighResolutionWheelDescriptor::feature_bytes == 1,
+              "The wheel resolution multipliers don't fit in one byte");
+
+typedef Descriptor<
+  /*  Mouse relative */
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              // USAGE_PAGE (Generic Desktop)
+  Usage<D_USAGE_MOUSE>,                           //  USAGE (Mouse)
+  Collection<D_APPLICATION>,                      //   COLLECTION (Application)
+  ReportId<report_id>,                            //    REPORT_ID (Mouse)
+
+  /* 8 Buttons */
+  UsagePage<D_PAGE_BUTTON>,                       //    USAGE_PAGE (Button)
+  UsageMinimum<0x01>,                             //     USAGE_MINIMUM (Button 1)
+  UsageMaximum<0x08>,                             //     USAGE_MAXIMUM (Button 8)
+  LogicalMinimum<0>,                              //     LOGICAL_MINIMUM (0)
+  LogicalMaximum<1>,                              //     LOGICAL_MAXIMUM (1)
+  ReportCount<8>,                                 //     REPORT_COUNT (8)
+  ReportSize<1>,                                  //     REPORT_SIZE (1)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,            //     INPUT (Data,Var,Abs)
+
+  /* X, Y and wheels */
+  Select<high_resolution_wheels,
+         Descriptor<CursorDescriptor, HighResolutionWheelDescriptor>,
+         Select<HID_MOUSE_16BIT_AXES,
+                Descriptor<CursorDescriptor, WheelDescriptor, PanDescriptor>,
+                Descriptor<CursorAndWheelDescriptor, PanDescriptor>>::type>::type,
 
   /* End */
-  D_END_COLLECTION                                // END_COLLECTION
-};
+  EndCollection                                   // END_COLLECTION
+> MouseDescriptor;
+
+static_assert(MouseDescriptor::input_bytes == sizeof(Report),
+              "Mouse descriptor doesn't match the mouse report size");
 
 
 void Report::pressButtons(byte buttons) {
   buttons_ = buttons;
 }
 
-void Report::moveCursor(int8_t x_delta, int8_t y_delta) {
+void Report::moveCursor(CursorDelta x_delta, CursorDelta y_delta) {
   x_delta_ = x_delta;
   y_delta_ = y_delta;
 }
@@ -92,58 +182,253 @@ void Report::scrollHorizontal(int8_t h_delta) {
   h_delta_ = h_delta;
 }
 
-Dispatcher::Dispatcher() {
-  static HIDSubDescriptor node(mouse_descriptor, sizeof(mouse_descriptor));
-  HID().AppendDescriptor(&node);
+Dispatcher::Dispatcher()
+    : Interface<HID_MOUSE_DEDICATED_ENDPOINT>(MouseDescriptor::data(),
+                                              MouseDescriptor::length,
+                                              poll_interval) {}
+
+namespace {
+
+constexpr int16_t unit = 1 << HID_MOUSE_SUBPIXEL_BITS;
+
+int16_t saturatingAdd(int16_t a, int32_t b) {
+  int32_t sum = int32_t(a) + b;
+  if (sum > INT16_MAX)
+    return INT16_MAX;
+  if (sum < INT16_MIN)
+    return INT16_MIN;
+  return sum;
+}
+
+// Take the whole units (rounding towards zero, so the remainder keeps its sign) out of
+// `accumulator`, up to `max_delta`, the most that fits in a report.
+int16_t takeDelta(int16_t& accumulator, int16_t max_delta) {
+  int16_t delta = accumulator / unit;
+  if (delta > max_delta)
+    delta = max_delta;
+  if (delta < -max_delta)
+    delta = -max_delta;
+  accumulator -= delta * unit;
+  return delta;
+}
+
+bool fits(int32_t delta, int16_t max_delta) {
+  return (delta >= -max_delta) && (delta <= max_delta);
 }
 
+} // namespace {
+
 void Dispatcher::init() {
+  plug();
+  stats_.publish(stats::Source::mouse);
   Report empty_report;
-  sendReport(empty_report);
+  sendReportUnchecked_(empty_report);
+}
+
+void Dispatcher::accumulate(int16_t x, int16_t y, int16_t v, int16_t h) {
+  updateWheelMultipliers_();
+  x_accumulator_ = saturatingAdd(x_accumulator_, x);
+  y_accumulator_ = saturatingAdd(y_accumulator_, y);
+  v_accumulator_ = saturatingAdd(v_accumulator_, int32_t(v) * verticalWheelMultiplier());
+  h_accumulator_ = saturatingAdd(h_accumulator_, int32_t(h) * horizontalWheelMultiplier());
+}
+
+// The wheel accumulators hold movement in the host's wheel units, so when the host
+// changes the multipliers (normally only while it's configuring the device), whatever
+// was left in them is dropped.
+void Dispatcher::updateWheelMultipliers_() {
+  byte multipliers = wheel_multipliers_;
+  if (multipliers != accumulated_wheel_multipliers_) {
+    accumulated_wheel_multipliers_ = multipliers;
+    v_accumulator_ = 0;
+    h_accumulator_ = 0;
+  }
+}
+
+#if HID_MOUSE_DEDICATED_ENDPOINT
+bool Dispatcher::setup(USBSetup& setup) {
+  if (pluggedInterface != setup.wIndex) {
+    return false;
+  }
+
+  if (high_resolution_wheels && setup.wValueH == HID_REPORT_TYPE_FEATURE) {
+    if (setup.bmRequestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE &&
+        setup.bRequest == HID_GET_REPORT) {
+      byte multipliers = wheel_multipliers_;
+      USB_SendControl(0, &multipliers, sizeof(multipliers));
+      return true;
+    }
+    if (setup.bmRequestType == REQUEST_HOSTTODEVICE_CLASS_INTERFACE &&
+        setup.bRequest == HID_SET_REPORT &&
+        setup.wLength == sizeof(byte)) {
+      byte multipliers;
+      USB_RecvControl(&multipliers, sizeof(multipliers));
+      wheel_multipliers_ = multipliers;
+      return true;
+    }
+  }
+
+  return DedicatedInterface::setup(setup);
+}
+#endif
+
+bool Dispatcher::hasPendingReports() const {
+  // Fractions of a unit don't count; they'll wait for more movement.
+  return (has_pending_report_ ||
+          buttons_ != prev_buttons_ ||
+          x_accumulator_ / unit != 0 || y_accumulator_ / unit != 0 ||
+          v_accumulator_ / unit != 0 || h_accumulator_ / unit != 0);
+}
+
+SendStatus Dispatcher::sendReport(const Report& report) {
+  if (has_pending_report_) {
+    SendStatus status = sendPendingReport_();
+    if (status == SendStatus::queued)
+      return SendStatus::host_busy;
+    if (status == SendStatus::host_absent)
+      return status;
+  }
+  if (isRedundant_(report)) {
+    stats_.duplicateSuppressed();
+    return SendStatus::sent;
+  }
+  return sendReportUnchecked_(report);
+}
+
+SendStatus Dispatcher::trySendReport(const Report& report) {
+  if (!has_pending_report_) {
+    if (isRedundant_(report)) {
+      stats_.duplicateSuppressed();
+      return SendStatus::sent;
+    }
+    pending_report_ = report;
+    has_pending_report_ = true;
+    stats_.reportQueued();
+    return SendStatus::queued;
+  }
+  if (addToPendingReport_(report))
+    return SendStatus::queued;
+  return SendStatus::host_busy;
+}
+
+bool Dispatcher::poll() {
+  if (byte(UDFNUML - last_send_frame_) < poll_interval)
+    return false;
+  updateWheelMultipliers_();
+  if (has_pending_report_) {
+    sendPendingReport_();
+    return true;
+  }
+  return sendAccumulatedReport_();
+}
+
+SendStatus Dispatcher::sendPendingReport_() {
+  Report report = pending_report_;
+  last_send_frame_ = UDFNUML;
+  return sendReportUnchecked_(report);
+}
+
+bool Dispatcher::sendAccumulatedReport_() {
+  Report report;
+  report.buttons_ = buttons_;
+  report.x_delta_ = takeDelta(x_accumulator_, Report::max_cursor_delta);
+  report.y_delta_ = takeDelta(y_accumulator_, Report::max_cursor_delta);
+  report.v_delta_ = takeDelta(v_accumulator_, 127);
+  report.h_delta_ = takeDelta(h_accumulator_, 127);
+  if (isRedundant_(report))
+    return false;
+  last_send_frame_ = UDFNUML;
+  // If the host is busy, the report (and the movement in it) waits in `pending_report_`.
+  sendReportUnchecked_(report);
+  return true;
+}
+
+// A report with no movement that doesn't change the buttons wouldn't tell the host
+// anything.
+bool Dispatcher::isRedundant_(const Report& report) const {
+  return (report.buttons_ == prev_buttons_ &&
+          report.x_delta_ == 0 && report.y_delta_ == 0 &&
+          report.v_delta_ == 0 && report.h_delta_ == 0);
 }
 
-void Dispatcher::sendReport(const Report& report) {
-  HID().SendReport(HID_REPORTID_MOUSE, &report, sizeof(report));
+// Add the movement in `report` to the waiting report. This only works if the buttons
+// haven't changed (we mustn't lose a click), and if the sums still fit in the report.
+bool Dispatcher::addToPendingReport_(const Report& report) {
+  if (report.buttons_ != pending_report_.buttons_)
+    return false;
+  int32_t x = int32_t(pending_report_.x_delta_) + report.x_delta_;
+  int32_t y = int32_t(pending_report_.y_delta_) + report.y_delta_;
+  int16_t v = pending_report_.v_delta_ + report.v_delta_;
+  int16_t h = pending_report_.h_delta_ + report.h_delta_;
+  if (!fits(x, Report::max_cursor_delta) || !fits(y, Report::max_cursor_delta) ||
+      !fits(v, 127) || !fits(h, 127))
+    return false;
+  pending_report_.x_delta_ = x;
+  pending_report_.y_delta_ = y;
+  pending_report_.v_delta_ = v;
+  pending_report_.h_delta_ = h;
+  return true;
+}
+
+SendStatus Dispatcher::sendReportUnchecked_(const Report& report) {
+  stats_.reportQueued();
+  int result = sendReport_(report_id, &report, sizeof(report));
+  stats_.reportSent(result);
+  SendStatus status = sendStatus(result);
+  has_pending_report_ = (status == SendStatus::host_busy);
+  if (has_pending_report_) {
+    pending_report_ = report;
+    return SendStatus::queued;
+  }
+  if (status == SendStatus::sent) {
+    prev_buttons_ = report.buttons_;
+  } else {
+    stats_.clearQueue();
+  }
+  return status;
 }
 
 // ----------------------------------------------------------------------------
 namespace absolute {
 
-static byte const absolute_mouse_descriptor[] PROGMEM = {
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,           // USAGE_PAGE (Generic Desktop)
-  D_USAGE, D_USAGE_MOUSE,                         // USAGE (Mouse)
-  D_COLLECTION, D_APPLICATION,                    // COLLECTION (Application)
+typedef Descriptor<
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              // USAGE_PAGE (Generic Desktop)
+  Usage<D_USAGE_MOUSE>,                           // USAGE (Mouse)
+  Collection<D_APPLICATION>,                      // COLLECTION (Application)
 
   // 8 buttons
-  D_USAGE_PAGE, D_PAGE_BUTTON,        //     USAGE_PAGE (Button)
-  D_USAGE_MINIMUM, 0x01,              //     USAGE_MINIMUM (Button 1)
-  D_USAGE_MAXIMUM, 0x08,              //     USAGE_MAXIMUM (Button 8)
-  D_LOGICAL_MINIMUM, 0x00,            //     LOGICAL_MINIMUM (0)
-  D_LOGICAL_MAXIMUM, 0x01,            //     LOGICAL_MAXIMUM (1)
-  D_REPORT_COUNT, 0x08,               //     REPORT_COUNT (8)
-  D_REPORT_SIZE, 0x01,                //     REPORT_SIZE (1)
-  D_INPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),
+  UsagePage<D_PAGE_BUTTON>,                       //     USAGE_PAGE (Button)
+  UsageMinimum<0x01>,                             //     USAGE_MINIMUM (Button 1)
+  UsageMaximum<0x08>,                             //     USAGE_MAXIMUM (Button 8)
+  LogicalMinimum<0>,                              //     LOGICAL_MINIMUM (0)
+  LogicalMaximum<1>,                              //     LOGICAL_MAXIMUM (1)
+  ReportCount<8>,                                 //     REPORT_COUNT (8)
+  ReportSize<1>,                                  //     REPORT_SIZE (1)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,
 
   // x & y coordinates
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,       // USAGE_PAGE (Generic Desktop)
-  D_USAGE, 0x30,                      	      // USAGE (X)
-  D_USAGE, 0x31,                              // USAGE (Y)
-  D_MULTIBYTE(D_LOGICAL_MINIMUM), 0x00, 0x00, // Logical Minimum (0)
-  D_MULTIBYTE(D_LOGICAL_MAXIMUM), 0xFF, 0x7f, // Logical Maximum (32767)
-  D_REPORT_SIZE, 0x10,			      // Report Size (16),
-  D_REPORT_COUNT, 0x02,		 	      // Report Count (2),
-  D_INPUT, (D_DATA|D_VARIABLE|D_ABSOLUTE),    // Input (Data, Variable, Absolute)
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,              // USAGE_PAGE (Generic Desktop)
+  Usage<0x30>,                                    // USAGE (X)
+  Usage<0x31>,                                    // USAGE (Y)
+  LogicalMinimum<0>,                              // Logical Minimum (0)
+  LogicalMaximum<32767>,                          // Logical Maximum (32767)
+  ReportSize<16>,                                 // Report Size (16),
+  ReportCount<2>,                                 // Report Count (2),
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,            // Input (Data, Variable, Absolute)
 
   // scroll wheel
-  D_USAGE, 0x38,                      	    //     USAGE (Wheel)
-  D_LOGICAL_MINIMUM, 0x81,                  //     LOGICAL_MINIMUM (-127)
-  D_LOGICAL_MAXIMUM, 0x7f,                  //     LOGICAL_MAXIMUM (127)
-  D_REPORT_SIZE, 0x08,                      //     REPORT_SIZE (8)
-  D_REPORT_COUNT, 0x01,                     //     REPORT_COUNT (1)
-  D_INPUT, (D_DATA|D_VARIABLE|D_RELATIVE),
+  Usage<0x38>,                                    //     USAGE (Wheel)
+  LogicalMinimum<-127>,                           //     LOGICAL_MINIMUM (-127)
+  LogicalMaximum<127>,                            //     LOGICAL_MAXIMUM (127)
+  ReportSize<8>,                                  //     REPORT_SIZE (8)
+  ReportCount<1>,                                 //     REPORT_COUNT (1)
+  Input<D_DATA|D_VARIABLE|D_RELATIVE>,
+
+  EndCollection                                   // END_COLLECTION
+> AbsoluteMouseDescriptor;
 
-  D_END_COLLECTION                                // END_COLLECTION
-};
+static_assert(AbsoluteMouseDescriptor::input_bytes == sizeof(Report),
+              "Absolute mouse descriptor doesn't match the report size");
 
 void Report::pressButtons(byte buttons) {
   buttons_ = buttons;
@@ -154,90 +439,68 @@ void Report::moveCursorTo(uint16_t x, uint16_t y) {
   y_ = y;
 }
 
-Dispatcher::Dispatcher() : PluggableUSBModule(1, 1, epType) {}
-
-// PluggableUSBModule method
-int Dispatcher::getInterface(byte* interface_count) {
-  *interface_count += 1; // uses 1
-  HIDDescriptor hid_interface = {
-    D_INTERFACE(pluggedInterface, 1,
-                USB_DEVICE_CLASS_HUMAN_INTERFACE,
-                HID_SUBCLASS_BOOT_INTERFACE,
-                HID_PROTOCOL_KEYBOARD),
-    D_HIDREPORT(sizeof(absolute_mouse_descriptor)),
-    D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint),
-               USB_ENDPOINT_TYPE_INTERRUPT, USB_EP_SIZE, 0x01)
-  };
-  return USB_SendControl(0, &hid_interface, sizeof(hid_interface));
-}
-
-// PluggableUSBModule method
-int Dispatcher::getDescriptor(USBSetup& setup) {
-  // Check if this is a HID Class Descriptor request
-  if (setup.bmRequestType != REQUEST_DEVICETOHOST_STANDARD_INTERFACE) {
-    return 0;
-  }
-  if (setup.wValueH != HID_REPORT_DESCRIPTOR_TYPE) {
-    return 0;
-  }
-
-  // In a HID Class Descriptor wIndex cointains the interface number
-  if (setup.wIndex != pluggedInterface) {
-    return 0;
-  }
+Dispatcher::Dispatcher()
+    : DedicatedInterface(AbsoluteMouseDescriptor::data(),
+                         AbsoluteMouseDescriptor::length,
+                         poll_interval) {}
 
-  return USB_SendControl(TRANSFER_PGM,
-                         absolute_mouse_descriptor,
-                         sizeof(absolute_mouse_descriptor));
+void Dispatcher::init() {
+  plug();
 }
 
-// PluggableUSBModule method
-bool Dispatcher::setup(USBSetup& setup) {
-  if (pluggedInterface != setup.wIndex) {
-    return false;
-  }
-
-  byte request = setup.bRequest;
-  byte request_type = setup.bmRequestType;
+SendStatus Dispatcher::sendReport(Report const &report) {
+  if (has_pending_report_ && isPollDue_())
+    sendPendingReport_();
+  SendStatus status = trySendReport(report);
+  if (status != SendStatus::queued || !isPollDue_())
+    return status;
+  return sendPendingReport_();
+}
 
-  if (request_type == REQUEST_DEVICETOHOST_CLASS_INTERFACE) {
-    if (request == HID_GET_REPORT) {
-      // TODO: HID_GetReport();
-      return true;
-    }
-    if (request == HID_GET_PROTOCOL) {
-      // TODO Send8(protocol)
-      return true;
-    }
+SendStatus Dispatcher::trySendReport(Report const &report) {
+  if (!has_pending_report_) {
+    if (report.isAt(last_report_) && report.wheel_ == 0)
+      return SendStatus::sent;
+    pending_report_ = report;
+    has_pending_report_ = true;
+    return SendStatus::queued;
   }
-
-  if (request_type == REQUEST_HOSTTODEVICE_CLASS_INTERFACE) {
-    if (request == HID_SET_PROTOCOL) {
-      return true;
-    }
-    if (request == HID_SET_IDLE) {
-      // We currently ignore SET_IDLE, because we don't really do anything with it, and implementing
-      // it causes issues on OSX, such as key chatter. Other operating systems do not suffer if we
-      // force this to zero, either.
-#if 0
-      idle = setup.wValueL;
-#else
-      idle = 0;
-#endif
-      return true;
-    }
-    if (request == HID_SET_REPORT) {}
+  if (report.buttons_ != pending_report_.buttons_)
+    return SendStatus::host_busy;
+  int16_t wheel = pending_report_.wheel_ + report.wheel_;
+  if (wheel < -127 || wheel > 127)
+    return SendStatus::host_busy;
+  pending_report_.x_ = report.x_;
+  pending_report_.y_ = report.y_;
+  pending_report_.wheel_ = wheel;
+  // The pointer might have come back to where it was.
+  if (pending_report_.isAt(last_report_) && wheel == 0) {
+    has_pending_report_ = false;
+    return SendStatus::sent;
   }
-
-  return false;
+  return SendStatus::queued;
 }
 
-void Dispatcher::init() {
-  PluggableUSB().plug(this);
+bool Dispatcher::poll() {
+  if (!has_pending_report_)
+    return false;
+  if (!isPollDue_())
+    return false;
+  sendPendingReport_();
+  return true;
 }
 
-void Dispatcher::sendReport(Report const &report) {
-  USB_Send(pluggedEndpoint | TRANSFER_RELEASE, &report, sizeof(report));
+SendStatus Dispatcher::sendPendingReport_() {
+  Report report = pending_report_;
+  last_send_frame_ = UDFNUML;
+  SendStatus status = sendStatus(sendReport_(HID_REPORTID_NONE,
+                                             &report, sizeof(report)));
+  has_pending_report_ = (status == SendStatus::host_busy);
+  if (has_pending_report_)
+    return SendStatus::queued;
+  if (status == SendStatus::sent)
+    last_report_ = report;
+  return status;
 }
 
 } // namespace absolute
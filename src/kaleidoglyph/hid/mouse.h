@@ -36,6 +36,8 @@ THE SOFTWARE.
 
 #include <kaleidoglyph/Key.h>
 #include <kaleidoglyph/utils.h>
+#include "kaleidoglyph/hid/interface.h"
+#include "kaleidoglyph/hid/stats.h"
 
 namespace kaleidoglyph {
 namespace hid {
@@ -52,69 +54,218 @@ enum class Button : byte {
 class Report {
   friend class Dispatcher;
 
+ public:
+  // The type of the X and Y movement, which depends on `HID_MOUSE_16BIT_AXES`, and the
+  // largest movement on either axis that fits in one report.
+  typedef descriptor::Select<HID_MOUSE_16BIT_AXES, int16_t, int8_t>::type CursorDelta;
+  static constexpr CursorDelta max_cursor_delta = HID_MOUSE_16BIT_AXES ? 32767 : 127;
+
  private:
   byte buttons_{0};
-  int8_t x_delta_{0};
-  int8_t y_delta_{0};
+  CursorDelta x_delta_{0};
+  CursorDelta y_delta_{0};
   int8_t v_delta_{0};
   int8_t h_delta_{0};
 
  public:
   void pressButtons(byte buttons);
-  void moveCursor(int8_t x_delta, int8_t y_delta);
+  void moveCursor(CursorDelta x_delta, CursorDelta y_delta);
   void scrollVertical(int8_t v_delta);
   void scrollHorizontal(int8_t h_delta);
 
   void scroll(int8_t v_delta) { scrollVertical(v_delta); }
 } __attribute__((packed));
 
-class Dispatcher {
+constexpr byte report_id = reportId(HID_MOUSE_DEDICATED_ENDPOINT, HID_REPORTID_MOUSE);
+
+constexpr bool high_resolution_wheels =
+  HID_MOUSE_DEDICATED_ENDPOINT && (HID_MOUSE_WHEEL_MULTIPLIER > 1);
+
+static_assert(HID_MOUSE_WHEEL_MULTIPLIER >= 1 && HID_MOUSE_WHEEL_MULTIPLIER <= 127,
+              "Invalid mouse wheel resolution multiplier");
+
+class Dispatcher : Interface<HID_MOUSE_DEDICATED_ENDPOINT> {
  public:
+  static constexpr byte poll_interval = HID_MOUSE_POLL_INTERVAL;
+  static_assert(isValidPollInterval(HID_MOUSE_POLL_INTERVAL),
+                "Invalid mouse polling interval");
+
+  static constexpr byte subpixel_bits = HID_MOUSE_SUBPIXEL_BITS;
+  static_assert(HID_MOUSE_SUBPIXEL_BITS >= 0 && HID_MOUSE_SUBPIXEL_BITS <= 8,
+                "Invalid number of mouse subpixel bits");
+
   Dispatcher();
   void init();
-  void sendReport(Report const & report);
+
+  // The motion accumulator: add movement, in units of 1/2^`subpixel_bits`, to be sent by
+  // `poll()`, which sends at most one report per polling interval. Each report takes
+  // the whole units accumulated so far (up to `Report::max_cursor_delta` for X and Y,
+  // and 127 for the wheels, leaving the rest for the next report), and fractions are
+  // carried forward, so no movement is lost. The sums saturate rather than wrap
+  // around. A report is only sent if it moves something, or the buttons set by
+  // `setButtons()` have changed.
+  void accumulate(int16_t x, int16_t y, int16_t v = 0, int16_t h = 0);
+  void setButtons(byte buttons) {
+    buttons_ = buttons;
+  }
+
+  // The number of wheel units per detent the host expects, which is only more than one
+  // if it has enabled the Resolution Multiplier feature. `accumulate()` takes wheel
+  // movement in detents, and scales it; wheel values in reports given to `sendReport()`
+  // or `trySendReport()` are sent as they are.
+  byte verticalWheelMultiplier() const {
+    return (wheel_multipliers_ & 0x03) ? HID_MOUSE_WHEEL_MULTIPLIER : 1;
+  }
+  byte horizontalWheelMultiplier() const {
+    return (wheel_multipliers_ & 0x0C) ? HID_MOUSE_WHEEL_MULTIPLIER : 1;
+  }
+
+  // The movement in a report the host didn't accept hasn't happened yet, so it's kept,
+  // and sent again by `poll()`; until it gets through, new reports are refused with
+  // `host_busy`.
+  SendStatus sendReport(Report const & report);
+  // Queue a report to be sent by `poll()`. Movement is added to a report that's already
+  // waiting, as long as the buttons are the same and the sums fit; otherwise this
+  // returns `host_busy`.
+  SendStatus trySendReport(Report const & report);
+  // Send the waiting report, or else the accumulated movement, if there is any, and
+  // `poll_interval` frames have passed since the last report. Returns `true` if it tried
+  // to send a report.
+  bool poll();
+  bool hasPendingReports() const;
+
+  // Counters and latency histogram (only collected if `HID_STATS` is enabled). Reports
+  // that `poll()` skips because they wouldn't move anything aren't counted.
+  stats::Stats<1>& stats() {
+    return stats_;
+  }
 
  private:
   // If the buttons haven't changed state, and the movement and scroll
   // parameters are zeros, don't send a report.
   byte prev_buttons_{0};
+
+  Report pending_report_;
+  bool has_pending_report_{false};
+  byte last_send_frame_{0};
+  stats::Stats<1> stats_;
+
+  // Accumulated movement, in fixed point with `subpixel_bits` fractional bits.
+  byte buttons_{0};
+  int16_t x_accumulator_{0};
+  int16_t y_accumulator_{0};
+  int16_t v_accumulator_{0};
+  int16_t h_accumulator_{0};
+
+  SendStatus sendReportUnchecked_(const Report& report);
+  SendStatus sendPendingReport_();
+  bool sendAccumulatedReport_();
+  bool addToPendingReport_(const Report& report);
+  bool isRedundant_(const Report& report) const;
+
+  // The Resolution Multiplier feature report (two bits for the vertical wheel, then two
+  // for the horizontal one), as set by the host, and the value the wheel accumulators
+  // are scaled for.
+  volatile byte wheel_multipliers_{0};
+  byte accumulated_wheel_multipliers_{0};
+  void updateWheelMultipliers_();
+
+#if HID_MOUSE_DEDICATED_ENDPOINT
+ protected:
+  // PluggableUSBModule
+  bool setup(USBSetup& setup) override;
+#endif
 };
 
 
 namespace absolute {
 
+// The logical range of the absolute mouse's X and Y coordinates is 0 to `max_position`.
+constexpr uint16_t max_position = 32767;
+
+// Maps pixel coordinates on a `_width` by `_height` screen to the logical range, with
+// the last pixel on each axis mapped to `max_position`. The scale factors are 16.16
+// fixed point constants, so a mapping is one 32-bit multiplication and a shift.
+template <uint16_t _width, uint16_t _height>
+struct Screen {
+  static_assert(_width > 1 && _height > 1, "Invalid absolute mouse screen size");
+
+  static constexpr uint32_t x_scale = (uint32_t(max_position) << 16) / (_width - 1);
+  static constexpr uint32_t y_scale = (uint32_t(max_position) << 16) / (_height - 1);
+
+  static constexpr uint16_t x(uint16_t pixel) {
+    return (pixel >= _width - 1) ? max_position :
+      ((uint32_t(pixel) * x_scale) + 0x8000) >> 16;
+  }
+  static constexpr uint16_t y(uint16_t pixel) {
+    return (pixel >= _height - 1) ? max_position :
+      ((uint32_t(pixel) * y_scale) + 0x8000) >> 16;
+  }
+};
+
+typedef Screen<HID_ABSOLUTEMOUSE_SCREEN_WIDTH, HID_ABSOLUTEMOUSE_SCREEN_HEIGHT> DefaultScreen;
+
 class Report {
   friend class Dispatcher;
 
  public:
   void pressButtons(byte buttons);
   void moveCursorTo(uint16_t x, uint16_t y);
+  // Move to pixel coordinates on the screen configured by
+  // `HID_ABSOLUTEMOUSE_SCREEN_WIDTH` and `HID_ABSOLUTEMOUSE_SCREEN_HEIGHT`.
+  void moveCursorToPixel(uint16_t x, uint16_t y) {
+    moveCursorTo(DefaultScreen::x(x), DefaultScreen::y(y));
+  }
+
+  // Only the buttons and the position are compared; the wheel is relative.
+  bool isAt(const Report& other) const {
+    return (buttons_ == other.buttons_ && x_ == other.x_ && y_ == other.y_);
+  }
 
  private:
   byte buttons_{0};
-  uint16_t x_;
-  uint16_t y_;
+  uint16_t x_{0};
+  uint16_t y_{0};
   int8_t wheel_{0};
 } __attribute__((packed));
 
 
-class Dispatcher : PluggableUSBModule {
+class Dispatcher : DedicatedInterface {
  public:
+  static constexpr byte poll_interval = HID_ABSOLUTEMOUSE_POLL_INTERVAL;
+  static_assert(isValidPollInterval(HID_ABSOLUTEMOUSE_POLL_INTERVAL),
+                "Invalid absolute mouse polling interval");
+
   Dispatcher();
   void init();
-  void sendReport(Report const &report);
+  // At most one report is sent per polling interval. A report that arrives before the
+  // interval is up (or that the host doesn't accept) waits, and is sent by `poll()`;
+  // until then, a newer report with the same buttons replaces its position and adds to
+  // its wheel movement, so only the latest position is sent. A report with different
+  // buttons can't replace it without losing a click, so it's refused with `host_busy`.
+  // A report that doesn't move, scroll or click anything isn't sent at all.
+  // `sendReport()` sends right away if it can, and `trySendReport()` always leaves it
+  // to `poll()`. So a second `sendReport()` in the same polling interval doesn't send
+  // anything: it returns `queued`, and the report (coalesced with any later ones) only
+  // reaches the host once `poll()` is called after the interval is up.
+  SendStatus sendReport(Report const &report);
+  SendStatus trySendReport(Report const &report);
+  bool poll();
+  bool hasPendingReports() const {
+    return has_pending_report_;
+  }
 
  private:
-  // variables
-
- protected:
-  // PluggableUSBModule
-  int getInterface(byte* interface_count);
-  int getDescriptor(USBSetup& setup);
-  bool setup(USBSetup& setup);
+  // The last report the host accepted.
+  Report last_report_;
+  Report pending_report_;
+  bool has_pending_report_{false};
+  byte last_send_frame_{0};
 
-  byte epType[1] = {EP_TYPE_INTERRUPT_IN};
-  byte idle{1};
+  bool isPollDue_() const {
+    return byte(UDFNUML - last_send_frame_) >= poll_interval;
+  }
+  SendStatus sendPendingReport_();
 };
 
 }
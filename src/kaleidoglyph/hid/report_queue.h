@@ -0,0 +1,90 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace hid {
+
+// A fixed-size ring buffer of pending HID reports. The dispatcher pushes reports onto
+// the back of the queue when it computes them, and pops them off the front as the host
+// collects them from the endpoint, so the caller never has to wait on the USB bus. No
+// bounds checking is done in `push()` or `front()`; callers must check `available()` or
+// `isEmpty()` first. Popping an empty queue does nothing.
+template <typename _Report, byte _capacity>
+class ReportQueue {
+
+  static_assert(_capacity > 0, "ReportQueue capacity must be at least one");
+
+ public:
+  static constexpr byte capacity = _capacity;
+
+  void clear() {
+    head_ = 0;
+    length_ = 0;
+  }
+
+  bool isEmpty() const {
+    return length_ == 0;
+  }
+  byte length() const {
+    return length_;
+  }
+  byte available() const {
+    return _capacity - length_;
+  }
+
+  const _Report& front() const {
+    return reports_[head_];
+  }
+
+  void push(const _Report& report) {
+    byte tail = head_ + length_;
+    if (tail >= _capacity)
+      tail -= _capacity;
+    reports_[tail] = report;
+    ++length_;
+  }
+
+  void pop() {
+    if (length_ == 0)
+      return;
+    if (++head_ == _capacity)
+      head_ = 0;
+    --length_;
+  }
+
+ private:
+  _Report reports_[_capacity];
+  byte head_{0};
+  byte length_{0};
+
+};
+
+} // namespace hid {
+} // namespace kaleidoglyph {
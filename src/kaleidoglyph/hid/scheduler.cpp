@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/scheduler.h"
+
+namespace kaleidoglyph {
+namespace hid {
+
+void Scheduler::poll() {
+  byte frame = UDFNUML;
+  if (frame == last_frame_)
+    return;
+  last_frame_ = frame;
+  shared_endpoint_used_ = false;
+
+  if (keyboard_ != nullptr)
+    poll_(keyboard_, keyboard_->usesSharedEndpoint());
+  poll_(consumer_, !HID_CONSUMERCONTROL_DEDICATED_ENDPOINT);
+  poll_(system_, !HID_SYSTEMCONTROL_DEDICATED_ENDPOINT);
+  poll_(mouse_, !HID_MOUSE_DEDICATED_ENDPOINT);
+  poll_(absolute_mouse_, false);
+  poll_(gamepad_, !HID_GAMEPAD_DEDICATED_ENDPOINT);
+}
+
+bool Scheduler::hasPendingReports() const {
+  return ((keyboard_ != nullptr && keyboard_->hasPendingReports()) ||
+          (consumer_ != nullptr && consumer_->hasPendingReports()) ||
+          (system_ != nullptr && system_->hasPendingReports()) ||
+          (mouse_ != nullptr && mouse_->hasPendingReports()) ||
+          (absolute_mouse_ != nullptr && absolute_mouse_->hasPendingReports()) ||
+          (gamepad_ != nullptr && gamepad_->hasPendingReports()));
+}
+
+template <typename _Dispatcher>
+void Scheduler::poll_(_Dispatcher* dispatcher, bool shared_endpoint) {
+  if (dispatcher == nullptr)
+    return;
+  if (shared_endpoint && shared_endpoint_used_)
+    return;
+  if (dispatcher->poll() && shared_endpoint)
+    shared_endpoint_used_ = true;
+}
+
+} // namespace hid {
+} // namespace kaleidoglyph {
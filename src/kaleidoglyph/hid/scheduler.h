@@ -0,0 +1,87 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "HID-Settings.h"
+#include "kaleidoglyph/hid/keyboard.h"
+#include "kaleidoglyph/hid/consumer.h"
+#include "kaleidoglyph/hid/system.h"
+#include "kaleidoglyph/hid/mouse.h"
+#include "kaleidoglyph/hid/gamepad.h"
+
+namespace kaleidoglyph {
+namespace hid {
+
+// The Scheduler sends the reports that the dispatchers have queued (with their
+// `trySendReport()` methods), at most once per USB frame, in priority order:
+// keyboard first, then consumer and system control, then pointer motion (which the
+// mouse dispatcher coalesces while it waits), then the gamepad. Dispatchers on the
+// shared `HID()` interface all use the same endpoint, which can only hold one report
+// per frame, so only the highest-priority one of them gets to send in any given
+// frame; otherwise, a burst of mouse movement could delay a keyboard report until the
+// host had collected it. Dispatchers with dedicated endpoints don't compete with each
+// other.
+//
+// Any of the dispatchers can be left out by passing `nullptr`. The immediate
+// `sendReport()` methods still work, but they bypass the scheduler.
+class Scheduler {
+
+ public:
+  Scheduler(keyboard::Dispatcher* keyboard,
+            consumer::Dispatcher* consumer = nullptr,
+            system::Dispatcher* system = nullptr,
+            mouse::Dispatcher* mouse = nullptr,
+            mouse::absolute::Dispatcher* absolute_mouse = nullptr,
+            gamepad::Dispatcher* gamepad = nullptr)
+      : keyboard_(keyboard), consumer_(consumer), system_(system),
+        mouse_(mouse), absolute_mouse_(absolute_mouse), gamepad_(gamepad) {}
+
+  // Call once per scan cycle.
+  void poll();
+
+  bool hasPendingReports() const;
+
+ private:
+  keyboard::Dispatcher* keyboard_;
+  consumer::Dispatcher* consumer_;
+  system::Dispatcher* system_;
+  mouse::Dispatcher* mouse_;
+  mouse::absolute::Dispatcher* absolute_mouse_;
+  gamepad::Dispatcher* gamepad_;
+
+  byte last_frame_{0};
+  bool shared_endpoint_used_{false};
+
+  template <typename _Dispatcher>
+  void poll_(_Dispatcher* dispatcher, bool shared_endpoint);
+
+};
+
+} // namespace hid {
+} // namespace kaleidoglyph {
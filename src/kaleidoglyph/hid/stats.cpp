@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "kaleidoglyph/hid/stats.h"
+
+#if HID_STATS
+
+#include <PluggableUSB.h>
+
+namespace kaleidoglyph {
+namespace hid {
+namespace stats {
+
+namespace {
+
+// The counters of each dispatcher, once it has published them.
+const Report* sources[source_count] = {};
+
+} // namespace {
+
+void publish(Source source, const Report& report) {
+  sources[byte(source)] = &report;
+}
+
+void unpublish(Source source) {
+  sources[byte(source)] = nullptr;
+}
+
+int sendFeatureReport() {
+  static const Report unused = {};
+  int total{0};
+  for (const Report* report : sources) {
+    int result = USB_SendControl(0, (report != nullptr) ? report : &unused, sizeof(Report));
+    if (result < 0)
+      return result;
+    total += result;
+  }
+  return total;
+}
+
+} // namespace stats {
+} // namespace hid {
+} // namespace kaleidoglyph {
+
+#endif
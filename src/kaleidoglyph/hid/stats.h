@@ -0,0 +1,194 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "HID-Settings.h"
+#include "kaleidoglyph/hid/descriptor.h"
+#include "kaleidoglyph/hid/report_queue.h"
+
+namespace kaleidoglyph {
+namespace hid {
+namespace stats {
+
+// Optional instrumentation for a dispatcher, enabled by `HID_STATS`. It counts reports
+// as they are queued and sent, and records the time each report spent between being
+// queued and the send call returning in a histogram with power-of-two buckets: the first
+// one holds anything under `HID_STATS_LATENCY_BASE_US` microseconds, each of the next
+// ones covers twice the range of the previous one, and the last one holds everything
+// longer. With `HID_STATS` off, the class is empty, and all of its methods do nothing.
+//
+// The keyboard, consumer control, system control and (relative) mouse dispatchers each
+// keep their own counters. The host reads all of them at once, as a vendor-defined
+// feature report on the keyboard's interface: one `Report` per `Source`, in order, with
+// zeros for any dispatcher that hasn't been initialized. Only the keyboard splits
+// updates; the others never count any split sends.
+
+static constexpr byte latency_bucket_count = 8;
+
+// The counters of one dispatcher. All of them saturate rather than wrapping around.
+struct Report {
+  uint16_t reports_sent;
+  uint16_t duplicates_suppressed;
+  uint16_t split_sends;
+  uint16_t send_failures;
+  uint16_t latency[latency_bucket_count];
+};
+
+// The dispatchers in the feature report, in order.
+enum class Source : byte {
+  keyboard,
+  consumer,
+  system,
+  mouse,
+};
+static constexpr byte source_count = 4;
+
+using namespace descriptor;
+
+typedef Descriptor<
+  UsagePage<0xFF00>,                    // USAGE_PAGE (Vendor Defined)
+  Usage<0x01>,                          // USAGE (Vendor Usage 1)
+  Collection<D_APPLICATION>,            // COLLECTION (Application)
+  Usage<0x02>,                          //   USAGE (Vendor Usage 2)
+  LogicalMinimum<0>,                    //   LOGICAL_MINIMUM (0)
+  LogicalMaximum<0xFFFF>,               //   LOGICAL_MAXIMUM (65535)
+  ReportSize<16>,                       //   REPORT_SIZE (16)
+  ReportCount<source_count * sizeof(Report) / 2>, // REPORT_COUNT (48)
+  Feature<D_DATA|D_VARIABLE|D_ABSOLUTE>, //  FEATURE (Data,Var,Abs)
+  EndCollection                         // END_COLLECTION
+> StatsDescriptor;
+
+static_assert(StatsDescriptor::feature_bytes == source_count * sizeof(Report),
+              "Stats descriptor doesn't match the report size");
+
+#if HID_STATS
+
+// Make `report` the counters the feature report has for `source`.
+void publish(Source source, const Report& report);
+// Leave `source` out of the feature report again; its counters read as zeros.
+void unpublish(Source source);
+// Answer the host's GET_REPORT request for the feature report.
+int sendFeatureReport();
+
+template <byte _queue_length>
+class Stats {
+
+ public:
+  // Include these counters in the feature report.
+  void publish(Source source) const {
+    stats::publish(source, report_);
+  }
+
+  // Call once for each report added to the dispatcher's queue, and once for each report
+  // removed from it, in the same order. A dispatcher that keeps a single waiting report
+  // (which a newer one can replace) uses a queue length of one: while a report is
+  // waiting, its time is kept.
+  void reportQueued() {
+    if (queued_at_.available() != 0)
+      queued_at_.push(micros());
+  }
+  // A failed report stays in the queue, to be sent again later.
+  void reportSent(int result) {
+    if (result < 0) {
+      increment_(report_.send_failures);
+      return;
+    }
+    increment_(report_.reports_sent);
+    recordLatency_();
+  }
+  // A queued report that was dropped because the host wouldn't have seen a change.
+  void reportDropped() {
+    increment_(report_.duplicates_suppressed);
+    queued_at_.pop();
+  }
+  // A report that was never queued, for the same reason.
+  void duplicateSuppressed() {
+    increment_(report_.duplicates_suppressed);
+  }
+  // Call once for each update that took more than one report to send.
+  void updateSplit() {
+    increment_(report_.split_sends);
+  }
+
+  void clear() {
+    memset(&report_, 0, sizeof(report_));
+  }
+  // The queue is cleared separately, so that can be done without resetting the counts.
+  void clearQueue() {
+    queued_at_.clear();
+  }
+
+  const Report& report() const {
+    return report_;
+  }
+
+ private:
+  Report report_ = {};
+  ReportQueue<unsigned long, _queue_length> queued_at_;
+
+  static void increment_(uint16_t& counter) {
+    if (counter != 0xFFFF)
+      ++counter;
+  }
+
+  void recordLatency_() {
+    unsigned long elapsed = (micros() - queued_at_.front()) / HID_STATS_LATENCY_BASE_US;
+    queued_at_.pop();
+    byte bucket{0};
+    while (elapsed != 0 && bucket < latency_bucket_count - 1) {
+      elapsed >>= 1;
+      ++bucket;
+    }
+    increment_(report_.latency[bucket]);
+  }
+
+};
+
+#else
+
+template <byte _queue_length>
+class Stats {
+
+ public:
+  void publish(Source /*source*/) const {}
+  void reportQueued() {}
+  void reportSent(int /*result*/) {}
+  void reportDropped() {}
+  void duplicateSuppressed() {}
+  void updateSplit() {}
+  void clear() {}
+  void clearQueue() {}
+
+};
+
+#endif
+
+} // namespace stats {
+} // namespace hid {
+} // namespace kaleidoglyph {
@@ -28,40 +28,137 @@ THE SOFTWARE.
 
 #include <kaleidoglyph/utils.h>
 #include "DescriptorPrimitives.h"
+#include "kaleidoglyph/hid/descriptor.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace system {
 
-static const PROGMEM byte hid_descriptor[] = {
+using namespace descriptor;
+
+#if HID_SYSTEMCONTROL_BITMAP
+typedef Descriptor<
+  //  System Control (one bit per usage)
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,           // USAGE_PAGE (Generic Desktop)
+  Usage<0x80>,                                 // USAGE (System Control)
+  Collection<D_APPLICATION>,                   // COLLECTION (Application)
+  ReportId<report_id>,                         // REPORT_ID
+  LogicalMinimum<0>,                           // LOGICAL_MINIMUM (0)
+  LogicalMaximum<1>,                           // LOGICAL_MAXIMUM (1)
+  UsageMinimum<HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE>, // USAGE_MINIMUM
+  UsageMaximum<HID_SYSTEMCONTROL_BITMAP_LAST_USAGE>,  // USAGE_MAXIMUM
+  ReportCount<Report::usage_count>,            // REPORT_COUNT
+  ReportSize<1>,                               // REPORT_SIZE (1)
+  Input<D_DATA|D_VARIABLE|D_ABSOLUTE>,         // INPUT (Data,Var,Abs)
+  InputPadding<(Report::size * 8) - Report::usage_count>,
+  EndCollection                                // END_COLLECTION
+> SystemControlDescriptor;
+#else
+typedef Descriptor<
   //TODO limit to system keys only?
   //  System Control (Power Down, Sleep, Wakeup, ...)
-  D_USAGE_PAGE, D_PAGE_GENERIC_DESKTOP,        // USAGE_PAGE (Generic Desktop)
-  D_USAGE, 0x80,                               // USAGE (System Control)
-  D_COLLECTION, D_APPLICATION,                 // COLLECTION (Application)
-  D_REPORT_ID, HID_REPORTID_SYSTEMCONTROL,     // REPORT_ID
+  UsagePage<D_PAGE_GENERIC_DESKTOP>,           // USAGE_PAGE (Generic Desktop)
+  Usage<0x80>,                                 // USAGE (System Control)
+  Collection<D_APPLICATION>,                   // COLLECTION (Application)
+  ReportId<report_id>,                         // REPORT_ID
   // 1 system key
-  D_LOGICAL_MINIMUM, 0x00,                     // LOGICAL_MINIMUM (0)
-  D_MULTIBYTE(D_LOGICAL_MAXIMUM), 0xff, 0x00,  // LOGICAL_MAXIMUM (255)
-  D_USAGE_MINIMUM, 0x00,                       // USAGE_MINIMUM (Undefined)
-  D_USAGE_MAXIMUM, 0xff,                       // USAGE_MAXIMUM (System Menu Down)
-  D_REPORT_COUNT, 0x01,                        // REPORT_COUNT (1)
-  D_REPORT_SIZE, 0x08,                         // REPORT_SIZE (8)
-  D_INPUT, (D_DATA|D_ARRAY|D_ABSOLUTE),        // INPUT (Data,Ary,Abs)
-  D_END_COLLECTION                             // END_COLLECTION
-};
-
-Dispatcher::Dispatcher() {
-  static HIDSubDescriptor node(hid_descriptor, sizeof(hid_descriptor));
-  HID().AppendDescriptor(&node);
+  LogicalMinimum<0>,                           // LOGICAL_MINIMUM (0)
+  LogicalMaximum<255>,                         // LOGICAL_MAXIMUM (255)
+  UsageMinimum<0x00>,                          // USAGE_MINIMUM (Undefined)
+  UsageMaximum<0xff>,                          // USAGE_MAXIMUM (System Menu Down)
+  ReportCount<1>,                              // REPORT_COUNT (1)
+  ReportSize<8>,                               // REPORT_SIZE (8)
+  Input<D_DATA|D_ARRAY|D_ABSOLUTE>,            // INPUT (Data,Ary,Abs)
+  EndCollection                                // END_COLLECTION
+> SystemControlDescriptor;
+#endif
+
+static_assert(SystemControlDescriptor::input_bytes == sizeof(Report),
+              "System control descriptor doesn't match the report size");
+
+Dispatcher::Dispatcher()
+    : Interface<HID_SYSTEMCONTROL_DEDICATED_ENDPOINT>(
+        SystemControlDescriptor::data(), SystemControlDescriptor::length,
+        poll_interval) {}
+
+void Report::addKeycode(byte keycode) {
+#if HID_SYSTEMCONTROL_BITMAP
+  byte i = keycode - first_usage;
+  if (i < usage_count)
+    data_[i / 8] |= (1 << (i % 8));
+#else
+  data_[0] = keycode;
+#endif
+}
+
+void Report::releaseKeycode(byte keycode) {
+#if HID_SYSTEMCONTROL_BITMAP
+  byte i = keycode - first_usage;
+  if (i < usage_count)
+    data_[i / 8] &= ~(1 << (i % 8));
+#else
+  if (data_[0] == keycode)
+    data_[0] = 0;
+#endif
 }
 
 void Dispatcher::init() {
-  sendReport(0);
+  plug();
+  stats_.publish(stats::Source::system);
+  last_report_.clear();
+  sendReportUnchecked_(last_report_);
+}
+
+SendStatus Dispatcher::sendReportUnchecked_(const Report& report) {
+  stats_.reportQueued();
+  int result = sendReport_(report_id, report.data_, sizeof(report.data_));
+  stats_.reportSent(result);
+  SendStatus status = sendStatus(result);
+  has_pending_report_ = (status == SendStatus::host_busy);
+  if (has_pending_report_) {
+    pending_report_.updateFrom(report);
+    return SendStatus::queued;
+  }
+  if (status == SendStatus::sent) {
+    last_report_.updateFrom(report);
+  } else {
+    stats_.clearQueue();
+  }
+  return status;
+}
+
+SendStatus Dispatcher::sendReport(const Report& report) {
+  if (report == last_report_) {
+    has_pending_report_ = false;
+    stats_.duplicateSuppressed();
+    stats_.clearQueue();
+    return SendStatus::sent;
+  }
+  return sendReportUnchecked_(report);
+}
+
+SendStatus Dispatcher::trySendReport(const Report& report) {
+  if (report == last_report_) {
+    has_pending_report_ = false;
+    stats_.duplicateSuppressed();
+    stats_.clearQueue();
+    return SendStatus::sent;
+  }
+  pending_report_.updateFrom(report);
+  has_pending_report_ = true;
+  stats_.reportQueued();
+  return SendStatus::queued;
 }
 
-void Dispatcher::sendReport(byte keycode) {
-  HID().SendReport(HID_REPORTID_SYSTEMCONTROL, &keycode, sizeof(keycode));
+bool Dispatcher::poll() {
+  if (!has_pending_report_)
+    return false;
+  if (byte(UDFNUML - last_send_frame_) < poll_interval)
+    return false;
+  Report report = pending_report_;
+  last_send_frame_ = UDFNUML;
+  sendReportUnchecked_(report);
+  return true;
 }
 
 } //
@@ -35,17 +35,87 @@ THE SOFTWARE.
 
 #include <kaleidoglyph/Key.h>
 #include <kaleidoglyph/utils.h>
+#include "kaleidoglyph/hid/interface.h"
+#include "kaleidoglyph/hid/stats.h"
 
 namespace kaleidoglyph {
 namespace hid {
 namespace system {
 
-class Dispatcher {
+constexpr byte report_id = reportId(HID_SYSTEMCONTROL_DEDICATED_ENDPOINT,
+                                    HID_REPORTID_SYSTEMCONTROL);
+
+class Report {
+
+  friend class Dispatcher;
+
+ public:
+#if HID_SYSTEMCONTROL_BITMAP
+  static_assert(HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE <= HID_SYSTEMCONTROL_BITMAP_LAST_USAGE,
+                "The system control bitmap range must not be empty");
+  static_assert(HID_SYSTEMCONTROL_BITMAP_LAST_USAGE <= 0xFF,
+                "System control usages must fit in one byte");
+
+  static constexpr byte first_usage = HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE;
+  static constexpr byte usage_count =
+    HID_SYSTEMCONTROL_BITMAP_LAST_USAGE - HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE + 1;
+  static constexpr byte size = (usage_count + 7) / 8;
+#else
+  static constexpr byte size = 1;
+#endif
+
+  void clear() {
+    memset(data_, 0, sizeof(data_));
+  }
+  // Without the bitmap, the report holds one usage: a press replaces it, and a release
+  // only clears it if it's the same usage.
+  void addKeycode(byte keycode);
+  void releaseKeycode(byte keycode);
+  bool operator==(const Report& other) const {
+    return (memcmp(data_, other.data_, sizeof(data_)) == 0);
+  }
+  void updateFrom(const Report& new_report) {
+    memcpy(data_, new_report.data_, sizeof(data_));
+  }
+
+ private:
+  byte data_[size] = {};
+
+};
+
+class Dispatcher : Interface<HID_SYSTEMCONTROL_DEDICATED_ENDPOINT> {
 
  public:
+  static constexpr byte poll_interval = HID_SYSTEMCONTROL_POLL_INTERVAL;
+  static_assert(isValidPollInterval(HID_SYSTEMCONTROL_POLL_INTERVAL),
+                "Invalid system control polling interval");
+
   Dispatcher();
   void init();
-  void sendReport(byte keycode);
+  // A report that's the same as the last one the host accepted isn't sent again, so
+  // this can be called every scan cycle. A report the host didn't accept is sent again
+  // by `poll()`, unless a newer one replaces it first. `trySendReport()` just replaces
+  // the waiting report.
+  SendStatus sendReport(const Report& report);
+  SendStatus trySendReport(const Report& report);
+  bool poll();
+  bool hasPendingReports() const {
+    return has_pending_report_;
+  }
+
+  // Counters and latency histogram (only collected if `HID_STATS` is enabled).
+  stats::Stats<1>& stats() {
+    return stats_;
+  }
+
+ private:
+  Report last_report_;
+  Report pending_report_;
+  bool has_pending_report_{false};
+  byte last_send_frame_{0};
+  stats::Stats<1> stats_;
+
+  SendStatus sendReportUnchecked_(const Report& report);
 
 };
 
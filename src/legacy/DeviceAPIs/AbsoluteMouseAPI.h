@@ -75,6 +75,10 @@ typedef union {
     };
 } HID_MouseAbsoluteReport_Data_t;
 
+// The device class derives from `AbsoluteMouseAPI<DeviceClass>`, and provides a
+// `sendReport_(void* data, int length)` method (which can be protected, if it makes the
+// API a friend). Sends are resolved at compile time, so there's no vtable.
+template <class _Derived>
 class AbsoluteMouseAPI {
   public:
     inline AbsoluteMouseAPI(void);
@@ -89,7 +93,9 @@ class AbsoluteMouseAPI {
     inline bool isPressed(uint8_t b = MOUSE_LEFT);
 
     // Sending is public in the base class for advanced users.
-    virtual void sendReport(void* data, int length);
+    inline void sendReport(void* data, int length) {
+      static_cast<_Derived*>(this)->sendReport_(data, length);
+    }
 
   protected:
     uint16_t xAxis;
@@ -25,17 +25,20 @@ THE SOFTWARE.
 
 #pragma once
 
-AbsoluteMouseAPI::AbsoluteMouseAPI(void): xAxis(0), yAxis(0), _buttons(0) { // Empty
+template <class _Derived>
+AbsoluteMouseAPI<_Derived>::AbsoluteMouseAPI(void): xAxis(0), yAxis(0), _buttons(0) { // Empty
 }
 
-void AbsoluteMouseAPI::buttons(uint8_t b) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::buttons(uint8_t b) {
   if (b != _buttons) {
     _buttons = b;
     moveTo(xAxis, yAxis, 0);
   }
 }
 
-int16_t AbsoluteMouseAPI::qadd16(int16_t base, int16_t increment) {
+template <class _Derived>
+int16_t AbsoluteMouseAPI<_Derived>::qadd16(int16_t base, int16_t increment) {
   // Separate between subtracting and adding
   if (increment < 0) {
     // Subtracting more would cause an undefined overflow
@@ -53,24 +56,28 @@ int16_t AbsoluteMouseAPI::qadd16(int16_t base, int16_t increment) {
   return base;
 }
 
-void AbsoluteMouseAPI::begin(void) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::begin(void) {
   // release all buttons
   end();
 }
 
-void AbsoluteMouseAPI::end(void) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::end(void) {
   _buttons = 0;
   moveTo(xAxis, yAxis, 0);
 }
 
-void AbsoluteMouseAPI::click(uint8_t b) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::click(uint8_t b) {
   _buttons = b;
   moveTo(xAxis, yAxis, 0);
   _buttons = 0;
   moveTo(xAxis, yAxis, 0);
 }
 
-void AbsoluteMouseAPI::moveTo(uint16_t x, uint16_t y, signed char wheel) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::moveTo(uint16_t x, uint16_t y, signed char wheel) {
   xAxis = x;
   yAxis = y;
   HID_MouseAbsoluteReport_Data_t report;
@@ -81,21 +88,25 @@ void AbsoluteMouseAPI::moveTo(uint16_t x, uint16_t y, signed char wheel) {
   sendReport(&report, sizeof(report));
 }
 
-void AbsoluteMouseAPI::move(int x, int y, signed char wheel) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::move(int x, int y, signed char wheel) {
   moveTo(qadd16(xAxis, x), qadd16(yAxis, y), wheel);
 }
 
-void AbsoluteMouseAPI::press(uint8_t b) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::press(uint8_t b) {
   // press LEFT by default
   buttons(_buttons | b);
 }
 
-void AbsoluteMouseAPI::release(uint8_t b) {
+template <class _Derived>
+void AbsoluteMouseAPI<_Derived>::release(uint8_t b) {
   // release LEFT by default
   buttons(_buttons & ~b);
 }
 
-bool AbsoluteMouseAPI::isPressed(uint8_t b) {
+template <class _Derived>
+bool AbsoluteMouseAPI<_Derived>::isPressed(uint8_t b) {
   // check LEFT by default
   if ((b & _buttons) > 0)
     return true;
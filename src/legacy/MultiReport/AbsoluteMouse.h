@@ -32,13 +32,17 @@ THE SOFTWARE.
 #include "HID-Settings.h"
 #include "../DeviceAPIs/AbsoluteMouseAPI.h"
 
-class AbsoluteMouse_ : public AbsoluteMouseAPI {
+class AbsoluteMouse_ : public AbsoluteMouseAPI<AbsoluteMouse_> {
+  friend class AbsoluteMouseAPI<AbsoluteMouse_>;
+
   public:
     AbsoluteMouse_(void);
 
   protected:
-    // Sending is public in the base class for advanced users.
-    virtual void sendReport(void* data, int length);
+    // Called by the base class's public sendReport().
+    void sendReport_(void* data, int length) {
+      HID().SendReport(HID_REPORTID_MOUSE_ABSOLUTE, data, length);
+    }
 };
 
 extern AbsoluteMouse_ AbsoluteMouse;
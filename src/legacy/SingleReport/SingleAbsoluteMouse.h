@@ -33,8 +33,11 @@ THE SOFTWARE.
 #include "../DeviceAPIs/AbsoluteMouseAPI.h"
 
 
-class SingleAbsoluteMouse_ : public PluggableUSBModule, public AbsoluteMouseAPI
+class SingleAbsoluteMouse_ : public PluggableUSBModule,
+                             public AbsoluteMouseAPI<SingleAbsoluteMouse_>
 {
+    friend class AbsoluteMouseAPI<SingleAbsoluteMouse_>;
+
 public:
     SingleAbsoluteMouse_(void);
     uint8_t getLeds(void);
@@ -50,6 +53,9 @@ protected:
     uint8_t protocol;
     uint8_t idle;
 
-    virtual inline void sendReport(void* data, int length) override;
+    // Called by the base class's public sendReport().
+    void sendReport_(void* data, int length) {
+        USB_Send(pluggedEndpoint | TRANSFER_RELEASE, data, length);
+    }
 };
 extern SingleAbsoluteMouse_ SingleAbsoluteMouse;
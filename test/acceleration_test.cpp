@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/acceleration.h"
+
+using namespace kaleidoglyph::hid;
+using namespace kaleidoglyph::hid::mouse;
+
+namespace {
+
+typedef CurveTable<QuadraticCurve<8, 160, 10>> Curve;
+
+// One whole unit per tick, whatever the number of subpixel bits.
+constexpr uint16_t unit = 1 << Dispatcher::subpixel_bits;
+typedef CurveTable<QuadraticCurve<unit, unit, 1>> ConstantCurve;
+
+std::vector<int> xSpeeds(Accelerator& accelerator, int ticks) {
+  std::vector<int> speeds;
+  for (int i{0}; i < ticks; ++i) {
+    int16_t x, y;
+    accelerator.tick(x, y);
+    speeds.push_back(x);
+  }
+  return speeds;
+}
+
+} // namespace {
+
+TEST(acceleration, quadratic_curve_table) {
+  static const uint16_t expected[] = {8, 9, 14, 21, 32, 46, 62, 82, 105, 131, 160};
+  EXPECT_EQ(Curve::length, 11);
+  for (byte i{0}; i < Curve::length; ++i)
+    EXPECT_EQ(pgm_read_word(&Curve::data[i]), expected[i]);
+}
+
+TEST(acceleration, speed_follows_the_curve_then_stays_at_the_end) {
+  Accelerator accelerator(Curve::data, Curve::length);
+  accelerator.setDirection(1, 0);
+
+  std::vector<int> speeds = xSpeeds(accelerator, 300);
+  for (byte i{0}; i < Curve::length; ++i)
+    EXPECT_EQ(speeds[i], pgm_read_word(&Curve::data[i]));
+  for (size_t i{Curve::length}; i < speeds.size(); ++i)
+    EXPECT_EQ(speeds[i], 160);
+}
+
+TEST(acceleration, directions_and_diagonals) {
+  Accelerator accelerator(Curve::data, Curve::length);
+  int16_t x, y;
+
+  accelerator.setDirection(-1, 0);
+  accelerator.tick(x, y);
+  EXPECT_EQ(x, -8);
+  EXPECT_EQ(y, 0);
+
+  // Changing direction while a key is still held keeps the speed up.
+  accelerator.setDirection(0, 1);
+  accelerator.tick(x, y);
+  EXPECT_EQ(x, 0);
+  EXPECT_EQ(y, 9);
+
+  for (int i{0}; i < 20; ++i)
+    accelerator.tick(x, y);
+  accelerator.setDirection(1, -1);
+  accelerator.tick(x, y);
+  EXPECT_EQ(x, (160 * 181) >> 8);
+  EXPECT_EQ(y, -((160 * 181) >> 8));
+}
+
+TEST(acceleration, releasing_every_key_starts_over) {
+  Accelerator accelerator(Curve::data, Curve::length);
+  accelerator.setDirection(1, 0);
+  xSpeeds(accelerator, 5);
+
+  int16_t x, y;
+  accelerator.setDirection(0, 0);
+  accelerator.tick(x, y);
+  EXPECT_EQ(x, 0);
+  EXPECT_EQ(y, 0);
+
+  accelerator.setDirection(1, 0);
+  accelerator.tick(x, y);
+  EXPECT_EQ(x, 8);
+}
+
+TEST(acceleration, an_empty_curve_never_moves) {
+  Accelerator accelerator(nullptr, 0);
+  accelerator.setDirection(1, 1);
+  int16_t x{1}, y{1};
+  accelerator.tick(x, y);
+  EXPECT_EQ(x, 0);
+  EXPECT_EQ(y, 0);
+}
+
+TEST(acceleration, movement_goes_through_the_accumulator) {
+  Dispatcher mouse;
+  mouse.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+  Accelerator accelerator(ConstantCurve::data, ConstantCurve::length);
+
+  accelerator.setDirection(1, 0);
+  for (int i{0}; i < 3; ++i)
+    accelerator.moveCursor(mouse);
+  accelerator.setDirection(0, -1);
+  accelerator.scroll(mouse);
+  EXPECT_TRUE(mouse.hasPendingReports());
+
+  while (mouse.hasPendingReports()) {
+    fake_usb::advanceFrames(1);
+    mouse.poll();
+  }
+  fake_usb::advanceFrames(1);
+
+  std::vector<fake_usb::Packet> packets = fake_usb::packets();
+  EXPECT_EQ(packets.size(), 1u);
+  const byte* report = packets[0].data.data() + (HID_MOUSE_DEDICATED_ENDPOINT ? 0 : 1);
+  EXPECT_EQ(report[1], 3);
+  EXPECT_EQ(int8_t(report[1 + 2 * sizeof(Report::CursorDelta)]),
+            -mouse.verticalWheelMultiplier());
+}
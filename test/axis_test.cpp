@@ -0,0 +1,163 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+
+#include "kaleidoglyph/hid/axis.h"
+
+using namespace kaleidoglyph::hid::gamepad;
+
+namespace {
+
+constexpr int16_t max_value = 32767;
+
+// A 10-bit ADC, at rest in the middle.
+constexpr int16_t raw_min = 0;
+constexpr int16_t raw_center = 512;
+constexpr int16_t raw_max = 1023;
+
+// The expected output for a reading `distance` raw units past the deadzone, on a side
+// that's `range` units long.
+int16_t scaled(int32_t distance, int32_t range) {
+  return (distance * max_value) / range;
+}
+
+Axis calibratedAxis(uint16_t deadzone, byte smoothing_shift, uint16_t threshold) {
+  Axis axis(deadzone, smoothing_shift, threshold);
+  axis.calibrate(raw_min, raw_center, raw_max);
+  return axis;
+}
+
+} // namespace {
+
+TEST(axis, calibrated_ends_and_center) {
+  Axis axis = calibratedAxis(0, 0, 0);
+  EXPECT_TRUE(axis.update(raw_max));
+  EXPECT_EQ(axis.value(), max_value);
+  EXPECT_TRUE(axis.update(raw_min));
+  EXPECT_EQ(axis.value(), -max_value);
+  EXPECT_TRUE(axis.update(raw_center));
+  EXPECT_EQ(axis.value(), 0);
+}
+
+TEST(axis, each_side_is_scaled_separately) {
+  Axis axis(0, 0, 0);
+  axis.calibrate(100, 400, 1000);
+  axis.update(100);
+  EXPECT_EQ(axis.value(), -max_value);
+  axis.update(250);
+  EXPECT_TRUE(axis.value() - scaled(-150, 300) <= 1);
+  EXPECT_TRUE(axis.value() - scaled(-150, 300) >= -1);
+  axis.update(700);
+  EXPECT_TRUE(axis.value() - scaled(300, 600) <= 1);
+  EXPECT_TRUE(axis.value() - scaled(300, 600) >= -1);
+  axis.update(1000);
+  EXPECT_EQ(axis.value(), max_value);
+}
+
+TEST(axis, readings_beyond_the_calibration_are_clamped) {
+  Axis axis = calibratedAxis(0, 0, 0);
+  axis.update(2000);
+  EXPECT_EQ(axis.value(), max_value);
+  axis.update(-50);
+  EXPECT_EQ(axis.value(), -max_value);
+}
+
+// Inside the deadzone, the output is 0; just outside it, the output starts from 0, with
+// the rest of each side scaled to the full range.
+TEST(axis, deadzone) {
+  constexpr uint16_t deadzone = 8;
+  Axis axis = calibratedAxis(deadzone, 0, 0);
+  for (int16_t raw = raw_center - deadzone; raw <= raw_center + deadzone; ++raw) {
+    axis.update(raw);
+    EXPECT_EQ(axis.value(), 0);
+  }
+  constexpr int32_t positive_range = raw_max - raw_center - deadzone;
+  axis.update(raw_center + deadzone + 1);
+  EXPECT_TRUE(axis.value() > 0);
+  EXPECT_TRUE(axis.value() <= scaled(1, positive_range) + 1);
+  axis.update(raw_min);
+  EXPECT_EQ(axis.value(), -max_value);
+}
+
+// The first reading is taken as it is; after that, each step moves a quarter of the way
+// to the new reading, and the average eventually gets all the way there.
+TEST(axis, smoothing) {
+  Axis axis = calibratedAxis(0, 2, 0);
+  axis.update(raw_center);
+  EXPECT_EQ(axis.value(), 0);
+
+  axis.update(raw_max);
+  int16_t first_step = axis.value();
+  EXPECT_TRUE(first_step > scaled(120, 511));
+  EXPECT_TRUE(first_step < scaled(130, 511));
+
+  int16_t previous = first_step;
+  for (int i{0}; i < 100; ++i) {
+    axis.update(raw_max);
+    EXPECT_TRUE(axis.value() >= previous);
+    previous = axis.value();
+  }
+  EXPECT_EQ(axis.value(), max_value);
+}
+
+// Small changes don't change the output, but reaching the centre or either end always
+// does.
+TEST(axis, change_threshold) {
+  Axis axis = calibratedAxis(0, 0, 6000);
+  EXPECT_FALSE(axis.update(raw_center));
+  EXPECT_FALSE(axis.update(raw_center + 40));
+  EXPECT_EQ(axis.value(), 0);
+
+  EXPECT_TRUE(axis.update(raw_max));
+  EXPECT_FALSE(axis.update(raw_max - 40));
+  EXPECT_EQ(axis.value(), max_value);
+
+  EXPECT_TRUE(axis.update(raw_center + 48));
+  int16_t value = axis.value();
+  EXPECT_TRUE(value > 0);
+  EXPECT_TRUE(value < 6000);
+  EXPECT_TRUE(axis.update(raw_center));
+  EXPECT_EQ(axis.value(), 0);
+
+  EXPECT_TRUE(axis.update(raw_max - 30));
+  EXPECT_TRUE(max_value - axis.value() < 6000);
+  EXPECT_TRUE(axis.update(raw_max));
+  EXPECT_EQ(axis.value(), max_value);
+}
+
+TEST(axis, eight_bit_output_is_symmetric) {
+  Axis axis(0, 0, 0);
+  axis.calibrate(raw_center - 511, raw_center, raw_center + 511);
+  axis.update(raw_center + 511);
+  EXPECT_EQ(axis.value8(), 127);
+  axis.update(raw_center - 511);
+  EXPECT_EQ(axis.value8(), -127);
+  for (int16_t offset{1}; offset < 16; ++offset) {
+    axis.update(raw_center + offset);
+    int8_t positive = axis.value8();
+    axis.update(raw_center - offset);
+    EXPECT_EQ(axis.value8(), -positive);
+  }
+}
@@ -0,0 +1,581 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Micro-benchmarks for the dispatchers, on the host. Each benchmark is run with twice as
+// many iterations at a time until a run takes at least `min_run_time`, and that run's
+// results are printed: the host CPU time per iteration, and the simulated USB time per
+// iteration (how long the fake host's clock advanced, which includes any time spent
+// waiting for an endpoint bank). The host numbers are only useful for comparing changes
+// to the code on the same machine; they say nothing about the speed on an AVR.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/acceleration.h"
+#include "kaleidoglyph/hid/axis.h"
+#include "kaleidoglyph/hid/bitmap.h"
+#include "kaleidoglyph/hid/keyboard.h"
+#include "kaleidoglyph/hid/consumer.h"
+#include "kaleidoglyph/hid/layout.h"
+#include "kaleidoglyph/hid/mouse.h"
+#include "kaleidoglyph/hid/scheduler.h"
+
+namespace bench {
+
+typedef void (*Function)(unsigned long iterations);
+
+struct Benchmark {
+  Benchmark(const char* name, Function function);
+
+  const char* name;
+  Function function;
+  Benchmark* next;
+};
+
+Benchmark* first_benchmark = nullptr;
+Benchmark* last_benchmark = nullptr;
+
+Benchmark::Benchmark(const char* name, Function function)
+    : name(name), function(function), next(nullptr) {
+  if (last_benchmark == nullptr) {
+    first_benchmark = this;
+  } else {
+    last_benchmark->next = this;
+  }
+  last_benchmark = this;
+}
+
+// Keep the compiler from optimizing away a value that's otherwise unused.
+template <typename _Type>
+inline void keep(const _Type& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench {
+
+#define BENCHMARK(name)                                                 \
+  static void name##_benchmark_(unsigned long iterations);              \
+  static bench::Benchmark name##_registration_(#name, name##_benchmark_); \
+  static void name##_benchmark_(unsigned long iterations)
+
+using namespace kaleidoglyph::hid;
+
+// ----------------------------------------------------------------------------
+// Report operations
+
+BENCHMARK(keyboard_report_add_remove_keycode) {
+  keyboard::Report report;
+  for (unsigned long i{0}; i < iterations; ++i) {
+    byte keycode = HID_KEYBOARD_A_AND_A + (i % 26);
+    report.addKeycode(keycode);
+    bench::keep(report);
+    report.removeKeycode(keycode);
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(consumer_report_add_release) {
+  consumer::Report report;
+  for (unsigned long i{0}; i < iterations; ++i) {
+    report.addKeycode(HID_CONSUMER_VOLUME_INCREMENT);
+    bench::keep(report);
+    report.releaseKeycode(HID_CONSUMER_VOLUME_INCREMENT);
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(mouse_accumulate) {
+  mouse::Dispatcher mouse;
+  for (unsigned long i{0}; i < iterations; ++i) {
+    mouse.accumulate(3, -5, 0, 0);
+    bench::keep(mouse);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Keyboard report bitmaps on a typing trace
+
+namespace {
+
+typedef keyboard::Report::Bitmap Bitmap;
+constexpr byte bitmap_size = keyboard::Report::size;
+
+// The report bitmap after each scan while typing `trace_text` on US QWERTY, with each key
+// still held when the next one is pressed, as a typist's fingers overlap, and a key typed
+// twice released in between.
+const char trace_text[] =
+  "The quick brown fox jumps over the lazy dog. Pack my box with five dozen liquor jugs!\n"
+  "Sphinx of black quartz, judge my vow; 1234567890 (tested) & done.\n";
+
+struct Scan {
+  Bitmap report;
+  // The changes from the previous scan.
+  Bitmap presses;
+  Bitmap releases;
+};
+
+void setBit(Bitmap& bitmap, byte keycode) {
+  bitmap[1 + (keycode / 8) - (keyboard::Report::first_key / 8)] |= 1 << (keycode % 8);
+}
+
+std::vector<Scan> typingTrace() {
+  std::vector<Scan> scans;
+  Bitmap previous = {};
+  auto add = [&](byte modifiers, byte held, byte pressed) {
+    Scan scan = {};
+    scan.report[0] = modifiers;
+    if (held != 0)
+      setBit(scan.report, held);
+    if (pressed != 0)
+      setBit(scan.report, pressed);
+    for (byte i{0}; i < bitmap_size; ++i) {
+      scan.presses[i] = scan.report[i] & ~previous[i];
+      scan.releases[i] = previous[i] & ~scan.report[i];
+    }
+    memcpy(previous, scan.report, bitmap_size);
+    scans.push_back(scan);
+  };
+  byte held{0};
+  for (const char* c = trace_text; *c != '\0'; ++c) {
+    layout::Keystroke keystroke = layout::Table<layout::UsQwerty>::lookup(*c);
+    if (keystroke.keycode == held)
+      add(0, 0, 0);
+    else if (held != 0)
+      add(keystroke.modifiers, held, keystroke.keycode);
+    add(keystroke.modifiers, 0, keystroke.keycode);
+    held = keystroke.keycode;
+  }
+  add(0, 0, 0);
+  return scans;
+}
+
+const std::vector<Scan>& trace() {
+  static const std::vector<Scan> scans = typingTrace();
+  return scans;
+}
+
+// The byte-at-a-time versions of the report operations that the bitmap kernels replaced,
+// for comparison.
+namespace baseline {
+
+bool equal(const Bitmap& a, const Bitmap& b) {
+  return memcmp(a, b, bitmap_size) == 0;
+}
+
+void copy(Bitmap& dst, const Bitmap& src) {
+  memcpy(dst, src, bitmap_size);
+}
+
+bool hasPlainReleases(const Bitmap& report, const Bitmap& new_report) {
+  for (byte i{1}; i < bitmap_size; ++i) {
+    if ((report[i] & ~(new_report[i])) != 0)
+      return true;
+  }
+  return false;
+}
+
+bool updatePlainReleases(Bitmap& report, const Bitmap& new_report) {
+  bool result{false};
+  for (byte i{1}; i < bitmap_size; ++i) {
+    byte released_keycodes = report[i] & ~(new_report[i]);
+    if (released_keycodes != 0) {
+      report[i] &= ~released_keycodes;
+      result = true;
+    }
+  }
+  return result;
+}
+
+bool apply(Bitmap& report, const Bitmap& presses, const Bitmap& releases) {
+  bool changed{false};
+  for (byte i{0}; i < bitmap_size; ++i) {
+    byte updated = (report[i] & ~releases[i]) | presses[i];
+    if (updated != report[i]) {
+      report[i] = updated;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+} // namespace baseline {
+
+// The next scan of the trace to compare with the one before it, wrapping around.
+size_t nextScan(const std::vector<Scan>& scans, size_t n) {
+  return (n + 1 < scans.size()) ? n + 1 : 1;
+}
+
+} // namespace {
+
+// Each iteration is one scan of the trace: comparing the report with the last one,
+// copying it, or checking for and removing released keys, as `trySendReport()` does, or
+// applying the scan's changes to the previous report. Each operation is run with the
+// byte-at-a-time baseline code, and with the bitmap kernels.
+
+BENCHMARK(keyboard_trace_compare_bytewise) {
+  const std::vector<Scan>& scans = trace();
+  bool equal{false};
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    equal ^= baseline::equal(scans[n].report, scans[n - 1].report);
+    bench::keep(equal);
+  }
+}
+
+BENCHMARK(keyboard_trace_compare_words) {
+  const std::vector<Scan>& scans = trace();
+  bool equal{false};
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    equal ^= bitmap::equal(scans[n].report, scans[n - 1].report, bitmap_size);
+    bench::keep(equal);
+  }
+}
+
+BENCHMARK(keyboard_trace_copy_bytewise) {
+  const std::vector<Scan>& scans = trace();
+  Bitmap report;
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    baseline::copy(report, scans[n].report);
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(keyboard_trace_copy_words) {
+  const std::vector<Scan>& scans = trace();
+  Bitmap report;
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    bitmap::copy(report, scans[n].report, bitmap_size);
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(keyboard_trace_plain_releases_bytewise) {
+  const std::vector<Scan>& scans = trace();
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    Bitmap report;
+    memcpy(report, scans[n - 1].report, bitmap_size);
+    bench::keep(report);
+    if (baseline::hasPlainReleases(report, scans[n].report))
+      bench::keep(baseline::updatePlainReleases(report, scans[n].report));
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(keyboard_trace_plain_releases_words) {
+  const std::vector<Scan>& scans = trace();
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    Bitmap report;
+    memcpy(report, scans[n - 1].report, bitmap_size);
+    bench::keep(report);
+    if (bitmap::hasBitsNotIn(&report[1], &scans[n].report[1], bitmap_size - 1))
+      bench::keep(bitmap::intersect(&report[1], &scans[n].report[1], bitmap_size - 1));
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(keyboard_trace_apply_diff_bytewise) {
+  const std::vector<Scan>& scans = trace();
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    Bitmap report;
+    memcpy(report, scans[n - 1].report, bitmap_size);
+    bench::keep(report);
+    bench::keep(baseline::apply(report, scans[n].presses, scans[n].releases));
+    bench::keep(report);
+  }
+}
+
+BENCHMARK(keyboard_trace_apply_diff_words) {
+  const std::vector<Scan>& scans = trace();
+  for (size_t i{0}, n{1}; i < iterations; ++i, n = nextScan(scans, n)) {
+    Bitmap report;
+    memcpy(report, scans[n - 1].report, bitmap_size);
+    bench::keep(report);
+    bench::keep(bitmap::apply(report, scans[n].presses, scans[n].releases,
+                              bitmap_size));
+    bench::keep(report);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Mouse key acceleration
+
+namespace {
+
+typedef mouse::CurveTable<mouse::QuadraticCurve<8, 160, 40>> CursorCurve;
+
+// A mouse key (or two, for a diagonal) held for 64 ticks, past the end of the curve,
+// then released, in each of the eight directions in turn.
+void holdMouseKeys(mouse::Accelerator& accelerator, unsigned long tick) {
+  static const int8_t directions[8][2] = {
+    {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1},
+  };
+  if (tick % 64 == 0) {
+    const int8_t* direction = directions[(tick / 64) % 8];
+    accelerator.setDirection(0, 0);
+    accelerator.setDirection(direction[0], direction[1]);
+  }
+}
+
+} // namespace {
+
+BENCHMARK(mouse_accelerator_tick) {
+  mouse::Accelerator accelerator(CursorCurve::data, CursorCurve::length);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    holdMouseKeys(accelerator, i);
+    int16_t x, y;
+    accelerator.tick(x, y);
+    bench::keep(x);
+    bench::keep(y);
+  }
+}
+
+// The same, adding the movement to the dispatcher's motion accumulator.
+BENCHMARK(mouse_accelerator_move_cursor) {
+  mouse::Dispatcher mouse;
+  mouse::Accelerator accelerator(CursorCurve::data, CursorCurve::length);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    holdMouseKeys(accelerator, i);
+    accelerator.moveCursor(mouse);
+    bench::keep(mouse);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Gamepad axes
+
+namespace {
+
+// A 10-bit ADC reading of a stick being swept slowly from end to end and back, through
+// the deadzone, with a few units of noise on every reading.
+std::vector<int16_t> sweepReadings() {
+  std::vector<int16_t> readings;
+  uint32_t noise{12345};
+  for (int i{0}; i < 4096; ++i) {
+    noise = noise * 1103515245 + 12345;
+    int position = (i < 2048) ? i / 2 : 2047 - i / 2;
+    int reading = position + int((noise >> 16) % 9) - 4;
+    readings.push_back(reading < 0 ? 0 : reading > 1023 ? 1023 : reading);
+  }
+  return readings;
+}
+
+const std::vector<int16_t>& stickReadings() {
+  static const std::vector<int16_t> readings = sweepReadings();
+  return readings;
+}
+
+} // namespace {
+
+// The cost of one reading with every stage of the conditioning enabled: smoothing,
+// calibrated scaling, the deadzone, and the change threshold.
+BENCHMARK(gamepad_axis_update) {
+  const std::vector<int16_t>& readings = stickReadings();
+  gamepad::Axis axis(8, 2, 64);
+  axis.calibrate(0, 512, 1023);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    int16_t raw = readings[i % readings.size()];
+    bench::keep(raw);
+    bench::keep(axis.update(raw));
+  }
+  bench::keep(axis.value());
+}
+
+// The same with every stage but the scaling turned off, for comparison.
+BENCHMARK(gamepad_axis_update_scale_only) {
+  const std::vector<int16_t>& readings = stickReadings();
+  gamepad::Axis axis(0, 0, 0);
+  axis.calibrate(0, 512, 1023);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    int16_t raw = readings[i % readings.size()];
+    bench::keep(raw);
+    bench::keep(axis.update(raw));
+  }
+  bench::keep(axis.value());
+}
+
+// ----------------------------------------------------------------------------
+// Sending reports
+
+// A key press and release, each sent with the blocking `sendReport()`.
+BENCHMARK(keyboard_send_report_blocking) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+  keyboard::Report pressed, released;
+  pressed.addKeycode(HID_KEYBOARD_A_AND_A);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    keyboard.sendReport(pressed);
+    keyboard.sendReport(released);
+  }
+}
+
+// The same, queued with `trySendReport()` and sent by `poll()` once per frame.
+BENCHMARK(keyboard_send_report_queued) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+  keyboard::Report pressed, released;
+  pressed.addKeycode(HID_KEYBOARD_A_AND_A);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    keyboard.trySendReport(pressed);
+    keyboard.trySendReport(released);
+    while (keyboard.hasPendingReports()) {
+      fake_usb::advanceFrames(1);
+      keyboard.poll();
+    }
+  }
+}
+
+// A shifted key, which is split into separate reports for the modifier and the key.
+BENCHMARK(keyboard_send_report_split) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+  keyboard::Report shifted, released;
+  shifted.addModifiers(0x02);
+  shifted.addKeycode(HID_KEYBOARD_A_AND_A);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    keyboard.sendReport(shifted);
+    keyboard.sendReport(released);
+  }
+}
+
+// A report identical to the last one, which shouldn't be sent at all.
+BENCHMARK(keyboard_send_report_duplicate) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+  keyboard::Report pressed;
+  pressed.addKeycode(HID_KEYBOARD_A_AND_A);
+  keyboard.sendReport(pressed);
+  for (unsigned long i{0}; i < iterations; ++i)
+    keyboard.sendReport(pressed);
+}
+
+BENCHMARK(mouse_send_report_blocking) {
+  mouse::Dispatcher mouse;
+  mouse.init();
+  mouse::Report report;
+  report.moveCursor(1, 0);
+  for (unsigned long i{0}; i < iterations; ++i)
+    mouse.sendReport(report);
+}
+
+// Keyboard and mouse activity every frame, sent by the scheduler.
+BENCHMARK(scheduler_keyboard_and_mouse) {
+  keyboard::Dispatcher keyboard;
+  mouse::Dispatcher mouse;
+  keyboard.init();
+  mouse.init();
+  Scheduler scheduler(&keyboard, nullptr, nullptr, &mouse);
+  keyboard::Report pressed, released;
+  pressed.addKeycode(HID_KEYBOARD_A_AND_A);
+  for (unsigned long i{0}; i < iterations; ++i) {
+    keyboard.trySendReport((i & 1) ? released : pressed);
+    mouse.accumulate(16, 16);
+    scheduler.poll();
+    fake_usb::advanceFrames(1);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Descriptors
+
+BENCHMARK(descriptor_enumerate) {
+  keyboard::Dispatcher keyboard;
+  consumer::Dispatcher consumer;
+  mouse::Dispatcher mouse;
+  keyboard.init();
+  consumer.init();
+  mouse.init();
+  for (unsigned long i{0}; i < iterations; ++i)
+    bench::keep(fake_usb::enumerate());
+}
+
+BENCHMARK(descriptor_shared_report_descriptor) {
+  keyboard::Dispatcher keyboard;
+  consumer::Dispatcher consumer;
+  mouse::Dispatcher mouse;
+  keyboard.init();
+  consumer.init();
+  mouse.init();
+  for (unsigned long i{0}; i < iterations; ++i)
+    bench::keep(fake_usb::reportDescriptor(fake_usb::shared_interface));
+}
+
+// The keyboard's own interface, whose boot descriptor is assembled from fragments.
+BENCHMARK(descriptor_keyboard_report_descriptor) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+  std::vector<fake_usb::Interface> interfaces = fake_usb::enumerate();
+  byte interface = interfaces.back().number;
+  for (unsigned long i{0}; i < iterations; ++i)
+    bench::keep(fake_usb::reportDescriptor(interface));
+}
+
+// ----------------------------------------------------------------------------
+
+namespace bench {
+
+constexpr std::chrono::milliseconds min_run_time{200};
+
+struct Result {
+  unsigned long iterations;
+  double host_ns;
+  double simulated_us;
+};
+
+Result run(Function function, unsigned long iterations) {
+  fake_usb::reset();
+  auto start = std::chrono::steady_clock::now();
+  function(iterations);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+  return {iterations, ns, double(fake_usb::now())};
+}
+
+} // namespace bench {
+
+// Runs every benchmark, or only those whose name contains the first argument.
+int main(int argc, char* argv[]) {
+  const char* filter = (argc > 1) ? argv[1] : "";
+  const double min_ns =
+    std::chrono::duration<double, std::nano>(bench::min_run_time).count();
+
+  printf("bitmap words: %u byte(s)\n", unsigned(sizeof(bitmap::word_t)));
+  printf("%-40s %12s %12s %16s\n",
+         "benchmark", "iterations", "host ns/op", "simulated us/op");
+  for (bench::Benchmark* b = bench::first_benchmark; b; b = b->next) {
+    if (strstr(b->name, filter) == nullptr)
+      continue;
+    bench::Result result;
+    for (unsigned long iterations{1}; ; iterations *= 2) {
+      result = bench::run(b->function, iterations);
+      if (result.host_ns >= min_ns)
+        break;
+    }
+    printf("%-40s %12lu %12.1f %16.1f\n", b->name, result.iterations,
+           result.host_ns / result.iterations, result.simulated_us / result.iterations);
+  }
+  return 0;
+}
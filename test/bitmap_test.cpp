@@ -0,0 +1,163 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+
+#include "kaleidoglyph/hid/bitmap.h"
+#include "kaleidoglyph/hid/keyboard.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+// Every size up to a few words past the word size, so both the word loops and the tail
+// loops are covered.
+constexpr byte max_size = 3 * sizeof(bitmap::word_t) + 3;
+
+void setBit(byte* bitmap, int bit) {
+  bitmap[bit / 8] |= 1 << (bit % 8);
+}
+
+// Keycodes in a diff bitmap are laid out as in the report, after the modifiers byte.
+void setKey(keyboard::Report::Bitmap& bitmap, byte keycode) {
+  bitmap[1 + (keycode / 8) - (keyboard::Report::first_key / 8)] |= 1 << (keycode % 8);
+}
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Kernels
+
+TEST(bitmap, equal_finds_a_difference_in_any_bit) {
+  for (byte size{1}; size <= max_size; ++size) {
+    for (int bit{0}; bit < size * 8; ++bit) {
+      byte a[max_size] = {}, b[max_size] = {};
+      setBit(a, bit);
+      EXPECT_FALSE(bitmap::equal(a, b, size));
+      setBit(b, bit);
+      EXPECT_TRUE(bitmap::equal(a, b, size));
+    }
+  }
+}
+
+TEST(bitmap, equal_ignores_bytes_past_the_end) {
+  byte a[max_size] = {}, b[max_size] = {};
+  a[5] = 0xFF;
+  EXPECT_TRUE(bitmap::equal(a, b, 5));
+}
+
+TEST(bitmap, copy_copies_exactly_size_bytes) {
+  for (byte size{1}; size < max_size; ++size) {
+    byte src[max_size], dst[max_size] = {};
+    for (byte i{0}; i < max_size; ++i)
+      src[i] = i + 1;
+    bitmap::copy(dst, src, size);
+    EXPECT_TRUE(bitmap::equal(dst, src, size));
+    EXPECT_EQ(dst[size], 0);
+  }
+}
+
+TEST(bitmap, has_bits_not_in_finds_any_extra_bit) {
+  for (byte size{1}; size <= max_size; ++size) {
+    for (int bit{0}; bit < size * 8; ++bit) {
+      byte a[max_size] = {}, b[max_size];
+      memset(b, 0xFF, sizeof(b));
+      EXPECT_FALSE(bitmap::hasBitsNotIn(a, b, size));
+      setBit(a, bit);
+      EXPECT_FALSE(bitmap::hasBitsNotIn(a, b, size));
+      b[bit / 8] &= ~(1 << (bit % 8));
+      EXPECT_TRUE(bitmap::hasBitsNotIn(a, b, size));
+    }
+  }
+}
+
+TEST(bitmap, intersect_clears_bits_missing_from_the_mask) {
+  for (byte size{1}; size <= max_size; ++size) {
+    for (int bit{0}; bit < size * 8; ++bit) {
+      byte dst[max_size] = {}, mask[max_size] = {}, expected[max_size] = {};
+      setBit(dst, bit);
+      setBit(dst, (bit + 1) % (size * 8));
+      setBit(mask, (bit + 1) % (size * 8));
+      setBit(expected, (bit + 1) % (size * 8));
+      EXPECT_TRUE(bitmap::intersect(dst, mask, size));
+      EXPECT_TRUE(bitmap::equal(dst, expected, max_size));
+      EXPECT_FALSE(bitmap::intersect(dst, mask, size));
+    }
+  }
+}
+
+TEST(bitmap, apply_releases_before_pressing) {
+  for (byte size{1}; size <= max_size; ++size) {
+    for (int bit{0}; bit < size * 8; ++bit) {
+      byte dst[max_size] = {}, presses[max_size] = {}, releases[max_size] = {};
+      setBit(presses, bit);
+      EXPECT_TRUE(bitmap::apply(dst, presses, releases, size));
+      EXPECT_TRUE(bitmap::equal(dst, presses, max_size));
+      EXPECT_FALSE(bitmap::apply(dst, presses, releases, size));
+
+      // A key in both lists ends up pressed, so nothing changes.
+      setBit(releases, bit);
+      EXPECT_FALSE(bitmap::apply(dst, presses, releases, size));
+
+      byte none[max_size] = {};
+      EXPECT_TRUE(bitmap::apply(dst, none, releases, size));
+      EXPECT_TRUE(bitmap::equal(dst, none, max_size));
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Keyboard reports
+
+TEST(keyboard_report, compares_modifiers_and_every_key) {
+  keyboard::Report a, b;
+  EXPECT_TRUE(a == b);
+  for (byte keycode{keyboard::Report::first_key};
+       keycode <= keyboard::Report::last_key; ++keycode) {
+    a.addKeycode(keycode);
+    EXPECT_TRUE(a != b);
+    b.addKeycode(keycode);
+    EXPECT_TRUE(a == b);
+  }
+  a.addModifiers(0x80);
+  EXPECT_TRUE(a != b);
+}
+
+TEST(keyboard_report, apply_diff_reports_whether_anything_changed) {
+  keyboard::Report report;
+  report.addKeycode(HID_KEYBOARD_A_AND_A);
+
+  keyboard::Report::Bitmap presses = {}, releases = {};
+  EXPECT_FALSE(report.applyDiff(presses, releases));
+
+  keyboard::Report with_b;
+  with_b.addKeycode(HID_KEYBOARD_B_AND_B);
+
+  setKey(presses, HID_KEYBOARD_B_AND_B);
+  setKey(releases, HID_KEYBOARD_A_AND_A);
+  EXPECT_TRUE(report.applyDiff(presses, releases));
+  EXPECT_TRUE(report == with_b);
+  EXPECT_FALSE(report.readKeycode(HID_KEYBOARD_A_AND_A));
+  EXPECT_FALSE(report.applyDiff(presses, releases));
+}
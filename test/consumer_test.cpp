@@ -0,0 +1,177 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "HIDTables.h"
+#include "kaleidoglyph/hid/consumer.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+constexpr byte consumer_endpoint = HID_CONSUMERCONTROL_DEDICATED_ENDPOINT
+                                   ? fake_usb::shared_endpoint + 1
+                                   : fake_usb::shared_endpoint;
+
+// The consumer control reports with the given report ID that the host has received,
+// without their report IDs.
+std::vector<std::vector<byte>> hostReports(byte report_id) {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(consumer_endpoint)) {
+    if (HID_CONSUMERCONTROL_DEDICATED_ENDPOINT)
+      reports.push_back(packet.data);
+    else if (packet.data[0] == report_id)
+      reports.emplace_back(packet.data.begin() + 1, packet.data.end());
+  }
+  return reports;
+}
+
+void start(consumer::Dispatcher& consumer) {
+  consumer.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+constexpr uint16_t brightness_up = 0x006F;
+constexpr uint16_t play = 0x00B0;
+constexpr uint16_t scan_next_track = 0x00B5;
+constexpr uint16_t mute = HID_CONSUMER_MUTE;
+constexpr uint16_t volume_up = HID_CONSUMER_VOLUME_INCREMENT;
+constexpr uint16_t calculator = 0x0192;
+constexpr uint16_t bookmarks = 0x022A;
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Usage map
+
+TEST(consumer, usage_map_gives_each_usage_its_bit_in_order) {
+  EXPECT_EQ(consumer::BitmapUsages::count, 26);
+  EXPECT_EQ(consumer::BitmapUsages::index(brightness_up), 0);
+  EXPECT_EQ(consumer::BitmapUsages::index(0x0070), 1);
+  EXPECT_EQ(consumer::BitmapUsages::index(play), 2);
+  EXPECT_EQ(consumer::BitmapUsages::index(scan_next_track), 7);
+  EXPECT_EQ(consumer::BitmapUsages::index(mute), 12);
+  EXPECT_EQ(consumer::BitmapUsages::index(volume_up), 13);
+  EXPECT_EQ(consumer::BitmapUsages::index(calculator), 17);
+  EXPECT_EQ(consumer::BitmapUsages::index(bookmarks), 25);
+}
+
+TEST(consumer, usage_map_has_no_bit_for_other_usages) {
+  // Below the first usage, in a block with usages, in an empty block inside the range,
+  // and past the last block.
+  for (uint16_t usage : {0x0000, 0x006E, 0x00B9, 0x0100, 0x0182, 0x022B, 0x0230, 0xFFFF})
+    EXPECT_EQ(consumer::BitmapUsages::index(usage), 0xFF);
+}
+
+TEST(consumer, usage_map_skips_empty_blocks) {
+  typedef consumer::UsageMap<0x0001, 0x000F, 0x0040, 0x0041> Map;
+  EXPECT_EQ(Map::block_count, 5);
+  EXPECT_EQ(Map::used_block_count, 2);
+  EXPECT_EQ(Map::index(0x0001), 0);
+  EXPECT_EQ(Map::index(0x000F), 1);
+  EXPECT_EQ(Map::index(0x0040), 2);
+  EXPECT_EQ(Map::index(0x0041), 3);
+  EXPECT_EQ(Map::index(0x0000), 0xFF);
+  EXPECT_EQ(Map::index(0x0020), 0xFF);
+  EXPECT_EQ(Map::index(0x0042), 0xFF);
+}
+
+// ----------------------------------------------------------------------------
+// Bitmap report
+
+TEST(consumer, bitmap_report_refuses_usages_without_a_bit) {
+  consumer::BitmapReport report;
+  EXPECT_FALSE(report.addUsage(0x00B9));
+  EXPECT_FALSE(report.addUsage(0x0100));
+  EXPECT_FALSE(report.releaseUsage(0x0230));
+  EXPECT_TRUE(report == consumer::BitmapReport());
+
+  EXPECT_TRUE(report.addUsage(mute));
+  EXPECT_FALSE(report == consumer::BitmapReport());
+  EXPECT_TRUE(report.releaseUsage(mute));
+  EXPECT_TRUE(report == consumer::BitmapReport());
+}
+
+TEST(consumer, array_report_layout) {
+  consumer::Dispatcher consumer;
+  start(consumer);
+
+  consumer::Report report;
+  report.addKeycode(volume_up);
+  report.addKeycode(calculator);
+  consumer.sendReport(report);
+  fake_usb::advanceFrames(1);
+
+  std::vector<std::vector<byte>> reports = hostReports(HID_REPORTID_CONSUMERCONTROL);
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], {0xE9, 0x00, 0x92, 0x01, 0x00, 0x00, 0x00, 0x00});
+}
+
+#if HID_CONSUMERCONTROL_BITMAP && !HID_CONSUMERCONTROL_DEDICATED_ENDPOINT
+TEST(consumer, bitmap_report_layout) {
+  consumer::Dispatcher consumer;
+  start(consumer);
+
+  consumer::BitmapReport report;
+  EXPECT_TRUE(report.addUsage(brightness_up));
+  EXPECT_TRUE(report.addUsage(mute));
+  EXPECT_TRUE(report.addUsage(bookmarks));
+  consumer.sendReport(report);
+  fake_usb::advanceFrames(1);
+  EXPECT_TRUE(report.releaseUsage(brightness_up));
+  consumer.sendReport(report);
+  fake_usb::advanceFrames(1);
+
+  // Report ID 9, then four bytes, with the usages in bit order from the low bit of the
+  // first byte; the last six bits are padding.
+  std::vector<fake_usb::Packet> packets = fake_usb::packetsOn(consumer_endpoint);
+  EXPECT_EQ(packets.size(), 2u);
+  EXPECT_EQ(consumer::bitmap_report_id, 9);
+  EXPECT_BYTES(packets[0].data, {0x09, 0x01, 0x10, 0x00, 0x02});
+  EXPECT_BYTES(packets[1].data, {0x09, 0x00, 0x10, 0x00, 0x02});
+}
+
+TEST(consumer, bitmap_and_array_reports_are_deduplicated_separately) {
+  consumer::Dispatcher consumer;
+  start(consumer);
+
+  consumer::BitmapReport bitmap;
+  bitmap.addUsage(play);
+  consumer::Report array;
+  array.addKeycode(play);
+  consumer.sendReport(bitmap);
+  fake_usb::advanceFrames(1);
+  consumer.sendReport(array);
+  fake_usb::advanceFrames(1);
+  consumer.sendReport(bitmap);
+  consumer.sendReport(array);
+  fake_usb::advanceFrames(1);
+
+  EXPECT_EQ(hostReports(consumer::bitmap_report_id).size(), 1u);
+  EXPECT_EQ(hostReports(HID_REPORTID_CONSUMERCONTROL).size(), 1u);
+}
+#endif
@@ -0,0 +1,249 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/descriptor.h"
+#include "kaleidoglyph/hid/keyboard.h"
+#include "kaleidoglyph/hid/consumer.h"
+#include "kaleidoglyph/hid/system.h"
+#include "kaleidoglyph/hid/mouse.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+template <typename _Descriptor>
+std::vector<byte> bytesOf() {
+  return std::vector<byte>(_Descriptor::data(), _Descriptor::data() + _Descriptor::length);
+}
+
+// Enumerate, and return the report descriptor of the given interface, after checking that
+// its HID descriptor announces the right length.
+std::vector<byte> reportDescriptor(byte interface) {
+  uint16_t announced_length = 0;
+  for (const fake_usb::Interface& i : fake_usb::enumerate()) {
+    if (i.number == interface)
+      announced_length = i.report_descriptor_length;
+  }
+  std::vector<byte> descriptor = fake_usb::reportDescriptor(interface);
+  EXPECT_EQ(announced_length, descriptor.size());
+  return descriptor;
+}
+
+// The interface a dispatcher's reports go through: `HID()`'s, or the first one plugged
+// after it.
+constexpr byte interfaceFor(bool dedicated) {
+  return dedicated ? fake_usb::shared_interface + 1 : fake_usb::shared_interface;
+}
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Item encoding
+
+TEST(descriptor, values_use_the_smallest_data_size) {
+  using namespace descriptor;
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMinimum<0>>>(), {0x15, 0x00});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMinimum<-1>>>(), {0x15, 0xff});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMinimum<-128>>>(), {0x15, 0x80});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMinimum<-129>>>(), {0x16, 0x7f, 0xff});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMinimum<-32768>>>(), {0x16, 0x00, 0x80});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMaximum<127>>>(), {0x25, 0x7f});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMaximum<255>>>(), {0x26, 0xff, 0x00});
+  EXPECT_BYTES(bytesOf<Descriptor<LogicalMaximum<65535>>>(),
+               {0x27, 0xff, 0xff, 0x00, 0x00});
+  EXPECT_BYTES(bytesOf<Descriptor<PhysicalMaximum<8>>>(), {0x45, 0x08});
+}
+
+TEST(descriptor, usages_are_unsigned) {
+  using namespace descriptor;
+  EXPECT_BYTES(bytesOf<Descriptor<UsagePage<0x0c>>>(), {0x05, 0x0c});
+  EXPECT_BYTES(bytesOf<Descriptor<Usage<0xff>>>(), {0x09, 0xff});
+  EXPECT_BYTES(bytesOf<Descriptor<Usage<0x0238>>>(), {0x0a, 0x38, 0x02});
+  typedef Descriptor<UsageMinimum<0xe0>, UsageMaximum<0xe7>> Range;
+  EXPECT_BYTES(bytesOf<Range>(), {0x19, 0xe0, 0x29, 0xe7});
+}
+
+TEST(descriptor, report_id_zero_and_empty_padding_emit_nothing) {
+  using namespace descriptor;
+  EXPECT_EQ((Descriptor<ReportId<0>>::length), 0);
+  EXPECT_BYTES(bytesOf<Descriptor<ReportId<4>>>(), {0x85, 0x04});
+  EXPECT_EQ((Descriptor<InputPadding<0>>::length), 0);
+  EXPECT_BYTES(bytesOf<Descriptor<InputPadding<3>>>(), {0x75, 0x03, 0x95, 0x01, 0x81, 0x01});
+}
+
+TEST(descriptor, report_lengths_are_counted_per_report_type) {
+  using namespace descriptor;
+  typedef Descriptor<Collection<D_APPLICATION>,
+                     ReportSize<1>, ReportCount<8>, Input<D_DATA>,
+                     ReportCount<5>, Output<D_DATA>,
+                     InputPadding<4>,
+                     ReportSize<16>, ReportCount<3>, Feature<D_DATA>,
+                     EndCollection> Nested;
+  typedef Descriptor<Nested, ReportSize<8>, ReportCount<2>, Input<D_DATA>> Outer;
+
+  EXPECT_EQ(Nested::input_bytes, 2);
+  EXPECT_EQ(Nested::output_bytes, 1);
+  EXPECT_EQ(Nested::feature_bytes, 6);
+  EXPECT_EQ(Outer::input_bytes, 4);
+  EXPECT_EQ(Outer::length, Nested::length + 6);
+  EXPECT_BYTES(bytesOf<Nested>(),
+               {0xa1, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x00, 0x95, 0x05, 0x91, 0x00,
+                0x75, 0x04, 0x95, 0x01, 0x81, 0x01, 0x75, 0x10, 0x95, 0x03, 0xb1, 0x00,
+                0xc0});
+}
+
+// ----------------------------------------------------------------------------
+// Dispatcher descriptors
+//
+// These are the descriptors the macros used to produce, byte for byte, except for two
+// deliberate changes to the keyboard's: the NKRO key bitmap ends at the last key of the
+// report's range, so its count is 0xda with two bits of padding (it was 0xd9, and three
+// bits), and the boot descriptor's logical maximum of 255 is encoded as two bytes
+// (`26 ff 00`), since the one-byte `25 ff` means -1.
+
+TEST(descriptor, keyboard) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+
+  std::vector<byte> nkro{
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01,
+#if !HID_KEYBOARD_DEDICATED_ENDPOINT
+    0x85, 0x08,
+#endif
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08,
+    0x81, 0x02,
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x08, 0x95, 0x08, 0x75, 0x01, 0x91, 0x02,
+    0x05, 0x07, 0x75, 0x04, 0x95, 0x01, 0x81, 0x01,
+    0x19, 0x04, 0x29, 0xdd, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0xda, 0x81, 0x02,
+    0x75, 0x02, 0x95, 0x01, 0x81, 0x01,
+    0xc0,
+  };
+#if HID_STATS
+  std::vector<byte> stats{
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x09, 0x02, 0x15, 0x00,
+    0x27, 0xff, 0xff, 0x00, 0x00, 0x75, 0x10, 0x95, 0x30, 0xb1, 0x02, 0xc0,
+  };
+  nkro.insert(nkro.end(), stats.begin(), stats.end());
+#endif
+
+  EXPECT_BYTES(reportDescriptor(interfaceFor(HID_KEYBOARD_DEDICATED_ENDPOINT)),
+               (nkro));
+}
+
+#if !HID_KEYBOARD_DEDICATED_ENDPOINT
+TEST(descriptor, keyboard_boot) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+
+  EXPECT_BYTES(reportDescriptor(fake_usb::shared_interface + 1),
+               {0x05, 0x01, 0x09, 0x06, 0xa1, 0x01,
+                0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+                0x95, 0x08, 0x81, 0x02,
+                0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+                0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02,
+                0x95, 0x01, 0x75, 0x03, 0x91, 0x01,
+                0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x26, 0xff, 0x00,
+                0x05, 0x07, 0x19, 0x00, 0x29, 0xff, 0x81, 0x00,
+                0xc0});
+
+  for (const fake_usb::Interface& interface : fake_usb::enumerate()) {
+    if (interface.number == fake_usb::shared_interface + 1) {
+      EXPECT_EQ(interface.subclass, 1);
+      EXPECT_EQ(interface.protocol, 1);
+    }
+  }
+}
+#endif
+
+TEST(descriptor, consumer) {
+  consumer::Dispatcher consumer;
+  consumer.init();
+
+  std::vector<byte> expected{
+    0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01,
+#if !HID_CONSUMERCONTROL_DEDICATED_ENDPOINT
+    0x85, 0x04,
+#endif
+    0x15, 0x00, 0x26, 0xff, 0x03, 0x19, 0x00, 0x2a, 0xff, 0x03, 0x95, 0x04, 0x75, 0x10,
+    0x81, 0x00,
+    0xc0,
+  };
+#if HID_CONSUMERCONTROL_BITMAP && !HID_CONSUMERCONTROL_DEDICATED_ENDPOINT
+  std::vector<byte> bitmap{
+    0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x09,
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x1a,
+    0x09, 0x6f, 0x09, 0x70, 0x09, 0xb0, 0x09, 0xb1, 0x09, 0xb2, 0x09, 0xb3, 0x09, 0xb4,
+    0x09, 0xb5, 0x09, 0xb6, 0x09, 0xb7, 0x09, 0xb8, 0x09, 0xcd, 0x09, 0xe2, 0x09, 0xe9,
+    0x09, 0xea, 0x0a, 0x83, 0x01, 0x0a, 0x8a, 0x01, 0x0a, 0x92, 0x01, 0x0a, 0x94, 0x01,
+    0x0a, 0x21, 0x02, 0x0a, 0x23, 0x02, 0x0a, 0x24, 0x02, 0x0a, 0x25, 0x02, 0x0a, 0x26,
+    0x02, 0x0a, 0x27, 0x02, 0x0a, 0x2a, 0x02, 0x81, 0x02,
+    0x75, 0x06, 0x95, 0x01, 0x81, 0x01,
+    0xc0,
+  };
+  expected.insert(expected.end(), bitmap.begin(), bitmap.end());
+#endif
+
+  EXPECT_BYTES(reportDescriptor(interfaceFor(HID_CONSUMERCONTROL_DEDICATED_ENDPOINT)),
+               (expected));
+}
+
+TEST(descriptor, system) {
+  system::Dispatcher system;
+  system.init();
+
+  std::vector<byte> expected{
+    0x05, 0x01, 0x09, 0x80, 0xa1, 0x01,
+#if !HID_SYSTEMCONTROL_DEDICATED_ENDPOINT
+    0x85, 0x05,
+#endif
+#if HID_SYSTEMCONTROL_BITMAP
+    0x15, 0x00, 0x25, 0x01, 0x19, 0x81, 0x29, 0x8f, 0x95, 0x0f, 0x75, 0x01, 0x81, 0x02,
+    0x75, 0x01, 0x95, 0x01, 0x81, 0x01,
+#else
+    0x15, 0x00, 0x26, 0xff, 0x00, 0x19, 0x00, 0x29, 0xff, 0x95, 0x01, 0x75, 0x08,
+    0x81, 0x00,
+#endif
+    0xc0,
+  };
+
+  EXPECT_BYTES(reportDescriptor(interfaceFor(HID_SYSTEMCONTROL_DEDICATED_ENDPOINT)),
+               (expected));
+}
+
+TEST(descriptor, absolute_mouse) {
+  mouse::absolute::Dispatcher mouse;
+  mouse.init();
+
+  EXPECT_BYTES(reportDescriptor(fake_usb::shared_interface + 1),
+               {0x05, 0x01, 0x09, 0x02, 0xa1, 0x01,
+                0x05, 0x09, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x95, 0x08,
+                0x75, 0x01, 0x81, 0x02,
+                0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xff, 0x7f,
+                0x75, 0x10, 0x95, 0x02, 0x81, 0x02,
+                0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06,
+                0xc0});
+}
@@ -0,0 +1,69 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// A stand-in for the parts of the Arduino AVR core that the kaleidoglyph::hid dispatchers
+// use, so they can be built and tested on the host. Time only passes when a test (or a
+// blocking `USB_Send()`) advances it; see `fake_usb.h`.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ARDUINO 10808
+#define USBCON
+
+typedef uint8_t byte;
+
+// There's no separate program memory on the host.
+#define PROGMEM
+#define PGM_P const char*
+#define pgm_read_byte(address) (*reinterpret_cast<const uint8_t*>(address))
+#define pgm_read_word(address) (*reinterpret_cast<const uint16_t*>(address))
+#define pgm_read_dword(address) (*reinterpret_cast<const uint32_t*>(address))
+#define pgm_read_ptr(address) (*reinterpret_cast<const void* const*>(address))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) \
+  ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// USB controller registers: the frame number (kept up to date by the fake host), and the
+// control endpoint's data register.
+extern volatile uint8_t UDFNUML;
+extern volatile uint8_t UDFNUMH;
+extern volatile uint8_t UEDATX;
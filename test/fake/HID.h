@@ -0,0 +1,117 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// A stand-in for the Arduino HID library, with the `getLEDs()` extension from the
+// Keyboardio core. `HID()` is a module on its own endpoint, like the real one.
+
+#pragma once
+
+#include <PluggableUSB.h>
+
+#define HID_GET_REPORT   0x01
+#define HID_GET_IDLE     0x02
+#define HID_GET_PROTOCOL 0x03
+#define HID_SET_REPORT   0x09
+#define HID_SET_IDLE     0x0A
+#define HID_SET_PROTOCOL 0x0B
+
+#define HID_HID_DESCRIPTOR_TYPE    0x21
+#define HID_REPORT_DESCRIPTOR_TYPE 0x22
+
+#define HID_SUBCLASS_NONE           0
+#define HID_SUBCLASS_BOOT_INTERFACE 1
+
+#define HID_PROTOCOL_NONE     0
+#define HID_PROTOCOL_KEYBOARD 1
+#define HID_PROTOCOL_MOUSE    2
+
+#define HID_BOOT_PROTOCOL   0
+#define HID_REPORT_PROTOCOL 1
+
+typedef struct {
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t addr;
+  uint8_t versionL;
+  uint8_t versionH;
+  uint8_t country;
+  uint8_t desctype;
+  uint8_t descLenL;
+  uint8_t descLenH;
+} HIDDescDescriptor;
+
+typedef struct {
+  InterfaceDescriptor hid;
+  HIDDescDescriptor desc;
+  EndpointDescriptor in;
+} HIDDescriptor;
+
+#define D_HIDREPORT(length) \
+  { 9, HID_HID_DESCRIPTOR_TYPE, 0x01, 0x01, 0, 1, HID_REPORT_DESCRIPTOR_TYPE, \
+    lowByte(length), highByte(length) }
+
+class HIDSubDescriptor {
+ public:
+  HIDSubDescriptor *next = NULL;
+  HIDSubDescriptor(const void *d, const uint16_t l) : data(d), length(l) { }
+
+  const void* data;
+  const uint16_t length;
+};
+
+class HID_ : public PluggableUSBModule {
+ public:
+  HID_();
+  int begin() {
+    return 0;
+  }
+  int SendReport(uint8_t id, const void* data, int len);
+  void AppendDescriptor(HIDSubDescriptor* node);
+  uint8_t getLEDs() {
+    return setReportData.leds;
+  }
+
+  // Not in the real library: forget every appended descriptor and the host's state.
+  void reset();
+
+ protected:
+  int getInterface(uint8_t* interfaceCount) override;
+  int getDescriptor(USBSetup& setup) override;
+  bool setup(USBSetup& setup) override;
+
+ private:
+  uint8_t epType[1];
+  HIDSubDescriptor* rootNode;
+  uint16_t descriptorSize;
+  uint8_t protocol;
+  uint8_t idle;
+  struct {
+    uint8_t reportId;
+    uint8_t leds;
+  } setReportData;
+};
+
+HID_& HID();
@@ -0,0 +1,159 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// A stand-in for the Arduino AVR core's USB device API (`USBAPI.h`, `USBCore.h` and
+// `PluggableUSB.h`). The functions are implemented by the fake host in `fake_usb.cpp`.
+
+#pragma once
+
+#include <Arduino.h>
+
+#define TRANSFER_PGM     0x80
+#define TRANSFER_RELEASE 0x40
+#define TRANSFER_ZERO    0x20
+
+#define EP_TYPE_INTERRUPT_IN 0xC1
+
+#define USB_EP_SIZE 64
+
+#define REQUEST_HOSTTODEVICE 0x00
+#define REQUEST_DEVICETOHOST 0x80
+#define REQUEST_STANDARD     0x00
+#define REQUEST_CLASS        0x20
+#define REQUEST_INTERFACE    0x01
+
+#define REQUEST_DEVICETOHOST_STANDARD_INTERFACE \
+  (REQUEST_DEVICETOHOST | REQUEST_STANDARD | REQUEST_INTERFACE)
+#define REQUEST_DEVICETOHOST_CLASS_INTERFACE \
+  (REQUEST_DEVICETOHOST | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_HOSTTODEVICE_CLASS_INTERFACE \
+  (REQUEST_HOSTTODEVICE | REQUEST_CLASS | REQUEST_INTERFACE)
+
+#define GET_DESCRIPTOR 6
+
+#define USB_DEVICE_CLASS_HUMAN_INTERFACE 0x03
+#define USB_ENDPOINT_TYPE_INTERRUPT      0x03
+#define USB_ENDPOINT_IN(addr)            (lowByte((addr) | 0x80))
+
+#define USB_INTERFACE_DESCRIPTOR_TYPE 4
+#define USB_ENDPOINT_DESCRIPTOR_TYPE  5
+
+typedef struct {
+  uint8_t bmRequestType;
+  uint8_t bRequest;
+  uint8_t wValueL;
+  uint8_t wValueH;
+  uint16_t wIndex;
+  uint16_t wLength;
+} USBSetup;
+
+typedef struct {
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t number;
+  uint8_t alternate;
+  uint8_t numEndpoints;
+  uint8_t interfaceClass;
+  uint8_t interfaceSubClass;
+  uint8_t protocol;
+  uint8_t iInterface;
+} InterfaceDescriptor;
+
+typedef struct {
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t addr;
+  uint8_t attr;
+  uint16_t packetSize;
+  uint8_t interval;
+} __attribute__((packed)) EndpointDescriptor;
+
+#define D_INTERFACE(_n, _numEndpoints, _class, _subClass, _protocol) \
+  { 9, USB_INTERFACE_DESCRIPTOR_TYPE, _n, 0, _numEndpoints, \
+    _class, _subClass, _protocol, 0 }
+
+#define D_ENDPOINT(_addr, _attr, _packetSize, _interval) \
+  { 7, USB_ENDPOINT_DESCRIPTOR_TYPE, _addr, _attr, _packetSize, _interval }
+
+class USBDevice_ {
+ public:
+  bool configured();
+  void attach() {}
+  void detach() {}
+};
+extern USBDevice_ USBDevice;
+
+int USB_SendControl(uint8_t flags, const void* data, int length);
+int USB_RecvControl(void* data, int length);
+uint8_t USB_SendSpace(uint8_t endpoint);
+int USB_Send(uint8_t endpoint, const void* data, int length);
+
+class PluggableUSBModule {
+ public:
+  PluggableUSBModule(uint8_t numEps, uint8_t numIfs, uint8_t *epType)
+      : numEndpoints(numEps), numInterfaces(numIfs), endpointType(epType) {}
+
+ protected:
+  virtual bool setup(USBSetup& setup) = 0;
+  virtual int getInterface(uint8_t* interfaceCount) = 0;
+  virtual int getDescriptor(USBSetup& setup) = 0;
+  virtual uint8_t getShortName(char *name) {
+    name[0] = 'A' + pluggedInterface;
+    return 1;
+  }
+
+  uint8_t pluggedInterface;
+  uint8_t pluggedEndpoint;
+
+  const uint8_t numEndpoints;
+  const uint8_t numInterfaces;
+  const uint8_t *endpointType;
+
+  PluggableUSBModule *next = NULL;
+
+  friend class PluggableUSB_;
+};
+
+class PluggableUSB_ {
+ public:
+  PluggableUSB_();
+  bool plug(PluggableUSBModule *node);
+  int getInterface(uint8_t* interfaceCount);
+  int getDescriptor(USBSetup& setup);
+  bool setup(USBSetup& setup);
+  void getShortName(char *iSerialNum);
+
+  // Not in the real core: forget every module (the fake host calls this between tests,
+  // because the tests' dispatchers don't outlive them).
+  void unplugAll();
+
+ private:
+  uint8_t lastIf;
+  uint8_t lastEp;
+  PluggableUSBModule* rootNode;
+};
+
+PluggableUSB_& PluggableUSB();
@@ -0,0 +1,513 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// ----------------------------------------------------------------------------
+// The fake host
+
+namespace fake_usb {
+namespace {
+
+constexpr byte endpoint_count = 16;
+constexpr byte send_timeout_ms = 250;
+
+struct Endpoint {
+  std::vector<byte> bank;
+  bool released{false};
+  size_t packet{0};
+  byte poll_interval{1};
+};
+
+struct Host {
+  unsigned long now{0};
+  bool configured{true};
+  bool polling{true};
+  unsigned long blocked{0};
+  Endpoint endpoints[endpoint_count];
+  std::vector<Packet> packets;
+  std::vector<byte> control_in;
+  std::vector<byte> control_out;
+  size_t control_out_read{0};
+};
+
+Host host;
+
+void updateFrameNumber() {
+  uint16_t frame = (host.now / frame_us) & 0x07FF;
+  UDFNUML = lowByte(frame);
+  UDFNUMH = highByte(frame);
+}
+
+// The start of a frame: collect the banks the host polls in this one.
+void startFrame() {
+  updateFrameNumber();
+  if (!host.polling || !host.configured)
+    return;
+  unsigned long frame = host.now / frame_us;
+  for (Endpoint& endpoint : host.endpoints) {
+    if (!endpoint.released || frame % endpoint.poll_interval != 0)
+      continue;
+    host.packets[endpoint.packet].collected_at = host.now;
+    endpoint.bank.clear();
+    endpoint.released = false;
+  }
+}
+
+} // namespace {
+
+void reset() {
+  host = Host{};
+  updateFrameNumber();
+  UEDATX = 0;
+  HID();
+  PluggableUSB().unplugAll();
+  HID().reset();
+#if HID_STATS
+  // The dispatchers of the last test are gone, too.
+  for (byte source = 0; source < kaleidoglyph::hid::stats::source_count; ++source)
+    kaleidoglyph::hid::stats::unpublish(kaleidoglyph::hid::stats::Source(source));
+#endif
+}
+
+unsigned long now() {
+  return host.now;
+}
+
+uint16_t frameNumber() {
+  return (host.now / frame_us) & 0x07FF;
+}
+
+void advanceMicros(unsigned long us) {
+  unsigned long end = host.now + us;
+  unsigned long next_frame = (host.now / frame_us + 1) * frame_us;
+  while (next_frame <= end) {
+    host.now = next_frame;
+    startFrame();
+    next_frame += frame_us;
+  }
+  host.now = end;
+}
+
+void advanceFrames(unsigned int frames) {
+  if (frames == 0)
+    return;
+  unsigned long next_frame = (host.now / frame_us + 1) * frame_us;
+  advanceMicros(next_frame - host.now + (frames - 1) * frame_us);
+}
+
+void setConfigured(bool configured) {
+  host.configured = configured;
+}
+
+void setHostPolling(bool polling) {
+  host.polling = polling;
+}
+
+void setPollInterval(byte endpoint, byte interval) {
+  host.endpoints[endpoint & 0x0F].poll_interval = interval;
+}
+
+const std::vector<Packet>& packets() {
+  return host.packets;
+}
+
+std::vector<Packet> packetsOn(byte endpoint) {
+  std::vector<Packet> result;
+  for (const Packet& packet : host.packets) {
+    if (packet.endpoint == endpoint)
+      result.push_back(packet);
+  }
+  return result;
+}
+
+void clearPackets() {
+  // Banks still waiting for the host keep their records.
+  std::vector<Packet> waiting;
+  for (Endpoint& endpoint : host.endpoints) {
+    if (endpoint.released) {
+      waiting.push_back(host.packets[endpoint.packet]);
+      endpoint.packet = waiting.size() - 1;
+    }
+  }
+  host.packets.swap(waiting);
+}
+
+unsigned long blockedMicros() {
+  return host.blocked;
+}
+
+std::vector<Interface> enumerate() {
+  host.control_in.clear();
+  byte interface_count{0};
+  PluggableUSB().getInterface(&interface_count);
+
+  std::vector<Interface> interfaces;
+  const std::vector<byte>& data = host.control_in;
+  for (size_t i{0}; i + 1 < data.size(); i += data[i]) {
+    if (data[i] == 0)
+      break;
+    if (data[i + 1] == USB_INTERFACE_DESCRIPTOR_TYPE) {
+      Interface interface{};
+      interface.number = data[i + 2];
+      interface.subclass = data[i + 6];
+      interface.protocol = data[i + 7];
+      interfaces.push_back(interface);
+    } else if (data[i + 1] == HID_HID_DESCRIPTOR_TYPE && !interfaces.empty()) {
+      interfaces.back().report_descriptor_length = data[i + 7] | (data[i + 8] << 8);
+    } else if (data[i + 1] == USB_ENDPOINT_DESCRIPTOR_TYPE && !interfaces.empty()) {
+      interfaces.back().endpoint = data[i + 2] & 0x0F;
+      interfaces.back().poll_interval = data[i + 6];
+      setPollInterval(data[i + 2], data[i + 6]);
+    }
+  }
+  return interfaces;
+}
+
+std::vector<byte> reportDescriptor(byte interface) {
+  USBSetup setup{REQUEST_DEVICETOHOST_STANDARD_INTERFACE, GET_DESCRIPTOR,
+                 0, HID_REPORT_DESCRIPTOR_TYPE, interface, 0xFF};
+  host.control_in.clear();
+  PluggableUSB().getDescriptor(setup);
+  return host.control_in;
+}
+
+bool request(const USBSetup& setup, const std::vector<byte>& data) {
+  host.control_in.clear();
+  host.control_out = data;
+  host.control_out_read = 0;
+  USBSetup copy = setup;
+  return PluggableUSB().setup(copy);
+}
+
+bool setReport(byte interface, byte report_type, byte report_id,
+               const std::vector<byte>& data) {
+  USBSetup setup{REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_REPORT,
+                 report_id, report_type, interface, uint16_t(data.size())};
+  return request(setup, data);
+}
+
+bool getReport(byte interface, byte report_type, byte report_id, uint16_t length) {
+  USBSetup setup{REQUEST_DEVICETOHOST_CLASS_INTERFACE, HID_GET_REPORT,
+                 report_id, report_type, interface, length};
+  return request(setup);
+}
+
+bool setProtocol(byte interface, byte protocol) {
+  USBSetup setup{REQUEST_HOSTTODEVICE_CLASS_INTERFACE, HID_SET_PROTOCOL,
+                 protocol, 0, interface, 0};
+  return request(setup);
+}
+
+const std::vector<byte>& response() {
+  return host.control_in;
+}
+
+} // namespace fake_usb {
+
+// ----------------------------------------------------------------------------
+// Arduino core
+
+volatile uint8_t UDFNUML;
+volatile uint8_t UDFNUMH;
+volatile uint8_t UEDATX;
+
+unsigned long millis() {
+  return fake_usb::now() / 1000;
+}
+
+unsigned long micros() {
+  return fake_usb::now();
+}
+
+void delay(unsigned long ms) {
+  fake_usb::advanceMicros(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  fake_usb::advanceMicros(us);
+}
+
+USBDevice_ USBDevice;
+
+bool USBDevice_::configured() {
+  return fake_usb::host.configured;
+}
+
+int USB_SendControl(uint8_t /*flags*/, const void* data, int length) {
+  const byte* bytes = static_cast<const byte*>(data);
+  std::vector<byte>& control_in = fake_usb::host.control_in;
+  control_in.insert(control_in.end(), bytes, bytes + length);
+  return length;
+}
+
+int USB_RecvControl(void* data, int length) {
+  fake_usb::Host& host = fake_usb::host;
+  size_t available = host.control_out.size() - host.control_out_read;
+  if (size_t(length) > available)
+    length = available;
+  memcpy(data, host.control_out.data() + host.control_out_read, length);
+  host.control_out_read += length;
+  return length;
+}
+
+uint8_t USB_SendSpace(uint8_t endpoint) {
+  const fake_usb::Endpoint& bank = fake_usb::host.endpoints[endpoint & 0x0F];
+  if (!fake_usb::host.configured || bank.released)
+    return 0;
+  return USB_EP_SIZE - bank.bank.size();
+}
+
+int USB_Send(uint8_t endpoint, const void* data, int length) {
+  fake_usb::Host& host = fake_usb::host;
+  if (!host.configured)
+    return -1;
+
+  fake_usb::Endpoint& bank = host.endpoints[endpoint & 0x0F];
+  for (byte timeout{fake_usb::send_timeout_ms}; bank.released; ) {
+    if (--timeout == 0)
+      return -1;
+    unsigned long start = host.now;
+    delay(1);
+    host.blocked += host.now - start;
+  }
+
+  if (bank.bank.size() + length > USB_EP_SIZE) {
+    fprintf(stderr, "USB_Send: %d bytes overflow the endpoint %d bank\n",
+            length, endpoint & 0x0F);
+    abort();
+  }
+  const byte* bytes = static_cast<const byte*>(data);
+  bank.bank.insert(bank.bank.end(), bytes, bytes + length);
+
+  if (endpoint & TRANSFER_RELEASE) {
+    bank.released = true;
+    bank.packet = host.packets.size();
+    host.packets.push_back({byte(endpoint & 0x0F), bank.bank, host.now,
+                            fake_usb::not_collected});
+  }
+  return length;
+}
+
+// ----------------------------------------------------------------------------
+// PluggableUSB
+
+PluggableUSB_::PluggableUSB_() : lastIf(0), lastEp(1), rootNode(NULL) {}
+
+bool PluggableUSB_::plug(PluggableUSBModule *node) {
+  if (lastEp + node->numEndpoints > fake_usb::endpoint_count)
+    return false;
+
+  if (rootNode == NULL) {
+    rootNode = node;
+  } else {
+    PluggableUSBModule *current = rootNode;
+    while (current->next != NULL)
+      current = current->next;
+    current->next = node;
+  }
+
+  node->pluggedInterface = lastIf;
+  node->pluggedEndpoint = lastEp;
+  lastIf += node->numInterfaces;
+  lastEp += node->numEndpoints;
+  return true;
+}
+
+int PluggableUSB_::getInterface(uint8_t* interfaceCount) {
+  int sent = 0;
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    int result = node->getInterface(interfaceCount);
+    if (result < 0)
+      return -1;
+    sent += result;
+  }
+  return sent;
+}
+
+int PluggableUSB_::getDescriptor(USBSetup& setup) {
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    int result = node->getDescriptor(setup);
+    // result > 0 : found and sent
+    // result < 0 : found but error
+    // result = 0 : not found, continue
+    if (result != 0)
+      return result;
+  }
+  return 0;
+}
+
+bool PluggableUSB_::setup(USBSetup& setup) {
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    if (node->setup(setup))
+      return true;
+  }
+  return false;
+}
+
+void PluggableUSB_::getShortName(char *iSerialNum) {
+  for (PluggableUSBModule* node = rootNode; node; node = node->next)
+    iSerialNum += node->getShortName(iSerialNum);
+  *iSerialNum = 0;
+}
+
+void PluggableUSB_::unplugAll() {
+  lastIf = 0;
+  lastEp = 1;
+  rootNode = NULL;
+}
+
+PluggableUSB_& PluggableUSB() {
+  static PluggableUSB_ obj;
+  return obj;
+}
+
+// ----------------------------------------------------------------------------
+// HID
+
+HID_::HID_() : PluggableUSBModule(1, 1, epType) {
+  epType[0] = EP_TYPE_INTERRUPT_IN;
+  reset();
+}
+
+void HID_::reset() {
+  rootNode = NULL;
+  descriptorSize = 0;
+  protocol = HID_REPORT_PROTOCOL;
+  idle = 1;
+  setReportData.reportId = 0;
+  setReportData.leds = 0;
+  next = NULL;
+  PluggableUSB().plug(this);
+}
+
+int HID_::getInterface(uint8_t* interfaceCount) {
+  *interfaceCount += 1;
+  HIDDescriptor hidInterface = {
+    D_INTERFACE(pluggedInterface, 1, USB_DEVICE_CLASS_HUMAN_INTERFACE,
+                HID_SUBCLASS_NONE, HID_PROTOCOL_NONE),
+    D_HIDREPORT(descriptorSize),
+    D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint), USB_ENDPOINT_TYPE_INTERRUPT,
+               USB_EP_SIZE, 0x01)
+  };
+  return USB_SendControl(0, &hidInterface, sizeof(hidInterface));
+}
+
+int HID_::getDescriptor(USBSetup& setup) {
+  if (setup.bmRequestType != REQUEST_DEVICETOHOST_STANDARD_INTERFACE)
+    return 0;
+  if (setup.wValueH != HID_REPORT_DESCRIPTOR_TYPE)
+    return 0;
+  if (setup.wIndex != pluggedInterface)
+    return 0;
+
+  int total = 0;
+  for (HIDSubDescriptor* node = rootNode; node; node = node->next) {
+    int result = USB_SendControl(TRANSFER_PGM, node->data, node->length);
+    if (result < 0)
+      return -1;
+    total += result;
+  }
+  protocol = HID_REPORT_PROTOCOL;
+  return total;
+}
+
+void HID_::AppendDescriptor(HIDSubDescriptor *node) {
+  // Unlike the real one, a node can be appended again after `reset()` (the keyboard's is
+  // static), so it mustn't keep a link to a node from an earlier test.
+  node->next = NULL;
+  if (rootNode == NULL) {
+    rootNode = node;
+  } else {
+    HIDSubDescriptor *current = rootNode;
+    while (current->next)
+      current = current->next;
+    current->next = node;
+  }
+  descriptorSize += node->length;
+}
+
+int HID_::SendReport(uint8_t id, const void* data, int len) {
+  int result = USB_Send(pluggedEndpoint, &id, 1);
+  if (result < 0)
+    return result;
+  int data_result = USB_Send(pluggedEndpoint | TRANSFER_RELEASE, data, len);
+  if (data_result < 0)
+    return data_result;
+  return result + data_result;
+}
+
+bool HID_::setup(USBSetup& setup) {
+  if (pluggedInterface != setup.wIndex)
+    return false;
+
+  uint8_t request = setup.bRequest;
+  uint8_t requestType = setup.bmRequestType;
+
+  if (requestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE) {
+    if (request == HID_GET_REPORT)
+      return true;
+    if (request == HID_GET_PROTOCOL) {
+      UEDATX = protocol;
+      return true;
+    }
+    if (request == HID_GET_IDLE) {
+      UEDATX = idle;
+      return true;
+    }
+  }
+
+  if (requestType == REQUEST_HOSTTODEVICE_CLASS_INTERFACE) {
+    if (request == HID_SET_PROTOCOL) {
+      protocol = setup.wValueL;
+      return true;
+    }
+    if (request == HID_SET_IDLE) {
+      idle = setup.wValueL;
+      return true;
+    }
+    if (request == HID_SET_REPORT) {
+      // The LED report, with or without its report ID.
+      if (setup.wLength == sizeof(setReportData)) {
+        USB_RecvControl(&setReportData, setup.wLength);
+      } else if (setup.wLength == sizeof(setReportData.leds)) {
+        USB_RecvControl(&setReportData.leds, setup.wLength);
+        setReportData.reportId = 0;
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+HID_& HID() {
+  static HID_ obj;
+  return obj;
+}
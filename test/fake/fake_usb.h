@@ -0,0 +1,114 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// The fake USB host behind the stand-in Arduino core. It keeps a simulated clock, and
+// every interrupt endpoint has a single 64-byte bank, like the ATmega32u4's:
+//
+// - `USB_Send()` fills the bank, and `TRANSFER_RELEASE` hands it to the host. If the
+//   bank is still waiting for the host, `USB_Send()` waits for it a millisecond at a time
+//   (advancing the clock), and gives up after 250 ms, as the real core does.
+// - At the start of each frame (every 1000 µs), the host collects the bank of every
+//   endpoint that it polls in that frame, i.e. every `poll_interval` frames.
+//
+// Every released packet is recorded, along with when it was sent and collected. `HID()`
+// is always plugged first, so the shared interface is interface 0, on endpoint 1, and
+// the dedicated dispatchers get the following ones, in the order their `init()` is
+// called. The fake host doesn't reserve any endpoints for CDC, and doesn't enforce the
+// real core's endpoint limit.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PluggableUSB.h>
+#include <HID.h>
+
+#include <vector>
+
+namespace fake_usb {
+
+constexpr unsigned long frame_us = 1000;
+constexpr unsigned long not_collected = ~0UL;
+
+constexpr byte shared_interface = 0;
+constexpr byte shared_endpoint = 1;
+
+struct Packet {
+  byte endpoint;
+  std::vector<byte> data;
+  unsigned long sent_at;
+  unsigned long collected_at;
+
+  bool collected() const {
+    return collected_at != not_collected;
+  }
+};
+
+struct Interface {
+  byte number;
+  byte endpoint;
+  byte subclass;
+  byte protocol;
+  byte poll_interval;
+  uint16_t report_descriptor_length;
+};
+
+// Unplug every module (except `HID()`, which is replugged empty), and restore the host to
+// its initial state: configured and polling, at time zero, with nothing recorded.
+void reset();
+
+// Simulated time. Crossing a frame boundary lets the host poll the endpoints.
+unsigned long now();
+uint16_t frameNumber();
+void advanceMicros(unsigned long us);
+void advanceFrames(unsigned int frames);
+
+// Host behaviour.
+void setConfigured(bool configured);
+void setHostPolling(bool polling);
+void setPollInterval(byte endpoint, byte interval);
+
+// Everything the device has sent, in order.
+const std::vector<Packet>& packets();
+std::vector<Packet> packetsOn(byte endpoint);
+void clearPackets();
+// The time `USB_Send()` has spent waiting for the host to empty a bank.
+unsigned long blockedMicros();
+
+// Enumeration reads every module's interface descriptor, and sets the poll interval of
+// each endpoint from it.
+std::vector<Interface> enumerate();
+std::vector<byte> reportDescriptor(byte interface);
+
+// Control requests to an interface. `response()` holds whatever the device sent back
+// (with `USB_SendControl()`) for the last one.
+bool request(const USBSetup& setup, const std::vector<byte>& data = {});
+bool setReport(byte interface, byte report_type, byte report_id,
+               const std::vector<byte>& data);
+bool getReport(byte interface, byte report_type, byte report_id, uint16_t length);
+bool setProtocol(byte interface, byte protocol);
+const std::vector<byte>& response();
+
+} // namespace fake_usb {
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// The fake host's endpoint timing, which the dispatcher tests and benchmarks rely on.
+
+#include "testing.h"
+#include "fake_usb.h"
+
+TEST(fake_usb, host_collects_a_report_at_the_next_frame) {
+  const byte report[] = {0x01, 0x02};
+  fake_usb::advanceMicros(300);
+  EXPECT_EQ(HID().SendReport(7, report, sizeof(report)), 3);
+
+  EXPECT_EQ(fake_usb::packets().size(), 1u);
+  const fake_usb::Packet& packet = fake_usb::packets()[0];
+  EXPECT_EQ(packet.endpoint, fake_usb::shared_endpoint);
+  EXPECT_BYTES(packet.data, {0x07, 0x01, 0x02});
+  EXPECT_EQ(packet.sent_at, 300ul);
+  EXPECT_FALSE(packet.collected());
+
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(fake_usb::packets()[0].collected_at, 1000ul);
+}
+
+TEST(fake_usb, a_full_bank_blocks_until_the_host_collects_it) {
+  const byte report[] = {0x01};
+  HID().SendReport(7, report, sizeof(report));
+  EXPECT_EQ(USB_SendSpace(fake_usb::shared_endpoint), 0);
+  HID().SendReport(7, report, sizeof(report));
+
+  EXPECT_EQ(fake_usb::now(), 1000ul);
+  EXPECT_EQ(fake_usb::blockedMicros(), 1000ul);
+  EXPECT_EQ(fake_usb::packets()[1].sent_at, 1000ul);
+  EXPECT_EQ(UDFNUML, 1);
+}
+
+TEST(fake_usb, sends_time_out_when_the_host_stops_polling) {
+  const byte report[] = {0x01};
+  HID().SendReport(7, report, sizeof(report));
+  fake_usb::setHostPolling(false);
+  EXPECT_EQ(HID().SendReport(7, report, sizeof(report)), -1);
+  EXPECT_EQ(fake_usb::now(), 249000ul);
+  EXPECT_EQ(fake_usb::packets().size(), 1u);
+}
+
+TEST(fake_usb, nothing_is_sent_unless_configured) {
+  const byte report[] = {0x01};
+  fake_usb::setConfigured(false);
+  EXPECT_FALSE(USBDevice.configured());
+  EXPECT_EQ(HID().SendReport(7, report, sizeof(report)), -1);
+  EXPECT_TRUE(fake_usb::packets().empty());
+}
+
+TEST(fake_usb, endpoints_are_polled_at_their_intervals) {
+  const byte report[] = {0x01};
+  fake_usb::setPollInterval(fake_usb::shared_endpoint, 4);
+  fake_usb::advanceFrames(1);
+  HID().SendReport(7, report, sizeof(report));
+  fake_usb::advanceFrames(2);
+  EXPECT_FALSE(fake_usb::packets()[0].collected());
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(fake_usb::packets()[0].collected_at, 4000ul);
+}
+
+TEST(fake_usb, enumeration_finds_the_shared_interface) {
+  static const byte descriptor[] = {0x05, 0x01, 0xc0};
+  HIDSubDescriptor node(descriptor, sizeof(descriptor));
+  HID().AppendDescriptor(&node);
+
+  std::vector<fake_usb::Interface> interfaces = fake_usb::enumerate();
+  EXPECT_EQ(interfaces.size(), 1u);
+  EXPECT_EQ(interfaces[0].number, fake_usb::shared_interface);
+  EXPECT_EQ(interfaces[0].endpoint, fake_usb::shared_endpoint);
+  EXPECT_EQ(interfaces[0].poll_interval, 1);
+  EXPECT_EQ(interfaces[0].report_descriptor_length, sizeof(descriptor));
+  EXPECT_BYTES(fake_usb::reportDescriptor(fake_usb::shared_interface),
+               {0x05, 0x01, 0xc0});
+}
+
+TEST(fake_usb, the_host_sets_the_shared_led_state) {
+  EXPECT_TRUE(fake_usb::setReport(fake_usb::shared_interface, 2, 0, {0x02}));
+  EXPECT_EQ(HID().getLEDs(), 0x02);
+}
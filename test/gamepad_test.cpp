@@ -0,0 +1,180 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/gamepad.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+constexpr byte gamepad_endpoint = HID_GAMEPAD_DEDICATED_ENDPOINT
+                                  ? fake_usb::shared_endpoint + 1
+                                  : fake_usb::shared_endpoint;
+
+// The gamepad reports the host has received, without their report IDs.
+std::vector<std::vector<byte>> hostReports() {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(gamepad_endpoint)) {
+    if (HID_GAMEPAD_DEDICATED_ENDPOINT)
+      reports.push_back(packet.data);
+    else if (packet.data[0] == HID_REPORTID_GAMEPAD)
+      reports.emplace_back(packet.data.begin() + 1, packet.data.end());
+  }
+  return reports;
+}
+
+// Start the dispatcher, and let the host collect its initial empty report.
+void start(gamepad::Dispatcher& gamepad) {
+  gamepad.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+// The bytes the host gets for a report.
+std::vector<byte> sentBytes(const gamepad::Report& report) {
+  fake_usb::reset();
+  gamepad::Dispatcher gamepad;
+  start(gamepad);
+  gamepad.sendReport(report);
+  fake_usb::advanceFrames(1);
+  std::vector<std::vector<byte>> reports = hostReports();
+  return reports.empty() ? std::vector<byte>() : reports.back();
+}
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Report layout
+
+TEST(gamepad, report_is_packed_into_fifteen_bytes) {
+  EXPECT_EQ(sizeof(gamepad::Report), 15u);
+
+  gamepad::Report report;
+  report.pressButton(1);
+  report.pressButton(10);
+  report.pressButton(32);
+  report.setXAxis(0x1234);
+  report.setYAxis(-2);
+  report.setRxAxis(-32768);
+  report.setRyAxis(32767);
+  report.setZAxis(-128);
+  report.setRzAxis(127);
+  report.setDPad1(gamepad::DPad::up_right);
+  report.setDPad2(gamepad::DPad::up_left);
+
+  // Buttons 1-32 from the low bit of the first byte, four little-endian 16-bit axes (X,
+  // Y, Rx, Ry), the two 8-bit axes (Z, Rz), then d-pad 1 in the low nibble and d-pad 2
+  // in the high one.
+  EXPECT_BYTES(sentBytes(report), {0x01, 0x02, 0x00, 0x80,
+                                   0x34, 0x12, 0xFE, 0xFF, 0x00, 0x80, 0xFF, 0x7F,
+                                   0x80, 0x7F,
+                                   0x82});
+}
+
+TEST(gamepad, buttons_outside_the_range_are_ignored) {
+  gamepad::Report report;
+  report.pressButton(0);
+  report.pressButton(33);
+  EXPECT_TRUE(report == gamepad::Report());
+
+  report.setButtons(0x80000001);
+  report.releaseButton(0);
+  report.releaseButton(33);
+  report.releaseButton(32);
+  EXPECT_BYTES(sentBytes(report), {0x01, 0x00, 0x00, 0x00,
+                                   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                   0x00, 0x00,
+                                   0x00});
+}
+
+TEST(gamepad, dpads_are_set_independently) {
+  gamepad::Report report;
+  report.setDPad2(gamepad::DPad::left);
+  report.setDPad1(gamepad::DPad::down);
+  report.setDPad2(gamepad::DPad::centered);
+  std::vector<byte> bytes = sentBytes(report);
+  EXPECT_EQ(bytes.size(), 15u);
+  EXPECT_EQ(bytes[14], byte(gamepad::DPad::down));
+}
+
+// ----------------------------------------------------------------------------
+// Duplicate suppression
+
+TEST(gamepad, an_identical_report_is_not_sent_again) {
+  gamepad::Dispatcher gamepad;
+  start(gamepad);
+
+  gamepad::Report report;
+  report.setXAxis(100);
+  EXPECT_EQ(gamepad.sendReport(report), SendStatus::sent);
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(gamepad.sendReport(report), SendStatus::sent);
+  EXPECT_EQ(gamepad.trySendReport(report), SendStatus::sent);
+  EXPECT_FALSE(gamepad.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_FALSE(gamepad.poll());
+  EXPECT_EQ(hostReports().size(), 1u);
+
+  // An empty report is identical to the one `init()` sent.
+  fake_usb::clearPackets();
+  EXPECT_EQ(gamepad.sendReport(gamepad::Report()), SendStatus::sent);
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(hostReports().size(), 1u);
+}
+
+TEST(gamepad, only_the_latest_waiting_report_is_sent) {
+  gamepad::Dispatcher gamepad;
+  start(gamepad);
+
+  gamepad::Report report;
+  for (int16_t x : {10, 20, 30}) {
+    report.setXAxis(x);
+    EXPECT_EQ(gamepad.trySendReport(report), SendStatus::queued);
+  }
+  fake_usb::advanceFrames(1);
+  EXPECT_TRUE(gamepad.poll());
+  fake_usb::advanceFrames(1);
+
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_EQ(reports[0][4], 30);
+}
+
+TEST(gamepad, a_waiting_report_that_returns_to_the_last_one_sent_is_dropped) {
+  gamepad::Dispatcher gamepad;
+  start(gamepad);
+
+  gamepad::Report report;
+  report.pressButton(3);
+  EXPECT_EQ(gamepad.trySendReport(report), SendStatus::queued);
+  report.releaseButton(3);
+  EXPECT_EQ(gamepad.trySendReport(report), SendStatus::sent);
+  EXPECT_FALSE(gamepad.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_FALSE(gamepad.poll());
+  EXPECT_EQ(hostReports().size(), 0u);
+}
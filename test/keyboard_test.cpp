@@ -0,0 +1,640 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/keyboard.h"
+#include "kaleidoglyph/hid/report_queue.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+// The keyboard's boot interface is the first one plugged after `HID()`'s. Without a
+// dedicated endpoint, NKRO reports go through `HID()` instead.
+constexpr byte keyboard_interface = fake_usb::shared_interface + 1;
+constexpr byte keyboard_endpoint = fake_usb::shared_endpoint + 1;
+
+// The bytes of an NKRO report with the given modifiers and keys.
+std::vector<byte> nkroReport(byte modifiers, std::initializer_list<byte> keycodes) {
+  std::vector<byte> report(keyboard::Report::size, 0);
+  report[0] = modifiers;
+  for (byte keycode : keycodes)
+    report[1 + (keycode / 8) - (keyboard::Report::first_key / 8)] |= 1 << (keycode % 8);
+  return report;
+}
+
+keyboard::Report report(byte modifiers, std::initializer_list<byte> keycodes) {
+  keyboard::Report report;
+  report.setModifiers(modifiers);
+  for (byte keycode : keycodes)
+    report.addKeycode(keycode);
+  return report;
+}
+
+// The NKRO reports the host has received, without their report IDs.
+std::vector<std::vector<byte>> hostReports() {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packets()) {
+#if HID_KEYBOARD_DEDICATED_ENDPOINT
+    if (packet.endpoint == keyboard_endpoint)
+      reports.push_back(packet.data);
+#else
+    if (packet.endpoint == fake_usb::shared_endpoint &&
+        packet.data[0] == HID_REPORTID_NKRO_KEYBOARD)
+      reports.emplace_back(packet.data.begin() + 1, packet.data.end());
+#endif
+  }
+  return reports;
+}
+
+// Start the dispatcher, and let the host collect its initial empty report.
+void start(keyboard::Dispatcher& keyboard) {
+  keyboard.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+// Poll once per frame until the queue is empty, and the host has collected everything.
+void drain(keyboard::Dispatcher& keyboard) {
+  while (keyboard.hasPendingReports()) {
+    fake_usb::advanceFrames(1);
+    keyboard.poll();
+  }
+  fake_usb::advanceFrames(1);
+}
+
+// The reports the host receives for an update from `before` to `after`, with the given
+// modifier ordering. Each call starts over with a reset host.
+std::vector<std::vector<byte>> updateReports(keyboard::ModifierOrdering ordering,
+                                             const keyboard::Report& before,
+                                             const keyboard::Report& after) {
+  fake_usb::reset();
+  keyboard::Dispatcher keyboard;
+  keyboard.setModifierOrdering(ordering);
+  start(keyboard);
+  keyboard.sendReport(before);
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  keyboard.trySendReport(after);
+  drain(keyboard);
+  return hostReports();
+}
+
+constexpr byte ctrl = 0x01;
+constexpr byte shift = 0x02;
+constexpr byte key_a = HID_KEYBOARD_A_AND_A;
+constexpr byte key_b = HID_KEYBOARD_B_AND_B;
+constexpr byte key_c = HID_KEYBOARD_C_AND_C;
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Report queue
+
+TEST(report_queue, pop_on_an_empty_queue_does_nothing) {
+  ReportQueue<int, 3> queue;
+  queue.pop();
+  EXPECT_TRUE(queue.isEmpty());
+  EXPECT_EQ(queue.available(), 3);
+  queue.push(7);
+  EXPECT_EQ(queue.front(), 7);
+  EXPECT_EQ(queue.length(), 1);
+}
+
+TEST(report_queue, keeps_its_order_across_the_wraparound) {
+  ReportQueue<int, 3> queue;
+  for (int i{0}; i < 7; ++i) {
+    queue.push(i);
+    if (queue.available() == 0)
+      queue.pop();
+  }
+  EXPECT_EQ(queue.length(), 2);
+  EXPECT_EQ(queue.front(), 5);
+  queue.pop();
+  EXPECT_EQ(queue.front(), 6);
+}
+
+// ----------------------------------------------------------------------------
+// Queued sending
+
+TEST(keyboard, poll_sends_a_queued_report) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+
+  EXPECT_EQ(keyboard.trySendReport(report(0, {key_a})), SendStatus::queued);
+  EXPECT_TRUE(keyboard.hasPendingReports());
+  EXPECT_TRUE(hostReports().empty());
+
+  drain(keyboard);
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], (nkroReport(0, {key_a})));
+  EXPECT_FALSE(keyboard.hasPendingReports());
+}
+
+TEST(keyboard, sends_one_report_per_polling_interval_in_order) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+
+  keyboard.trySendReport(report(0, {key_a}));
+  keyboard.trySendReport(report(0, {key_a, key_b}));
+  keyboard.trySendReport(report(0, {key_b}));
+  drain(keyboard);
+
+  std::vector<fake_usb::Packet> packets = fake_usb::packets();
+  EXPECT_EQ(packets.size(), 3u);
+  for (size_t i{1}; i < packets.size(); ++i)
+    EXPECT_EQ(packets[i].collected_at - packets[i - 1].collected_at,
+              keyboard::Dispatcher::poll_interval * fake_usb::frame_us);
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_BYTES(reports[0], (nkroReport(0, {key_a})));
+  EXPECT_BYTES(reports[1], (nkroReport(0, {key_a, key_b})));
+  EXPECT_BYTES(reports[2], (nkroReport(0, {key_b})));
+}
+
+// The keyboard's own interface (the boot interface, or the dedicated one) asks the host
+// to poll it every `HID_KEYBOARD_POLL_INTERVAL` ms; the shared interface always uses 1 ms.
+TEST(keyboard, endpoint_descriptor_has_the_polling_interval) {
+  keyboard::Dispatcher keyboard;
+  keyboard.init();
+
+  std::vector<fake_usb::Interface> interfaces = fake_usb::enumerate();
+  EXPECT_EQ(interfaces.size(), 2u);
+  EXPECT_EQ(interfaces[0].number, fake_usb::shared_interface);
+  EXPECT_EQ(interfaces[0].poll_interval, 1);
+  EXPECT_EQ(interfaces[1].number, keyboard_interface);
+  EXPECT_EQ(interfaces[1].endpoint, keyboard_endpoint);
+  EXPECT_EQ(interfaces[1].poll_interval, HID_KEYBOARD_POLL_INTERVAL);
+}
+
+// Releasing shift and B while pressing ctrl and A takes three reports: the release, the
+// modifier change, and the press. That's the most a single update can need.
+TEST(keyboard, a_three_report_update_is_queued_whole) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  keyboard.sendReport(report(shift, {key_b}));
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  EXPECT_EQ(keyboard.trySendReport(report(ctrl, {key_a})), SendStatus::queued);
+  drain(keyboard);
+
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 3u);
+  EXPECT_BYTES(reports[0], (nkroReport(shift, {})));
+  EXPECT_BYTES(reports[1], (nkroReport(ctrl, {})));
+  EXPECT_BYTES(reports[2], (nkroReport(ctrl, {key_a})));
+}
+
+// If there isn't room for all three, nothing is queued, and the same report can be tried
+// again later.
+TEST(keyboard, an_update_that_does_not_fit_changes_nothing) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  keyboard.sendReport(report(shift, {key_b}));
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  // Leave two free slots.
+  for (byte i{0}; i < HID_KEYBOARD_REPORT_QUEUE_LENGTH - 2; ++i) {
+    keyboard.trySendReport((i % 2 == 0) ? report(shift, {key_b, key_c})
+                                        : report(shift, {key_b}));
+  }
+  keyboard::Report update = report(ctrl, {key_a});
+  EXPECT_EQ(keyboard.trySendReport(update), SendStatus::host_busy);
+
+  drain(keyboard);
+  EXPECT_EQ(hostReports().size(), size_t(HID_KEYBOARD_REPORT_QUEUE_LENGTH - 2));
+  fake_usb::clearPackets();
+
+  EXPECT_EQ(keyboard.trySendReport(update), SendStatus::queued);
+  drain(keyboard);
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 3u);
+  EXPECT_BYTES(reports.back(), (nkroReport(ctrl, {key_a})));
+}
+
+// ----------------------------------------------------------------------------
+// Blocking sending
+
+// With the queue full, the blocking `sendReport()` has to send queued reports to make
+// room, and then send the rest. It must never send from an empty queue.
+TEST(keyboard, blocking_send_with_a_full_queue_sends_everything) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  keyboard.sendReport(report(shift, {key_b}));
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  for (byte i{0}; i < HID_KEYBOARD_REPORT_QUEUE_LENGTH; ++i) {
+    keyboard.trySendReport((i % 2 == 0) ? report(shift, {key_b, key_c})
+                                        : report(shift, {key_b}));
+  }
+  EXPECT_EQ(keyboard.sendReport(report(ctrl, {key_a})), SendStatus::sent);
+  EXPECT_FALSE(keyboard.hasPendingReports());
+
+  fake_usb::advanceFrames(1);
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), size_t(HID_KEYBOARD_REPORT_QUEUE_LENGTH + 3));
+  EXPECT_BYTES(reports[HID_KEYBOARD_REPORT_QUEUE_LENGTH], (nkroReport(shift, {})));
+  EXPECT_BYTES(reports.back(), (nkroReport(ctrl, {key_a})));
+}
+
+TEST(keyboard, blocking_send_of_an_unchanged_report_sends_nothing) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  keyboard.sendReport(report(0, {key_a}));
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  EXPECT_EQ(keyboard.sendReport(report(0, {key_a})), SendStatus::sent);
+  EXPECT_TRUE(fake_usb::packets().empty());
+}
+
+// ----------------------------------------------------------------------------
+// Host state
+
+TEST(keyboard, nothing_is_queued_without_a_host) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  fake_usb::setConfigured(false);
+
+  EXPECT_EQ(keyboard.trySendReport(report(0, {key_a})), SendStatus::host_absent);
+  EXPECT_EQ(keyboard.sendReport(report(0, {key_a})), SendStatus::host_absent);
+  EXPECT_FALSE(keyboard.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_TRUE(fake_usb::packets().empty());
+}
+
+// Reports queued for a host that goes away are dropped, rather than sent to the next one.
+TEST(keyboard, queued_reports_are_dropped_when_the_host_goes_away) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  keyboard.sendReport(report(shift, {key_b}));
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  EXPECT_EQ(keyboard.trySendReport(report(ctrl, {key_a})), SendStatus::queued);
+  fake_usb::setConfigured(false);
+  fake_usb::advanceFrames(1);
+  keyboard.poll();
+  EXPECT_FALSE(keyboard.hasPendingReports());
+
+  fake_usb::setConfigured(true);
+  drain(keyboard);
+  EXPECT_TRUE(hostReports().empty());
+}
+
+// A host that stops collecting reports makes the blocking send give up, leaving the rest
+// of the update queued for `poll()`.
+TEST(keyboard, blocking_send_to_a_busy_host_leaves_the_update_queued) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  keyboard.sendReport(report(shift, {key_b}));
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+
+  fake_usb::setHostPolling(false);
+  EXPECT_EQ(keyboard.sendReport(report(ctrl, {key_a})), SendStatus::queued);
+  EXPECT_TRUE(keyboard.hasPendingReports());
+
+  fake_usb::setHostPolling(true);
+  drain(keyboard);
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_FALSE(reports.empty());
+  EXPECT_BYTES(reports.back(), (nkroReport(ctrl, {key_a})));
+}
+
+// ----------------------------------------------------------------------------
+// Modifier ordering
+
+TEST(keyboard, strict_ordering_sends_releases_then_modifiers_then_presses) {
+  std::vector<std::vector<byte>> reports =
+    updateReports(keyboard::ModifierOrdering::strict,
+                  report(shift, {key_b}), report(ctrl, {key_a}));
+  EXPECT_EQ(reports.size(), 3u);
+  EXPECT_BYTES(reports[0], (nkroReport(shift, {})));
+  EXPECT_BYTES(reports[1], (nkroReport(ctrl, {})));
+  EXPECT_BYTES(reports[2], (nkroReport(ctrl, {key_a})));
+}
+
+TEST(keyboard, two_phase_ordering_sends_releases_with_the_modifiers) {
+  std::vector<std::vector<byte>> reports =
+    updateReports(keyboard::ModifierOrdering::two_phase,
+                  report(shift, {key_b}), report(ctrl, {key_a}));
+  EXPECT_EQ(reports.size(), 2u);
+  EXPECT_BYTES(reports[0], (nkroReport(ctrl, {})));
+  EXPECT_BYTES(reports[1], (nkroReport(ctrl, {key_a})));
+}
+
+TEST(keyboard, unordered_sends_every_update_in_one_report) {
+  std::vector<std::vector<byte>> reports =
+    updateReports(keyboard::ModifierOrdering::unordered,
+                  report(shift, {key_b}), report(ctrl, {key_a}));
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], (nkroReport(ctrl, {key_a})));
+}
+
+// Without a plain key release, strict and two-phase ordering are the same: the new
+// modifier goes first, then the key it modifies.
+TEST(keyboard, a_new_modifier_goes_before_the_key_it_modifies) {
+  for (keyboard::ModifierOrdering ordering : {keyboard::ModifierOrdering::strict,
+                                              keyboard::ModifierOrdering::two_phase}) {
+    std::vector<std::vector<byte>> reports =
+      updateReports(ordering, report(0, {key_b}), report(shift, {key_b, key_a}));
+    EXPECT_EQ(reports.size(), 2u);
+    EXPECT_BYTES(reports[0], (nkroReport(shift, {key_b})));
+    EXPECT_BYTES(reports[1], (nkroReport(shift, {key_a, key_b})));
+  }
+}
+
+TEST(keyboard, updates_without_modifier_changes_are_never_split) {
+  for (keyboard::ModifierOrdering ordering : {keyboard::ModifierOrdering::strict,
+                                              keyboard::ModifierOrdering::two_phase,
+                                              keyboard::ModifierOrdering::unordered}) {
+    std::vector<std::vector<byte>> reports =
+      updateReports(ordering, report(shift, {key_b}), report(shift, {key_a, key_c}));
+    EXPECT_EQ(reports.size(), 1u);
+    EXPECT_BYTES(reports[0], (nkroReport(shift, {key_a, key_c})));
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Boot protocol
+
+namespace {
+
+constexpr byte key_d = HID_KEYBOARD_D_AND_D;
+constexpr byte key_e = HID_KEYBOARD_E_AND_E;
+constexpr byte key_f = HID_KEYBOARD_F_AND_F;
+constexpr byte key_g = HID_KEYBOARD_G_AND_G;
+constexpr byte key_h = HID_KEYBOARD_H_AND_H;
+
+// A boot report: the modifiers, a reserved byte, and six key slots.
+std::vector<byte> bootReport(byte modifiers, std::initializer_list<byte> keycodes) {
+  std::vector<byte> report(8, 0);
+  report[0] = modifiers;
+  byte slot{2};
+  for (byte keycode : keycodes)
+    report[slot++] = keycode;
+  return report;
+}
+
+// Everything the host has received from the keyboard's own endpoint, which only carries
+// boot reports once the dispatcher has switched to boot protocol.
+std::vector<std::vector<byte>> hostBootReports() {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(keyboard_endpoint))
+    reports.push_back(packet.data);
+  return reports;
+}
+
+void startInBootProtocol(keyboard::Dispatcher& keyboard) {
+  start(keyboard);
+  keyboard.toggleProtocol();
+}
+
+// Press the keys one at a time, a report each, and let the host collect them.
+void pressInTurn(keyboard::Dispatcher& keyboard, keyboard::Report& report,
+                 std::initializer_list<byte> keycodes) {
+  for (byte keycode : keycodes) {
+    report.addKeycode(keycode);
+    keyboard.sendReport(report);
+  }
+  fake_usb::advanceFrames(1);
+}
+
+} // namespace {
+
+// Keys take the boot slots in the order they were pressed, not in keycode order, and a
+// released key's slot is closed up.
+TEST(keyboard, boot_slots_keep_the_press_order) {
+  keyboard::Dispatcher keyboard;
+  startInBootProtocol(keyboard);
+  keyboard::Report keys;
+
+  pressInTurn(keyboard, keys, {key_c, key_a, key_b});
+  std::vector<std::vector<byte>> reports = hostBootReports();
+  EXPECT_EQ(reports.size(), 3u);
+  EXPECT_BYTES(reports[0], (bootReport(0, {key_c})));
+  EXPECT_BYTES(reports[1], (bootReport(0, {key_c, key_a})));
+  EXPECT_BYTES(reports[2], (bootReport(0, {key_c, key_a, key_b})));
+
+  keys.removeKeycode(key_a);
+  keyboard.sendReport(keys);
+  fake_usb::advanceFrames(1);
+  EXPECT_BYTES(hostBootReports().back(), (bootReport(0, {key_c, key_b})));
+}
+
+// A seventh key doesn't fit, so the host isn't sent anything for it; when one of the
+// first six is released, it takes the free slot.
+TEST(keyboard, a_seventh_key_fills_the_slot_of_a_released_key) {
+  keyboard::Dispatcher keyboard;
+  startInBootProtocol(keyboard);
+  keyboard::Report keys;
+
+  pressInTurn(keyboard, keys, {key_a, key_b, key_c, key_d, key_e, key_f, key_g});
+  std::vector<std::vector<byte>> reports = hostBootReports();
+  EXPECT_EQ(reports.size(), 6u);
+  EXPECT_BYTES(reports.back(), (bootReport(0, {key_a, key_b, key_c, key_d, key_e, key_f})));
+  fake_usb::clearPackets();
+
+  keys.removeKeycode(key_b);
+  keyboard.sendReport(keys);
+  fake_usb::advanceFrames(1);
+  reports = hostBootReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], (bootReport(0, {key_a, key_c, key_d, key_e, key_f, key_g})));
+}
+
+// In boot protocol, changes to the keys beyond the sixth are invisible to the host, so
+// they aren't sent.
+TEST(keyboard, boot_protocol_skips_changes_beyond_the_sixth_key) {
+  keyboard::Dispatcher keyboard;
+  startInBootProtocol(keyboard);
+  keyboard::Report keys;
+  pressInTurn(keyboard, keys, {key_a, key_b, key_c, key_d, key_e, key_f, key_g});
+  fake_usb::clearPackets();
+
+  keys.addKeycode(key_h);
+  EXPECT_EQ(keyboard.trySendReport(keys), SendStatus::sent);
+  keys.removeKeycode(key_g);
+  EXPECT_EQ(keyboard.trySendReport(keys), SendStatus::sent);
+  EXPECT_FALSE(keyboard.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_TRUE(fake_usb::packets().empty());
+}
+
+// An intermediate report that only releases an overflow key looks the same to a boot
+// protocol host as the one before it, so it's dropped from the queue instead of sent.
+TEST(keyboard, boot_protocol_drops_queued_reports_the_host_would_not_notice) {
+  keyboard::Dispatcher keyboard;
+  keyboard.setModifierOrdering(keyboard::ModifierOrdering::strict);
+  startInBootProtocol(keyboard);
+  keyboard::Report keys;
+  keys.setModifiers(shift);
+  pressInTurn(keyboard, keys, {key_a, key_b, key_c, key_d, key_e, key_f, key_g});
+  fake_usb::clearPackets();
+
+  // Releasing shift and a plain key at once would take two reports: the plain release
+  // first, then the modifier change.
+  keys.setModifiers(0);
+  keys.removeKeycode(key_g);
+  EXPECT_EQ(keyboard.trySendReport(keys), SendStatus::queued);
+  drain(keyboard);
+
+  std::vector<std::vector<byte>> reports = hostBootReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], (bootReport(0, {key_a, key_b, key_c, key_d, key_e, key_f})));
+}
+
+// Padding bits set in a bulk update (by default, the bits for NO_EVENT and the three
+// error codes) aren't keys: they must not be sent, or take a boot slot.
+TEST(keyboard, apply_diff_ignores_the_padding_bits) {
+  typedef keyboard::Report Report;
+  constexpr byte first_byte_mask = byte(0xFF << Report::leading_padding_bits);
+  constexpr byte last_byte_mask = byte(0xFF >> Report::trailing_padding_bits);
+  Report::Bitmap presses = {}, releases = {};
+
+  // An update of nothing but padding changes nothing.
+  Report keys;
+  presses[1] = byte(~first_byte_mask);
+  presses[Report::size - 1] = byte(~last_byte_mask);
+  EXPECT_FALSE(keys.applyDiff(presses, releases));
+  EXPECT_TRUE(keys == Report());
+
+  // Every bit of the bitmap's first and last bytes, only some of which are keys.
+  presses[1] = 0xFF;
+  presses[Report::size - 1] = 0xFF;
+  EXPECT_TRUE(keys.applyDiff(presses, releases));
+
+  std::vector<byte> expected(Report::size, 0);
+  expected[1] = 0xFF;
+  expected[Report::size - 1] = 0xFF;
+  expected[1] &= first_byte_mask;
+  expected[Report::size - 1] &= last_byte_mask;
+  std::vector<byte> expected_boot(8, 0);
+  byte slot{2};
+  for (byte keycode{Report::first_key}; keycode <= Report::last_key && slot < 8; ++keycode) {
+    if (keys.readKeycode(keycode))
+      expected_boot[slot++] = keycode;
+  }
+
+  keyboard::Dispatcher keyboard;
+  startInBootProtocol(keyboard);
+  keyboard.sendReport(keys);
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(hostBootReports().size(), 1u);
+  EXPECT_BYTES(hostBootReports().back(), (expected_boot));
+
+  keyboard.toggleProtocol();
+  keyboard.sendReport(Report());
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+  keyboard.sendReport(keys);
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(hostReports().size(), 1u);
+  EXPECT_BYTES(hostReports().back(), (expected));
+}
+
+// ----------------------------------------------------------------------------
+// LED state
+
+namespace {
+
+// The host sends NKRO LED reports to the interface that NKRO reports come from, and boot
+// protocol ones to the keyboard's own interface (which are the same with a dedicated
+// endpoint).
+void setNkroLeds(byte leds) {
+  if (HID_KEYBOARD_DEDICATED_ENDPOINT) {
+    fake_usb::setReport(keyboard_interface, HID_REPORT_TYPE_OUTPUT, 0, {leds});
+  } else {
+    fake_usb::setReport(fake_usb::shared_interface, HID_REPORT_TYPE_OUTPUT,
+                        HID_REPORTID_NKRO_KEYBOARD, {leds});
+  }
+}
+
+void setBootLeds(byte leds) {
+  fake_usb::setReport(keyboard_interface, HID_REPORT_TYPE_OUTPUT, 0, {leds});
+}
+
+std::vector<byte> led_callbacks;
+void recordLedState(byte leds) {
+  led_callbacks.push_back(leds);
+}
+
+} // namespace {
+
+TEST(keyboard, led_reports_set_the_state_and_report_each_change_once) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  EXPECT_EQ(keyboard.getLedState(), 0);
+  EXPECT_FALSE(keyboard.ledStateChanged());
+
+  setBootLeds(0x01);
+  EXPECT_EQ(keyboard.getLedState(), 0x01);
+  EXPECT_TRUE(keyboard.ledStateChanged());
+  EXPECT_FALSE(keyboard.ledStateChanged());
+
+  setNkroLeds(0x03);
+  EXPECT_EQ(keyboard.getLedState(), 0x03);
+  EXPECT_TRUE(keyboard.ledStateChanged());
+  EXPECT_FALSE(keyboard.ledStateChanged());
+
+  // The same state again isn't a change.
+  setBootLeds(0x03);
+  EXPECT_FALSE(keyboard.ledStateChanged());
+}
+
+TEST(keyboard, led_state_can_be_read_through_a_const_reference) {
+  keyboard::Dispatcher keyboard;
+  start(keyboard);
+  const keyboard::Dispatcher& view = keyboard;
+
+  setNkroLeds(0x02);
+  // Reading the state picks up the change, and it's still reported once.
+  EXPECT_EQ(view.getLedState(), 0x02);
+  EXPECT_TRUE(keyboard.ledStateChanged());
+  EXPECT_EQ(view.getLedState(), 0x02);
+  EXPECT_FALSE(keyboard.ledStateChanged());
+}
+
+TEST(keyboard, poll_calls_the_led_callback_once_per_change) {
+  led_callbacks.clear();
+  keyboard::Dispatcher keyboard;
+  keyboard.setLedStateCallback(recordLedState);
+  start(keyboard);
+
+  setBootLeds(0x02);
+  EXPECT_TRUE(led_callbacks.empty());
+  keyboard.poll();
+  keyboard.poll();
+  setNkroLeds(0x06);
+  fake_usb::advanceFrames(1);
+  keyboard.poll();
+  EXPECT_BYTES(led_callbacks, {0x02, 0x06});
+}
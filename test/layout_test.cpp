@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+
+#include "kaleidoglyph/hid/layout.h"
+
+using namespace kaleidoglyph::hid::layout;
+
+// Check a character's keystroke in the US layout.
+#define EXPECT_KEYSTROKE(c, expected_keycode, expected_modifiers)       \
+  do {                                                                  \
+    Keystroke keystroke = Us::lookup(c);                                \
+    EXPECT_EQ(keystroke.keycode, expected_keycode);                     \
+    EXPECT_EQ(keystroke.modifiers, expected_modifiers);                 \
+  } while (0)
+
+namespace {
+
+typedef Table<UsQwerty> Us;
+
+constexpr byte shift = shift_modifier;
+
+// A layout with AltGr, and a character on two keys: `x` is typed with the second key,
+// even though it's also the first key's shifted character.
+struct TestLayout {
+  static constexpr byte key_count = 2;
+  static constexpr char plain(byte i) {
+    return "ax"[i];
+  }
+  static constexpr char shifted(byte i) {
+    return "xX"[i];
+  }
+  static constexpr char altgr(byte i) {
+    return "@" "\0"[i];
+  }
+};
+
+} // namespace {
+
+TEST(layout, letters) {
+  for (byte i{0}; i < 26; ++i) {
+    EXPECT_KEYSTROKE(char('a' + i), HID_KEYBOARD_A_AND_A + i, 0);
+    EXPECT_KEYSTROKE(char('A' + i), HID_KEYBOARD_A_AND_A + i, shift);
+  }
+}
+
+TEST(layout, digits_and_symbols) {
+  EXPECT_KEYSTROKE('1', HID_KEYBOARD_1_AND_EXCLAMATION_POINT, 0);
+  EXPECT_KEYSTROKE('!', HID_KEYBOARD_1_AND_EXCLAMATION_POINT, shift);
+  EXPECT_KEYSTROKE('0', HID_KEYBOARD_0_AND_RIGHT_PAREN, 0);
+  EXPECT_KEYSTROKE(')', HID_KEYBOARD_0_AND_RIGHT_PAREN, shift);
+  EXPECT_KEYSTROKE('\\', HID_KEYBOARD_BACKSLASH_AND_PIPE, 0);
+  EXPECT_KEYSTROKE('|', HID_KEYBOARD_BACKSLASH_AND_PIPE, shift);
+  EXPECT_KEYSTROKE('\'', HID_KEYBOARD_QUOTE_AND_DOUBLEQUOTE, 0);
+  EXPECT_KEYSTROKE('"', HID_KEYBOARD_QUOTE_AND_DOUBLEQUOTE, shift);
+  EXPECT_KEYSTROKE('`', HID_KEYBOARD_GRAVE_ACCENT_AND_TILDE, 0);
+  EXPECT_KEYSTROKE('~', HID_KEYBOARD_GRAVE_ACCENT_AND_TILDE, shift);
+  EXPECT_KEYSTROKE('/', HID_KEYBOARD_SLASH_AND_QUESTION_MARK, 0);
+  EXPECT_KEYSTROKE('?', HID_KEYBOARD_SLASH_AND_QUESTION_MARK, shift);
+}
+
+TEST(layout, whitespace_and_control_characters) {
+  EXPECT_KEYSTROKE('\b', HID_KEYBOARD_DELETE, 0);
+  EXPECT_KEYSTROKE('\t', HID_KEYBOARD_TAB, 0);
+  EXPECT_KEYSTROKE('\n', HID_KEYBOARD_ENTER, 0);
+  EXPECT_KEYSTROKE(' ', HID_KEYBOARD_SPACEBAR, 0);
+}
+
+TEST(layout, every_printable_character_is_typeable) {
+  for (char c{' '}; c <= '~'; ++c) {
+    Keystroke keystroke = Us::lookup(c);
+    EXPECT_TRUE(keystroke.keycode >= HID_KEYBOARD_A_AND_A);
+    EXPECT_TRUE(keystroke.keycode <= HID_KEYBOARD_SLASH_AND_QUESTION_MARK);
+    EXPECT_TRUE(keystroke.modifiers == 0 || keystroke.modifiers == shift);
+  }
+}
+
+TEST(layout, unmapped_characters_look_up_as_nothing) {
+  for (int c : {0x00, 0x01, 0x07, 0x0d, 0x1b, 0x7f, 0x80, 0xc3, 0xff}) {
+    Keystroke keystroke = Us::lookup(char(c));
+    EXPECT_EQ(keystroke.keycode, 0);
+    EXPECT_EQ(keystroke.modifiers, 0);
+  }
+}
+
+TEST(layout, plain_keys_are_preferred_then_shift_then_altgr) {
+  typedef Table<TestLayout> Test;
+  EXPECT_EQ(Test::lookup('a').keycode, HID_KEYBOARD_A_AND_A);
+  EXPECT_EQ(Test::lookup('x').keycode, HID_KEYBOARD_B_AND_B);
+  EXPECT_EQ(Test::lookup('x').modifiers, 0);
+  EXPECT_EQ(Test::lookup('X').keycode, HID_KEYBOARD_B_AND_B);
+  EXPECT_EQ(Test::lookup('X').modifiers, shift);
+  EXPECT_EQ(Test::lookup('@').keycode, HID_KEYBOARD_A_AND_A);
+  EXPECT_EQ(Test::lookup('@').modifiers, altgr_modifier);
+  EXPECT_EQ(Test::lookup('b').keycode, 0);
+}
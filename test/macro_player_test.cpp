@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdio.h>
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/macro_player.h"
+
+using namespace kaleidoglyph::hid;
+using namespace kaleidoglyph::hid::keyboard;
+
+namespace {
+
+constexpr byte keyboard_endpoint = HID_KEYBOARD_DEDICATED_ENDPOINT
+                                   ? fake_usb::shared_endpoint + 1
+                                   : fake_usb::shared_endpoint;
+
+constexpr byte shift = 0x02;
+constexpr byte key_a = HID_KEYBOARD_A_AND_A;
+constexpr byte key_b = HID_KEYBOARD_B_AND_B;
+constexpr byte key_c = HID_KEYBOARD_C_AND_C;
+
+// A report as the host sees it: the modifiers, and the keys that are pressed.
+struct HostReport {
+  byte modifiers;
+  std::vector<byte> keycodes;
+  unsigned long sent_at;
+};
+
+std::vector<HostReport> hostReports() {
+  std::vector<HostReport> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(keyboard_endpoint)) {
+    const byte* data = packet.data.data();
+    if (!HID_KEYBOARD_DEDICATED_ENDPOINT) {
+      if (data[0] != HID_REPORTID_NKRO_KEYBOARD)
+        continue;
+      ++data;
+    }
+    HostReport report{data[0], {}, packet.sent_at};
+    for (int keycode{Report::first_key}; keycode <= Report::last_key; ++keycode) {
+      int bit = keycode - (Report::first_key / 8) * 8;
+      if (data[1 + bit / 8] & (1 << (bit % 8)))
+        report.keycodes.push_back(keycode);
+    }
+    reports.push_back(report);
+  }
+  return reports;
+}
+
+bool isPressed(const HostReport& report, byte keycode) {
+  for (byte k : report.keycodes) {
+    if (k == keycode)
+      return true;
+  }
+  return false;
+}
+
+// Start the dispatcher, and let the host collect its initial empty report.
+void start(Dispatcher& keyboard) {
+  keyboard.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+// Run the scan loop once per frame until the macro is done, and everything has been
+// sent. Returns the number of frames it took.
+int playToEnd(MacroPlayer& player, Dispatcher& keyboard) {
+  int frames{0};
+  while ((player.isPlaying() || keyboard.hasPendingReports()) && frames < 10000) {
+    player.poll();
+    keyboard.poll();
+    fake_usb::advanceFrames(1);
+    ++frames;
+  }
+  fake_usb::advanceFrames(1);
+  return frames;
+}
+
+} // namespace {
+
+// Each tap is released by the report that presses the next key, so typing "abc" takes
+// four reports: one per key, and a final release.
+TEST(macro_player, taps_roll_over_into_the_next_key) {
+  static const byte abc[] PROGMEM = {key_a, key_b, key_c, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(abc);
+  playToEnd(player, keyboard);
+
+  std::vector<HostReport> reports = hostReports();
+  EXPECT_EQ(reports.size(), 4u);
+  EXPECT_BYTES(reports[0].keycodes, {key_a});
+  EXPECT_BYTES(reports[1].keycodes, {key_b});
+  EXPECT_BYTES(reports[2].keycodes, {key_c});
+  EXPECT_BYTES(reports[3].keycodes, {});
+  EXPECT_FALSE(player.isPlaying());
+}
+
+TEST(macro_player, a_repeated_key_is_released_in_between) {
+  static const byte aa[] PROGMEM = {key_a, key_a, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(aa);
+  playToEnd(player, keyboard);
+
+  std::vector<HostReport> reports = hostReports();
+  EXPECT_EQ(reports.size(), 4u);
+  EXPECT_BYTES(reports[0].keycodes, {key_a});
+  EXPECT_BYTES(reports[1].keycodes, {});
+  EXPECT_BYTES(reports[2].keycodes, {key_a});
+  EXPECT_BYTES(reports[3].keycodes, {});
+}
+
+// The host must never see "A" pressed without shift, or "b" pressed with it.
+TEST(macro_player, modifiers_only_apply_to_their_own_key) {
+  static const byte Ab[] PROGMEM = {macro::tap_with, shift, key_a, key_b, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(Ab);
+  playToEnd(player, keyboard);
+
+  bool typed_a{false}, typed_b{false};
+  for (const HostReport& report : hostReports()) {
+    if (isPressed(report, key_a)) {
+      EXPECT_EQ(report.modifiers, shift);
+      EXPECT_FALSE(typed_b);
+      typed_a = true;
+    }
+    if (isPressed(report, key_b)) {
+      EXPECT_EQ(report.modifiers, 0);
+      typed_b = true;
+    }
+  }
+  EXPECT_TRUE(typed_a);
+  EXPECT_TRUE(typed_b);
+  EXPECT_EQ(hostReports().back().modifiers, 0);
+  EXPECT_BYTES(hostReports().back().keycodes, {});
+}
+
+TEST(macro_player, press_holds_a_key_until_it_is_released) {
+  static const byte held[] PROGMEM = {
+    macro::press, key_a, key_b, key_c, macro::release, key_a, macro::end,
+  };
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(held);
+  playToEnd(player, keyboard);
+
+  std::vector<HostReport> reports = hostReports();
+  EXPECT_EQ(reports.size(), 5u);
+  EXPECT_BYTES(reports[0].keycodes, {key_a});
+  EXPECT_BYTES(reports[1].keycodes, {key_a, key_b});
+  EXPECT_BYTES(reports[2].keycodes, {key_a, key_c});
+  EXPECT_BYTES(reports[3].keycodes, {key_a});
+  EXPECT_BYTES(reports[4].keycodes, {});
+}
+
+// The pause starts when the reports before it have been sent, not when the player queued
+// them, so the host sees all of it.
+TEST(macro_player, wait_pauses_for_whole_frames) {
+  static const byte pause[] PROGMEM = {key_a, macro::wait, 20, key_b, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(pause);
+  playToEnd(player, keyboard);
+
+  std::vector<HostReport> reports = hostReports();
+  EXPECT_EQ(reports.size(), 4u);
+  EXPECT_BYTES(reports[0].keycodes, {key_a});
+  EXPECT_BYTES(reports[1].keycodes, {});
+  EXPECT_BYTES(reports[2].keycodes, {key_b});
+  unsigned long gap = reports[2].sent_at - reports[1].sent_at;
+  EXPECT_TRUE(gap >= 20 * fake_usb::frame_us);
+  EXPECT_TRUE(gap <= (20 + Dispatcher::poll_interval) * fake_usb::frame_us);
+}
+
+// A long macro goes out at one report per polling interval, without ever waiting for
+// the host.
+TEST(macro_player, plays_at_the_full_polling_rate) {
+  static const byte text[] PROGMEM = {
+    key_a, key_b, key_c, key_a, key_b, key_c, key_a, key_b, key_c, key_a,
+    key_b, key_c, key_a, key_b, key_c, key_a, key_b, key_c, key_a, key_b,
+    macro::end,
+  };
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(text);
+  int frames = playToEnd(player, keyboard);
+
+  std::vector<HostReport> reports = hostReports();
+  EXPECT_EQ(reports.size(), 21u);
+  for (size_t i{1}; i < reports.size(); ++i)
+    EXPECT_EQ(reports[i].sent_at - reports[i - 1].sent_at,
+              Dispatcher::poll_interval * fake_usb::frame_us);
+  EXPECT_TRUE(frames <= int(reports.size() * Dispatcher::poll_interval) + 1);
+  EXPECT_EQ(fake_usb::blockedMicros(), 0ul);
+
+  // Every character takes one report, so the typing rate is the polling rate: 1000
+  // characters per second at a 1 ms interval.
+  const unsigned long characters = sizeof(text) - 1;
+  unsigned long elapsed = reports.back().sent_at - reports.front().sent_at;
+  unsigned long characters_per_second = characters * 1000000ul / elapsed;
+  printf("  %lu characters in %lu us: %lu characters/s\n",
+         characters, elapsed, characters_per_second);
+  EXPECT_EQ(characters_per_second, 1000ul / Dispatcher::poll_interval);
+}
+
+TEST(macro_player, stop_releases_every_key) {
+  static const byte held[] PROGMEM = {
+    macro::press, key_a, key_b, macro::wait, 100, macro::end,
+  };
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(held);
+  for (int i{0}; i < 10; ++i) {
+    player.poll();
+    keyboard.poll();
+    fake_usb::advanceFrames(1);
+  }
+  EXPECT_TRUE(player.isPlaying());
+
+  player.stop();
+  EXPECT_FALSE(player.isPlaying());
+  fake_usb::advanceFrames(1);
+  EXPECT_BYTES(hostReports().back().keycodes, {});
+}
+
+// Starting another macro releases the keys the abandoned one was holding, instead of
+// leaving them pressed in every report the new one sends.
+TEST(macro_player, play_releases_the_keys_of_the_abandoned_macro) {
+  static const byte held[] PROGMEM = {
+    macro::press, key_a, macro::wait, 100, macro::end,
+  };
+  static const byte bc[] PROGMEM = {key_b, key_c, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(held);
+  for (int i{0}; i < 10; ++i) {
+    player.poll();
+    keyboard.poll();
+    fake_usb::advanceFrames(1);
+  }
+  EXPECT_BYTES(hostReports().back().keycodes, {key_a});
+  fake_usb::clearPackets();
+
+  player.play(bc);
+  playToEnd(player, keyboard);
+
+  std::vector<HostReport> reports = hostReports();
+  EXPECT_EQ(reports.size(), 4u);
+  EXPECT_BYTES(reports[0].keycodes, {});
+  EXPECT_BYTES(reports[1].keycodes, {key_b});
+  EXPECT_BYTES(reports[2].keycodes, {key_c});
+  EXPECT_BYTES(reports[3].keycodes, {});
+}
+
+// The same goes for a macro that has ended with a key still pressed, and for a tap in
+// progress.
+TEST(macro_player, play_releases_a_key_left_pressed_or_tapped) {
+  static const byte pressed[] PROGMEM = {macro::press, key_a, macro::end};
+  static const byte taps[] PROGMEM = {
+    key_a, key_b, key_c, key_a, key_b, key_c, key_a, key_b, key_c, key_a,
+    key_b, key_c, key_a, key_b, key_c, key_a, key_b, key_c, key_a, key_b,
+    macro::end,
+  };
+  static const byte b[] PROGMEM = {macro::wait, 10, key_b, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(pressed);
+  playToEnd(player, keyboard);
+  EXPECT_FALSE(player.isPlaying());
+  EXPECT_BYTES(hostReports().back().keycodes, {key_a});
+
+  player.play(b);
+  fake_usb::advanceFrames(1);
+  EXPECT_BYTES(hostReports().back().keycodes, {});
+  playToEnd(player, keyboard);
+  fake_usb::clearPackets();
+
+  // The dispatcher's queue fills up before the player gets to the end of the macro.
+  player.play(taps);
+  player.poll();
+  EXPECT_TRUE(player.isPlaying());
+  player.play(b);
+  fake_usb::advanceFrames(1);
+  EXPECT_BYTES(hostReports().back().keycodes, {});
+  playToEnd(player, keyboard);
+  EXPECT_BYTES(hostReports().back().keycodes, {});
+}
+
+TEST(macro_player, stops_when_the_host_goes_away) {
+  static const byte abc[] PROGMEM = {key_a, key_b, key_c, macro::end};
+  Dispatcher keyboard;
+  start(keyboard);
+  MacroPlayer player(keyboard);
+
+  player.play(abc);
+  fake_usb::setConfigured(false);
+  player.poll();
+  EXPECT_FALSE(player.isPlaying());
+  EXPECT_FALSE(keyboard.hasPendingReports());
+}
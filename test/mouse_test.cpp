@@ -0,0 +1,456 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/mouse.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+constexpr byte mouse_interface = HID_MOUSE_DEDICATED_ENDPOINT
+                                 ? fake_usb::shared_interface + 1
+                                 : fake_usb::shared_interface;
+constexpr byte mouse_endpoint = HID_MOUSE_DEDICATED_ENDPOINT
+                                ? fake_usb::shared_endpoint + 1
+                                : fake_usb::shared_endpoint;
+
+constexpr int16_t unit = 1 << mouse::Dispatcher::subpixel_bits;
+constexpr int max_delta = mouse::Report::max_cursor_delta;
+
+// The bytes of a report, with X and Y as wide as `HID_MOUSE_16BIT_AXES` makes them.
+std::vector<byte> mouseReport(byte buttons, int x, int y, int v = 0, int h = 0) {
+  std::vector<byte> report{buttons};
+  for (int delta : {x, y}) {
+    report.push_back(byte(delta));
+    if (sizeof(mouse::Report::CursorDelta) == 2)
+      report.push_back(byte(delta >> 8));
+  }
+  report.push_back(byte(v));
+  report.push_back(byte(h));
+  return report;
+}
+
+// The mouse reports the host has received, without their report IDs.
+std::vector<std::vector<byte>> hostReports() {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(mouse_endpoint)) {
+    if (HID_MOUSE_DEDICATED_ENDPOINT)
+      reports.push_back(packet.data);
+    else if (packet.data[0] == HID_REPORTID_MOUSE)
+      reports.emplace_back(packet.data.begin() + 1, packet.data.end());
+  }
+  return reports;
+}
+
+// The X movement in a report from `hostReports()`.
+int xDelta(const std::vector<byte>& report) {
+  if (sizeof(mouse::Report::CursorDelta) == 2)
+    return int16_t(report[1] | (report[2] << 8));
+  return int8_t(report[1]);
+}
+
+// The vertical and horizontal wheel movement in a report from `hostReports()`.
+int verticalDelta(const std::vector<byte>& report) {
+  return int8_t(report[1 + 2 * sizeof(mouse::Report::CursorDelta)]);
+}
+int horizontalDelta(const std::vector<byte>& report) {
+  return int8_t(report[2 + 2 * sizeof(mouse::Report::CursorDelta)]);
+}
+
+// Start the dispatcher, and let the host collect its initial empty report.
+void start(mouse::Dispatcher& mouse) {
+  mouse.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+// Poll once per frame until there's nothing left to send.
+void drain(mouse::Dispatcher& mouse) {
+  while (mouse.hasPendingReports()) {
+    fake_usb::advanceFrames(1);
+    mouse.poll();
+  }
+  fake_usb::advanceFrames(1);
+}
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Descriptor and report layout
+
+#if !(HID_MOUSE_DEDICATED_ENDPOINT && HID_MOUSE_WHEEL_MULTIPLIER > 1)
+// With 8-bit axes, X, Y and the wheel share one input item, as they always have, so the
+// descriptor stays at 58 bytes (56 without a report ID); 16-bit X and Y need their own.
+TEST(mouse, descriptor) {
+  mouse::Dispatcher mouse;
+  mouse.init();
+
+  std::vector<byte> expected{
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01,
+#if !HID_MOUSE_DEDICATED_ENDPOINT
+    0x85, 0x01,
+#endif
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x95, 0x08, 0x75, 0x01,
+    0x81, 0x02,
+#if HID_MOUSE_16BIT_AXES
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xff, 0x7f, 0x75, 0x10,
+    0x95, 0x02, 0x81, 0x06,
+    0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06,
+#else
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08,
+    0x95, 0x03, 0x81, 0x06,
+#endif
+    0x05, 0x0c, 0x0a, 0x38, 0x02, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x01,
+    0x81, 0x06,
+    0xc0,
+  };
+
+  fake_usb::enumerate();
+  EXPECT_BYTES(fake_usb::reportDescriptor(mouse_interface), (expected));
+#if !HID_MOUSE_16BIT_AXES
+  EXPECT_EQ(expected.size(), HID_MOUSE_DEDICATED_ENDPOINT ? 56u : 58u);
+#endif
+}
+#endif
+
+TEST(mouse, reports_carry_the_full_axis_range) {
+  mouse::Dispatcher mouse;
+  start(mouse);
+
+  mouse::Report report;
+  report.moveCursor(max_delta, -max_delta);
+  report.scrollVertical(-127);
+  EXPECT_EQ(mouse.sendReport(report), SendStatus::sent);
+  fake_usb::advanceFrames(1);
+
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], (mouseReport(0, max_delta, -max_delta, -127)));
+}
+
+TEST(mouse, accumulated_movement_is_split_only_where_it_does_not_fit) {
+  mouse::Dispatcher mouse;
+  start(mouse);
+
+  mouse.accumulate(200 * unit, -3 * unit);
+  drain(mouse);
+
+  std::vector<std::vector<byte>> reports = hostReports();
+#if HID_MOUSE_16BIT_AXES
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], (mouseReport(0, 200, -3)));
+#else
+  EXPECT_EQ(reports.size(), 2u);
+  EXPECT_BYTES(reports[0], (mouseReport(0, 127, -3)));
+  EXPECT_BYTES(reports[1], (mouseReport(0, 73, 0)));
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Polling interval
+
+// Movement accumulated every frame is sent once every `poll_interval` frames, and none of
+// it is lost in between.
+TEST(mouse, accumulated_movement_is_sent_once_per_polling_interval) {
+  mouse::Dispatcher mouse;
+  start(mouse);
+
+  constexpr int frames = 4 * mouse::Dispatcher::poll_interval;
+  for (int i{0}; i < frames; ++i) {
+    fake_usb::advanceFrames(1);
+    mouse.accumulate(unit, 0);
+    mouse.poll();
+  }
+  drain(mouse);
+
+  std::vector<fake_usb::Packet> packets = fake_usb::packetsOn(mouse_endpoint);
+  EXPECT_TRUE(packets.size() >= 4u);
+  for (size_t i{1}; i < packets.size(); ++i)
+    EXPECT_EQ(packets[i].sent_at - packets[i - 1].sent_at,
+              mouse::Dispatcher::poll_interval * fake_usb::frame_us);
+  int x{0};
+  for (const std::vector<byte>& report : hostReports())
+    x += xDelta(report);
+  EXPECT_EQ(x, frames);
+}
+
+#if HID_MOUSE_DEDICATED_ENDPOINT
+TEST(mouse, endpoint_descriptor_has_the_polling_interval) {
+  mouse::Dispatcher mouse;
+  mouse.init();
+
+  std::vector<fake_usb::Interface> interfaces = fake_usb::enumerate();
+  EXPECT_EQ(interfaces.size(), 2u);
+  EXPECT_EQ(interfaces[1].number, mouse_interface);
+  EXPECT_EQ(interfaces[1].endpoint, mouse_endpoint);
+  EXPECT_EQ(interfaces[1].poll_interval, HID_MOUSE_POLL_INTERVAL);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Wheel resolution multiplier
+
+#if HID_MOUSE_DEDICATED_ENDPOINT && HID_MOUSE_WHEEL_MULTIPLIER > 1
+// Each wheel is in a logical collection with its Resolution Multiplier, and the two
+// multipliers (and four bits of padding) make up a one-byte feature report.
+TEST(mouse, high_resolution_descriptor) {
+  mouse::Dispatcher mouse;
+  mouse.init();
+
+  fake_usb::enumerate();
+  EXPECT_BYTES(fake_usb::reportDescriptor(mouse_interface),
+               {0x05, 0x01, 0x09, 0x02, 0xa1, 0x01,
+                0x05, 0x09, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x95, 0x08,
+                0x75, 0x01, 0x81, 0x02,
+                0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08,
+                0x95, 0x02, 0x81, 0x06,
+                0xa1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01,
+                0x45, HID_MOUSE_WHEEL_MULTIPLIER, 0x75, 0x02, 0x95, 0x01, 0xb1, 0x02,
+                0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x35, 0x00, 0x45, 0x00, 0x75, 0x08,
+                0x81, 0x06, 0xc0,
+                0xa1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01,
+                0x45, HID_MOUSE_WHEEL_MULTIPLIER, 0x75, 0x02, 0xb1, 0x02,
+                0x75, 0x04, 0xb1, 0x01, 0x35, 0x00, 0x45, 0x00,
+                0x05, 0x0c, 0x0a, 0x38, 0x02, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08,
+                0x81, 0x06, 0xc0,
+                0xc0});
+}
+
+TEST(mouse, host_reads_and_sets_the_wheel_multipliers) {
+  mouse::Dispatcher mouse;
+  start(mouse);
+
+  EXPECT_TRUE(fake_usb::getReport(mouse_interface, HID_REPORT_TYPE_FEATURE, 0, 1));
+  EXPECT_BYTES(fake_usb::response(), {0x00});
+  EXPECT_EQ(mouse.verticalWheelMultiplier(), 1);
+  EXPECT_EQ(mouse.horizontalWheelMultiplier(), 1);
+
+  EXPECT_TRUE(fake_usb::setReport(mouse_interface, HID_REPORT_TYPE_FEATURE, 0, {0x05}));
+  EXPECT_TRUE(fake_usb::getReport(mouse_interface, HID_REPORT_TYPE_FEATURE, 0, 1));
+  EXPECT_BYTES(fake_usb::response(), {0x05});
+  EXPECT_EQ(mouse.verticalWheelMultiplier(), HID_MOUSE_WHEEL_MULTIPLIER);
+  EXPECT_EQ(mouse.horizontalWheelMultiplier(), HID_MOUSE_WHEEL_MULTIPLIER);
+
+  EXPECT_TRUE(fake_usb::setReport(mouse_interface, HID_REPORT_TYPE_FEATURE, 0, {0x01}));
+  EXPECT_EQ(mouse.verticalWheelMultiplier(), HID_MOUSE_WHEEL_MULTIPLIER);
+  EXPECT_EQ(mouse.horizontalWheelMultiplier(), 1);
+}
+
+// Once the host has enabled a multiplier, a detent of accumulated wheel movement is sent
+// as that many units.
+TEST(mouse, accumulated_wheel_movement_is_scaled_by_the_multiplier) {
+  mouse::Dispatcher mouse;
+  start(mouse);
+  fake_usb::setReport(mouse_interface, HID_REPORT_TYPE_FEATURE, 0, {0x01});
+
+  mouse.accumulate(0, 0, unit, -unit);
+  drain(mouse);
+
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_EQ(verticalDelta(reports[0]), HID_MOUSE_WHEEL_MULTIPLIER);
+  EXPECT_EQ(horizontalDelta(reports[0]), -1);
+}
+#else
+// Without a dedicated interface there's no feature report, and the host can't change the
+// wheel resolution.
+TEST(mouse, wheel_movement_is_sent_in_detents) {
+  mouse::Dispatcher mouse;
+  start(mouse);
+  EXPECT_EQ(mouse.verticalWheelMultiplier(), 1);
+  EXPECT_EQ(mouse.horizontalWheelMultiplier(), 1);
+
+  mouse.accumulate(0, 0, unit, -unit);
+  drain(mouse);
+
+  std::vector<std::vector<byte>> reports = hostReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_EQ(verticalDelta(reports[0]), 1);
+  EXPECT_EQ(horizontalDelta(reports[0]), -1);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Absolute mouse
+
+namespace {
+
+// The absolute mouse is always on its own interface.
+constexpr byte absolute_endpoint = fake_usb::shared_endpoint + 1;
+
+std::vector<byte> absoluteReport(byte buttons, uint16_t x, uint16_t y) {
+  return {buttons, byte(x), byte(x >> 8), byte(y), byte(y >> 8), 0};
+}
+
+mouse::absolute::Report absoluteMove(uint16_t x, uint16_t y, byte buttons = 0) {
+  mouse::absolute::Report report;
+  report.pressButtons(buttons);
+  report.moveCursorTo(x, y);
+  return report;
+}
+
+std::vector<std::vector<byte>> absoluteHostReports() {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(absolute_endpoint))
+    reports.push_back(packet.data);
+  return reports;
+}
+
+void start(mouse::absolute::Dispatcher& mouse) {
+  mouse.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+// Every pixel of a `_width` pixel axis is within one of the exact (rounded) logical
+// position, the positions never go backwards, and the edges are exact.
+template <uint16_t _width>
+bool mapsEveryPixel() {
+  typedef mouse::absolute::Screen<_width, 2> Screen;
+  uint32_t previous{0};
+  for (uint32_t pixel{0}; pixel < _width; ++pixel) {
+    uint32_t exact = (pixel * mouse::absolute::max_position * 2 + (_width - 1)) /
+                     (2 * (_width - 1));
+    uint32_t x = Screen::x(pixel);
+    if (x + 1 < exact || x > exact + 1 || x < previous)
+      return false;
+    previous = x;
+  }
+  return Screen::x(0) == 0 && Screen::x(_width - 1) == mouse::absolute::max_position;
+}
+
+} // namespace {
+
+TEST(absolute_mouse, screen_edges_map_to_the_ends_of_the_range) {
+  typedef mouse::absolute::Screen<1920, 1080> Screen;
+  static_assert(Screen::x(0) == 0 && Screen::y(0) == 0,
+                "The first pixel isn't mapped to 0");
+  EXPECT_EQ(Screen::x(1), 17);
+  EXPECT_EQ(Screen::x(1918), 32750);
+  EXPECT_EQ(Screen::x(1919), mouse::absolute::max_position);
+  EXPECT_EQ(Screen::y(1078), 32737);
+  EXPECT_EQ(Screen::y(1079), mouse::absolute::max_position);
+  // Pixels past the edge stay on it.
+  EXPECT_EQ(Screen::x(1920), mouse::absolute::max_position);
+  EXPECT_EQ(Screen::y(0xFFFF), mouse::absolute::max_position);
+}
+
+TEST(absolute_mouse, screen_maps_every_pixel) {
+  EXPECT_TRUE(mapsEveryPixel<2>());
+  EXPECT_TRUE(mapsEveryPixel<3>());
+  EXPECT_TRUE(mapsEveryPixel<768>());
+  EXPECT_TRUE(mapsEveryPixel<1920>());
+  EXPECT_TRUE(mapsEveryPixel<3840>());
+  // Two pixels: one at each end. Three: the middle one is halfway, rounded up.
+  EXPECT_EQ((mouse::absolute::Screen<2, 2>::x(1)), mouse::absolute::max_position);
+  EXPECT_EQ((mouse::absolute::Screen<3, 3>::y(1)), 16384);
+}
+
+TEST(absolute_mouse, report_layout) {
+  mouse::absolute::Dispatcher mouse;
+  start(mouse);
+
+  mouse::absolute::Report report;
+  report.pressButtons(0x05);
+  report.moveCursorToPixel(1919, 0);
+  EXPECT_EQ(mouse.sendReport(report), SendStatus::sent);
+  fake_usb::advanceFrames(1);
+
+  std::vector<std::vector<byte>> reports = absoluteHostReports();
+  EXPECT_EQ(reports.size(), 1u);
+  EXPECT_BYTES(reports[0], {0x05, 0xFF, 0x7F, 0x00, 0x00, 0x00});
+}
+
+TEST(absolute_mouse, moves_in_one_frame_are_coalesced) {
+  mouse::absolute::Dispatcher mouse;
+  start(mouse);
+
+  EXPECT_EQ(mouse.sendReport(absoluteMove(100, 200)), SendStatus::sent);
+  // The polling interval isn't up, so these wait, and only the last position is kept.
+  EXPECT_EQ(mouse.sendReport(absoluteMove(110, 210)), SendStatus::queued);
+  EXPECT_EQ(mouse.sendReport(absoluteMove(120, 220)), SendStatus::queued);
+  EXPECT_TRUE(mouse.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(absoluteHostReports().size(), 1u);
+
+  EXPECT_TRUE(mouse.poll());
+  fake_usb::advanceFrames(1);
+  std::vector<std::vector<byte>> reports = absoluteHostReports();
+  EXPECT_EQ(reports.size(), 2u);
+  EXPECT_BYTES(reports[0], (absoluteReport(0, 100, 200)));
+  EXPECT_BYTES(reports[1], (absoluteReport(0, 120, 220)));
+  EXPECT_FALSE(mouse.hasPendingReports());
+}
+
+TEST(absolute_mouse, a_coalesced_move_is_sent_by_the_next_send_after_the_interval) {
+  mouse::absolute::Dispatcher mouse;
+  start(mouse);
+
+  mouse.sendReport(absoluteMove(100, 200));
+  EXPECT_EQ(mouse.sendReport(absoluteMove(110, 210)), SendStatus::queued);
+  fake_usb::advanceFrames(mouse::absolute::Dispatcher::poll_interval);
+  // The waiting report goes first, and the new one waits for the next interval.
+  EXPECT_EQ(mouse.sendReport(absoluteMove(120, 220)), SendStatus::queued);
+  fake_usb::advanceFrames(1);
+
+  std::vector<std::vector<byte>> reports = absoluteHostReports();
+  EXPECT_EQ(reports.size(), 2u);
+  EXPECT_BYTES(reports[1], (absoluteReport(0, 110, 210)));
+}
+
+TEST(absolute_mouse, moving_back_cancels_the_waiting_report) {
+  mouse::absolute::Dispatcher mouse;
+  start(mouse);
+
+  mouse.sendReport(absoluteMove(100, 200));
+  EXPECT_EQ(mouse.sendReport(absoluteMove(110, 210)), SendStatus::queued);
+  EXPECT_EQ(mouse.sendReport(absoluteMove(100, 200)), SendStatus::sent);
+  EXPECT_FALSE(mouse.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_FALSE(mouse.poll());
+  // And a report that's where the host already is isn't sent at all.
+  EXPECT_EQ(mouse.sendReport(absoluteMove(100, 200)), SendStatus::sent);
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(absoluteHostReports().size(), 1u);
+}
+
+TEST(absolute_mouse, a_click_is_not_coalesced) {
+  mouse::absolute::Dispatcher mouse;
+  start(mouse);
+
+  mouse.sendReport(absoluteMove(100, 200));
+  EXPECT_EQ(mouse.sendReport(absoluteMove(100, 200, 0x01)), SendStatus::queued);
+  // Releasing the button now would lose the click.
+  EXPECT_EQ(mouse.sendReport(absoluteMove(100, 200)), SendStatus::host_busy);
+  fake_usb::advanceFrames(1);
+  EXPECT_TRUE(mouse.poll());
+  fake_usb::advanceFrames(1);
+
+  std::vector<std::vector<byte>> reports = absoluteHostReports();
+  EXPECT_EQ(reports.size(), 2u);
+  EXPECT_BYTES(reports[1], (absoluteReport(0x01, 100, 200)));
+}
@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/scheduler.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+// The keyboard is started first, so its interface follows `HID()`'s, and the mouse's (if
+// it has one) comes after that.
+constexpr byte keyboard_endpoint = HID_KEYBOARD_DEDICATED_ENDPOINT
+                                   ? fake_usb::shared_endpoint + 1
+                                   : fake_usb::shared_endpoint;
+constexpr byte mouse_endpoint = HID_MOUSE_DEDICATED_ENDPOINT
+                                ? fake_usb::shared_endpoint + 2
+                                : fake_usb::shared_endpoint;
+
+constexpr int16_t unit = 1 << mouse::Dispatcher::subpixel_bits;
+
+bool isKeyboardReport(const fake_usb::Packet& packet) {
+  return (packet.endpoint == keyboard_endpoint &&
+          (HID_KEYBOARD_DEDICATED_ENDPOINT || packet.data[0] == HID_REPORTID_NKRO_KEYBOARD));
+}
+
+bool isMouseReport(const fake_usb::Packet& packet) {
+  return (packet.endpoint == mouse_endpoint &&
+          (HID_MOUSE_DEDICATED_ENDPOINT || packet.data[0] == HID_REPORTID_MOUSE));
+}
+
+// The X movement in a mouse report.
+int xDelta(const fake_usb::Packet& packet) {
+  const byte* report = packet.data.data() + (HID_MOUSE_DEDICATED_ENDPOINT ? 0 : 1);
+  if (sizeof(mouse::Report::CursorDelta) == 2)
+    return int16_t(report[1] | (report[2] << 8));
+  return int8_t(report[1]);
+}
+
+keyboard::Report keyReport(byte keycode) {
+  keyboard::Report report;
+  if (keycode != 0)
+    report.addKeycode(keycode);
+  return report;
+}
+
+// Start both dispatchers, and wait long enough for either one's polling interval to
+// have passed. On the shared endpoint, the mouse's initial report has to wait for the
+// keyboard's, so this returns the time spent blocked so far.
+unsigned long start(keyboard::Dispatcher& keyboard, mouse::Dispatcher& mouse) {
+  keyboard.init();
+  mouse.init();
+  fake_usb::advanceFrames(64);
+  fake_usb::clearPackets();
+  return fake_usb::blockedMicros();
+}
+
+} // namespace {
+
+// When both have something to send in the same frame, the keyboard goes first. On the
+// shared endpoint, the mouse has to wait for the next frame; with dedicated endpoints,
+// they don't compete.
+TEST(scheduler, keyboard_reports_go_before_mouse_reports) {
+  keyboard::Dispatcher keyboard;
+  mouse::Dispatcher mouse;
+  unsigned long blocked = start(keyboard, mouse);
+  Scheduler scheduler(&keyboard, nullptr, nullptr, &mouse);
+
+  keyboard.trySendReport(keyReport(HID_KEYBOARD_A_AND_A));
+  mouse.accumulate(5 * unit, 0);
+  scheduler.poll();
+
+  std::vector<fake_usb::Packet> packets = fake_usb::packets();
+  bool shared = !HID_KEYBOARD_DEDICATED_ENDPOINT && !HID_MOUSE_DEDICATED_ENDPOINT;
+  EXPECT_EQ(packets.size(), shared ? 1u : 2u);
+  EXPECT_TRUE(isKeyboardReport(packets[0]));
+  EXPECT_TRUE(mouse.hasPendingReports() == shared);
+
+  fake_usb::advanceFrames(1);
+  scheduler.poll();
+  packets = fake_usb::packets();
+  EXPECT_EQ(packets.size(), 2u);
+  EXPECT_TRUE(isMouseReport(packets[1]));
+  EXPECT_EQ(xDelta(packets[1]), 5);
+  EXPECT_FALSE(scheduler.hasPendingReports());
+  EXPECT_EQ(fake_usb::blockedMicros(), blocked);
+}
+
+TEST(scheduler, polls_at_most_once_per_frame) {
+  keyboard::Dispatcher keyboard;
+  mouse::Dispatcher mouse;
+  start(keyboard, mouse);
+  Scheduler scheduler(&keyboard, nullptr, nullptr, &mouse);
+
+  keyboard.trySendReport(keyReport(HID_KEYBOARD_A_AND_A));
+  keyboard.trySendReport(keyReport(0));
+  scheduler.poll();
+  scheduler.poll();
+  EXPECT_EQ(fake_usb::packets().size(), 1u);
+  EXPECT_TRUE(scheduler.hasPendingReports());
+}
+
+// Mouse movement that waits behind a burst of keyboard reports is coalesced, not lost,
+// and the keyboard reports are never delayed by it: one goes out every polling interval
+// until the keyboard's queue is empty.
+TEST(scheduler, mouse_movement_waits_behind_keyboard_reports) {
+  keyboard::Dispatcher keyboard;
+  mouse::Dispatcher mouse;
+  unsigned long blocked = start(keyboard, mouse);
+  Scheduler scheduler(&keyboard, nullptr, nullptr, &mouse);
+
+  constexpr int frames = 64;
+  for (int i{0}; i < frames; ++i) {
+    keyboard.trySendReport(keyReport((i % 2 == 0) ? HID_KEYBOARD_A_AND_A : 0));
+    mouse.accumulate(unit, 0);
+    scheduler.poll();
+    fake_usb::advanceFrames(1);
+  }
+  while (scheduler.hasPendingReports()) {
+    scheduler.poll();
+    fake_usb::advanceFrames(1);
+  }
+  fake_usb::advanceFrames(1);
+
+  int keyboard_reports{0}, x{0};
+  unsigned long last_keyboard_report{0};
+  for (const fake_usb::Packet& packet : fake_usb::packets()) {
+    EXPECT_TRUE(packet.collected());
+    if (isKeyboardReport(packet)) {
+      if (keyboard_reports > 0)
+        EXPECT_EQ(packet.sent_at - last_keyboard_report,
+                  keyboard::Dispatcher::poll_interval * fake_usb::frame_us);
+      last_keyboard_report = packet.sent_at;
+      ++keyboard_reports;
+    } else if (isMouseReport(packet)) {
+      x += xDelta(packet);
+    }
+  }
+  EXPECT_TRUE(keyboard_reports >= frames / keyboard::Dispatcher::poll_interval);
+  EXPECT_EQ(x, frames);
+  EXPECT_EQ(fake_usb::blockedMicros(), blocked);
+}
@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "kaleidoglyph/hid/consumer.h"
+#include "kaleidoglyph/hid/keyboard.h"
+#include "kaleidoglyph/hid/mouse.h"
+#include "kaleidoglyph/hid/stats.h"
+#include "kaleidoglyph/hid/system.h"
+
+#include <string.h>
+
+// The counters only exist with `HID_STATS` enabled (in the `dedicated` configuration).
+#if HID_STATS
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+constexpr byte keyboard_interface = fake_usb::shared_interface + 1;
+
+// The feature report, as the host reads it.
+std::vector<byte> featureReport() {
+  fake_usb::getReport(keyboard_interface, HID_REPORT_TYPE_FEATURE, 0,
+                      stats::StatsDescriptor::feature_bytes);
+  return fake_usb::response();
+}
+
+// The bytes of one dispatcher's counters in the feature report.
+std::vector<byte> sourceBytes(const std::vector<byte>& feature, stats::Source source) {
+  auto begin = feature.begin() + byte(source) * sizeof(stats::Report);
+  return std::vector<byte>(begin, begin + sizeof(stats::Report));
+}
+
+std::vector<byte> bytesOf(const stats::Report& report) {
+  std::vector<byte> bytes(sizeof(report));
+  memcpy(bytes.data(), &report, sizeof(report));
+  return bytes;
+}
+
+// A little-endian counter in the feature report.
+uint16_t counter(const std::vector<byte>& feature, stats::Source source, byte offset) {
+  size_t index = byte(source) * sizeof(stats::Report) + offset;
+  return feature[index] | (feature[index + 1] << 8);
+}
+
+constexpr byte reports_sent = offsetof(stats::Report, reports_sent);
+constexpr byte duplicates_suppressed = offsetof(stats::Report, duplicates_suppressed);
+
+// The latency bucket a report that waited `us` microseconds lands in.
+int latencyBucket(unsigned long us) {
+  stats::Stats<1> stats;
+  stats.reportQueued();
+  fake_usb::advanceMicros(us);
+  stats.reportSent(1);
+  for (byte bucket{0}; bucket < stats::latency_bucket_count; ++bucket) {
+    if (stats.report().latency[bucket] != 0)
+      return bucket;
+  }
+  return -1;
+}
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Feature report
+
+TEST(stats, feature_report_holds_each_dispatcher_in_order) {
+  keyboard::Dispatcher keyboard;
+  system::Dispatcher system;
+  keyboard.init();
+  system.init();
+  fake_usb::advanceFrames(1);
+
+  system::Report report;
+  report.addKeycode(HID_SYSTEM_SLEEP);
+  system.sendReport(report);
+  system.sendReport(report);
+  system.trySendReport(report);
+
+  std::vector<byte> feature = featureReport();
+  EXPECT_EQ(feature.size(), stats::source_count * sizeof(stats::Report));
+  EXPECT_EQ(feature.size(), 96u);
+  EXPECT_BYTES(sourceBytes(feature, stats::Source::keyboard),
+               (bytesOf(keyboard.stats().report())));
+  EXPECT_BYTES(sourceBytes(feature, stats::Source::system),
+               (bytesOf(system.stats().report())));
+  // Nothing is left out for the dispatchers that don't exist.
+  EXPECT_BYTES(sourceBytes(feature, stats::Source::consumer),
+               (std::vector<byte>(sizeof(stats::Report), 0)));
+  EXPECT_BYTES(sourceBytes(feature, stats::Source::mouse),
+               (std::vector<byte>(sizeof(stats::Report), 0)));
+
+  // The initial empty report, and the sleep report.
+  EXPECT_EQ(counter(feature, stats::Source::system, reports_sent), 2);
+  EXPECT_EQ(counter(feature, stats::Source::system, duplicates_suppressed), 2);
+}
+
+TEST(stats, each_dispatcher_counts_its_own_reports) {
+  keyboard::Dispatcher keyboard;
+  consumer::Dispatcher consumer;
+  system::Dispatcher system;
+  mouse::Dispatcher mouse;
+  keyboard.init();
+  consumer.init();
+  system.init();
+  mouse.init();
+  fake_usb::advanceFrames(1);
+  std::vector<byte> before = featureReport();
+
+  consumer::Report volume_up;
+  volume_up.addKeycode(HID_CONSUMER_VOLUME_INCREMENT);
+  consumer.sendReport(volume_up);
+  consumer.sendReport(volume_up);
+
+  mouse::Report click;
+  click.pressButtons(0x01);
+  mouse.sendReport(click);
+  mouse.sendReport(click);
+  mouse.sendReport(click);
+
+  std::vector<byte> after = featureReport();
+  EXPECT_BYTES(sourceBytes(after, stats::Source::keyboard),
+               (sourceBytes(before, stats::Source::keyboard)));
+  EXPECT_BYTES(sourceBytes(after, stats::Source::system),
+               (sourceBytes(before, stats::Source::system)));
+  EXPECT_EQ(counter(after, stats::Source::consumer, reports_sent) -
+            counter(before, stats::Source::consumer, reports_sent), 1);
+  EXPECT_EQ(counter(after, stats::Source::consumer, duplicates_suppressed) -
+            counter(before, stats::Source::consumer, duplicates_suppressed), 1);
+  EXPECT_EQ(counter(after, stats::Source::mouse, reports_sent) -
+            counter(before, stats::Source::mouse, reports_sent), 1);
+  EXPECT_EQ(counter(after, stats::Source::mouse, duplicates_suppressed) -
+            counter(before, stats::Source::mouse, duplicates_suppressed), 2);
+}
+
+TEST(stats, a_report_that_waits_for_the_poll_counts_its_wait) {
+  system::Dispatcher system;
+  system.init();
+  fake_usb::advanceFrames(1);
+  system.poll();
+  const uint16_t* latency = system.stats().report().latency;
+  uint16_t immediate = latency[0];
+
+  system::Report report;
+  report.addKeycode(HID_SYSTEM_SLEEP);
+  system.trySendReport(report);
+  fake_usb::advanceMicros(3 * HID_STATS_LATENCY_BASE_US);
+  // A newer report doesn't restart the clock.
+  report.addKeycode(HID_SYSTEM_POWER_DOWN);
+  system.trySendReport(report);
+  fake_usb::advanceFrames(1);
+  EXPECT_TRUE(system.poll());
+
+  EXPECT_EQ(latency[0], immediate);
+  uint16_t waited{0};
+  for (byte bucket{2}; bucket < stats::latency_bucket_count; ++bucket)
+    waited += latency[bucket];
+  EXPECT_EQ(waited, 1);
+}
+
+// ----------------------------------------------------------------------------
+// Latency histogram
+
+TEST(stats, latency_buckets_double_in_width) {
+  constexpr unsigned long base = HID_STATS_LATENCY_BASE_US;
+  EXPECT_EQ(latencyBucket(0), 0);
+  EXPECT_EQ(latencyBucket(base - 1), 0);
+  EXPECT_EQ(latencyBucket(base), 1);
+  EXPECT_EQ(latencyBucket(2 * base - 1), 1);
+  EXPECT_EQ(latencyBucket(2 * base), 2);
+  EXPECT_EQ(latencyBucket(4 * base - 1), 2);
+  EXPECT_EQ(latencyBucket(4 * base), 3);
+  EXPECT_EQ(latencyBucket(32 * base), 6);
+  EXPECT_EQ(latencyBucket(64 * base - 1), 6);
+}
+
+TEST(stats, the_last_latency_bucket_holds_everything_longer) {
+  constexpr unsigned long base = HID_STATS_LATENCY_BASE_US;
+  EXPECT_EQ(latencyBucket(64 * base), 7);
+  EXPECT_EQ(latencyBucket(1000 * base), 7);
+}
+
+TEST(stats, a_failed_send_keeps_its_queue_time) {
+  stats::Stats<1> stats;
+  stats.reportQueued();
+  fake_usb::advanceMicros(HID_STATS_LATENCY_BASE_US);
+  stats.reportSent(-1);
+  fake_usb::advanceMicros(HID_STATS_LATENCY_BASE_US);
+  stats.reportQueued();
+  stats.reportSent(1);
+  EXPECT_EQ(stats.report().send_failures, 1);
+  EXPECT_EQ(stats.report().reports_sent, 1);
+  EXPECT_EQ(stats.report().latency[2], 1);
+}
+
+#endif
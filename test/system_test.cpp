@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+#include "fake_usb.h"
+
+#include "HIDTables.h"
+#include "kaleidoglyph/hid/system.h"
+
+using namespace kaleidoglyph::hid;
+
+namespace {
+
+constexpr byte system_endpoint = HID_SYSTEMCONTROL_DEDICATED_ENDPOINT
+                                 ? fake_usb::shared_endpoint + 1
+                                 : fake_usb::shared_endpoint;
+
+// The system control reports the host has received, without their report IDs.
+std::vector<std::vector<byte>> hostReports() {
+  std::vector<std::vector<byte>> reports;
+  for (const fake_usb::Packet& packet : fake_usb::packetsOn(system_endpoint)) {
+    if (HID_SYSTEMCONTROL_DEDICATED_ENDPOINT)
+      reports.push_back(packet.data);
+    else if (packet.data[0] == HID_REPORTID_SYSTEMCONTROL)
+      reports.emplace_back(packet.data.begin() + 1, packet.data.end());
+  }
+  return reports;
+}
+
+// Start the dispatcher, and let the host collect its initial empty report.
+void start(system::Dispatcher& system) {
+  system.init();
+  fake_usb::advanceFrames(1);
+  fake_usb::clearPackets();
+}
+
+system::Report report(std::initializer_list<byte> keycodes) {
+  system::Report report;
+  for (byte keycode : keycodes)
+    report.addKeycode(keycode);
+  return report;
+}
+
+// The bytes the host gets for a report.
+std::vector<byte> sentBytes(const system::Report& report) {
+  fake_usb::reset();
+  system::Dispatcher system;
+  start(system);
+  system.sendReport(report);
+  fake_usb::advanceFrames(1);
+  std::vector<std::vector<byte>> reports = hostReports();
+  return reports.empty() ? std::vector<byte>() : reports.back();
+}
+
+} // namespace {
+
+// ----------------------------------------------------------------------------
+// Duplicate suppression
+
+TEST(system, init_sends_an_empty_report) {
+  system::Dispatcher system;
+  system.init();
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(hostReports().size(), 1u);
+  EXPECT_BYTES(hostReports()[0], (std::vector<byte>(system::Report::size, 0)));
+}
+
+TEST(system, a_repeated_report_is_not_sent_again) {
+  system::Dispatcher system;
+  start(system);
+
+  system::Report sleep = report({HID_SYSTEM_SLEEP});
+  EXPECT_EQ(system.sendReport(sleep), SendStatus::sent);
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(system.sendReport(sleep), SendStatus::sent);
+  EXPECT_EQ(system.trySendReport(sleep), SendStatus::sent);
+  EXPECT_FALSE(system.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_FALSE(system.poll());
+  EXPECT_EQ(hostReports().size(), 1u);
+
+  system.sendReport(system::Report());
+  fake_usb::advanceFrames(1);
+  EXPECT_EQ(hostReports().size(), 2u);
+}
+
+TEST(system, a_waiting_report_replaced_by_the_last_one_sent_is_dropped) {
+  system::Dispatcher system;
+  start(system);
+
+  EXPECT_EQ(system.trySendReport(report({HID_SYSTEM_SLEEP})), SendStatus::queued);
+  EXPECT_TRUE(system.hasPendingReports());
+  // Back to what the host already has.
+  EXPECT_EQ(system.trySendReport(system::Report()), SendStatus::sent);
+  EXPECT_FALSE(system.hasPendingReports());
+  fake_usb::advanceFrames(1);
+  EXPECT_FALSE(system.poll());
+  EXPECT_EQ(hostReports().size(), 0u);
+}
+
+// ----------------------------------------------------------------------------
+// Report layout
+
+#if HID_SYSTEMCONTROL_BITMAP
+TEST(system, bitmap_sets_one_bit_per_usage) {
+  // `HID_SYSTEMCONTROL_BITMAP_FIRST_USAGE` is bit 0 of the first byte, and the last of
+  // the fifteen usages is bit 6 of the second; the top bit is padding.
+  EXPECT_EQ(system::Report::size, 2);
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_POWER_DOWN})), {0x01, 0x00});
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_SLEEP, HID_SYSTEM_WAKE_UP})), {0x06, 0x00});
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_MENU_EXIT})), {0x80, 0x00});
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_MENU_SELECT})), {0x00, 0x01});
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_WARM_RESTART})), {0x00, 0x40});
+}
+
+TEST(system, bitmap_ignores_usages_outside_its_range) {
+  system::Report sleep = report({HID_SYSTEM_SLEEP});
+  EXPECT_TRUE(report({0x80, HID_SYSTEM_SLEEP, 0x90, HID_SYSTEM_DOCK}) == sleep);
+  sleep.releaseKeycode(0x80);
+  sleep.releaseKeycode(HID_SYSTEM_DOCK);
+  EXPECT_TRUE(sleep == report({HID_SYSTEM_SLEEP}));
+}
+
+TEST(system, bitmap_releases_only_the_given_usage) {
+  system::Report pressed = report({HID_SYSTEM_SLEEP, HID_SYSTEM_MENU_SELECT});
+  pressed.releaseKeycode(HID_SYSTEM_SLEEP);
+  EXPECT_BYTES(sentBytes(pressed), {0x00, 0x01});
+}
+#else
+TEST(system, report_holds_one_usage) {
+  EXPECT_EQ(system::Report::size, 1);
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_SLEEP})), {HID_SYSTEM_SLEEP});
+  // A press replaces the usage, and a release only clears the same one.
+  EXPECT_BYTES(sentBytes(report({HID_SYSTEM_SLEEP, HID_SYSTEM_DOCK})), {HID_SYSTEM_DOCK});
+  system::Report dock = report({HID_SYSTEM_DOCK});
+  dock.releaseKeycode(HID_SYSTEM_SLEEP);
+  EXPECT_TRUE(dock == report({HID_SYSTEM_DOCK}));
+  dock.releaseKeycode(HID_SYSTEM_DOCK);
+  EXPECT_TRUE(dock == system::Report());
+}
+#endif
@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fake_usb.h"
+
+namespace testing {
+namespace {
+
+Test* first_test = nullptr;
+Test* last_test = nullptr;
+bool current_failed = false;
+
+void printBytes(const std::vector<byte>& bytes) {
+  for (byte b : bytes)
+    printf(" %02x", b);
+  printf("\n");
+}
+
+} // namespace {
+
+Test::Test(const char* suite, const char* name, Function function)
+    : suite(suite), name(name), function(function), next(nullptr) {
+  if (last_test == nullptr) {
+    first_test = this;
+  } else {
+    last_test->next = this;
+  }
+  last_test = this;
+}
+
+void fail(const char* file, int line, const char* check) {
+  printf("%s:%d: failed: %s\n", file, line, check);
+  current_failed = true;
+}
+
+void failEqual(const char* file, int line, const char* check,
+               long long actual, long long expected) {
+  printf("%s:%d: failed: %s\n", file, line, check);
+  printf("  actual:   %lld\n  expected: %lld\n", actual, expected);
+  current_failed = true;
+}
+
+void failBytes(const char* file, int line, const char* check,
+               const std::vector<byte>& actual, const std::vector<byte>& expected) {
+  printf("%s:%d: failed: %s\n", file, line, check);
+  printf("  actual:  ");
+  printBytes(actual);
+  printf("  expected:");
+  printBytes(expected);
+  current_failed = true;
+}
+
+} // namespace testing {
+
+// Runs every test, or only those whose "suite.name" contains the first argument.
+int main(int argc, char* argv[]) {
+  const char* filter = (argc > 1) ? argv[1] : "";
+  int run{0}, failed{0};
+  char full_name[128];
+
+  for (testing::Test* test = testing::first_test; test; test = test->next) {
+    snprintf(full_name, sizeof(full_name), "%s.%s", test->suite, test->name);
+    if (strstr(full_name, filter) == nullptr)
+      continue;
+    fake_usb::reset();
+    testing::current_failed = false;
+    test->function();
+    ++run;
+    if (testing::current_failed) {
+      ++failed;
+      printf("FAIL %s\n", full_name);
+    }
+  }
+
+  printf("%d tests, %d failed\n", run, failed);
+  return (failed == 0) ? 0 : 1;
+}
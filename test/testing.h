@@ -0,0 +1,92 @@
+// -*- c++ -*-
+
+/*
+Copyright (c) 2019 Michael Richters
+
+See the readme for credit to other people.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// A minimal test framework for the host build. A test is defined with
+// `TEST(suite, name) { ... }` in any file linked into the test binary, and the runner
+// (`testing.cpp`) calls every one of them in turn, after resetting the fake USB host. A
+// failed check prints its location and values and marks the test as failed, but the
+// test keeps going.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+namespace testing {
+
+class Test {
+ public:
+  typedef void (*Function)();
+
+  Test(const char* suite, const char* name, Function function);
+
+  const char* suite;
+  const char* name;
+  Function function;
+  Test* next;
+};
+
+void fail(const char* file, int line, const char* check);
+void failEqual(const char* file, int line, const char* check,
+               long long actual, long long expected);
+void failBytes(const char* file, int line, const char* check,
+               const std::vector<byte>& actual, const std::vector<byte>& expected);
+
+} // namespace testing {
+
+#define TEST(suite, name)                                               \
+  static void suite##_##name##_test_();                                 \
+  static testing::Test suite##_##name##_registration_(#suite, #name,    \
+                                                      suite##_##name##_test_); \
+  static void suite##_##name##_test_()
+
+#define EXPECT_TRUE(condition)                                  \
+  do {                                                          \
+    if (!(condition))                                           \
+      testing::fail(__FILE__, __LINE__, #condition);            \
+  } while (0)
+
+#define EXPECT_FALSE(condition) EXPECT_TRUE(!(condition))
+
+// Integers, enums and pointers; the values are printed as integers on failure.
+#define EXPECT_EQ(actual, expected)                                     \
+  do {                                                                  \
+    auto actual_ = (actual);                                            \
+    auto expected_ = (expected);                                        \
+    if (!(actual_ == expected_))                                        \
+      testing::failEqual(__FILE__, __LINE__, #actual " == " #expected,  \
+                         (long long)(actual_), (long long)(expected_)); \
+  } while (0)
+
+// A byte vector against a list of bytes, e.g. `EXPECT_BYTES(packet.data, {0x02, 0x04})`.
+#define EXPECT_BYTES(actual, ...)                                       \
+  do {                                                                  \
+    std::vector<byte> actual_(actual);                                  \
+    std::vector<byte> expected_ __VA_ARGS__;                            \
+    if (actual_ != expected_)                                           \
+      testing::failBytes(__FILE__, __LINE__, #actual, actual_, expected_); \
+  } while (0)